@@ -23,50 +23,134 @@
 #include <linux/module.h>
 #include <linux/acpi.h>
 #include <linux/version.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include "clevo_interfaces.h"
 
+#define lwl_TRACE_SYSTEM lwl_clevo_acpi
+#define CREATE_TRACE_POINTS
+#include "lwl_trace.h"
+
 #define DRIVER_NAME			"clevo_acpi"
 
+// Commands are u8, one slot each
+#define CLEVO_ACPI_STATS_CMDS		0x100
+
+struct clevo_acpi_cmd_stats {
+	u64 calls;
+	u64 errors;
+	u64 total_us;
+	u64 max_us;
+};
+
 struct clevo_acpi_driver_data_t {
 	struct acpi_device *adev;
 	struct clevo_interface_t *clevo_interface;
+
+	/*
+	 * _DSM state prepared on add, the argument package and the integer
+	 * result object are reused by every call under lock
+	 */
+	struct mutex lock;
+	acpi_handle handle;
+	guid_t dsm_guid;
+	union acpi_object dsm_argv4_data;
+	union acpi_object dsm_argv4;
+	union acpi_object dsm_params[4];
+	union acpi_object int_out_obj;
+
+	struct clevo_acpi_cmd_stats stats[CLEVO_ACPI_STATS_CMDS];
+	struct dentry *debugfs_dir;
 };
 
 static struct clevo_acpi_driver_data_t *active_driver_data = NULL;
 
-static int clevo_acpi_evaluate(struct acpi_device *device, u8 cmd, u32 arg, union acpi_object **result)
+static void clevo_acpi_account(struct clevo_acpi_driver_data_t *data, u8 cmd,
+			       u64 arg, int status, u64 delta_us)
 {
-	int status;
-	acpi_handle handle;
-	u64 dsm_rev_dummy = 0x00; // Dummy 0 value since not used
-	u64 dsm_func = cmd;
-	union acpi_object *out_obj;
-	guid_t clevo_acpi_dsm_uuid;
+	struct clevo_acpi_cmd_stats *st = &data->stats[cmd];
 
-	// Integer package data for argument
-	union acpi_object dsm_argv4_package_data[] = {
-		{
-			.integer.type = ACPI_TYPE_INTEGER,
-			.integer.value = arg
-		}
-	};
+	trace_lwl_method_eval(CLEVO_ACPI_DSM_UUID, cmd, arg, status, delta_us);
 
-	// Package argument
-	union acpi_object dsm_argv4 = {
-		.package.type = ACPI_TYPE_PACKAGE,
-		.package.count = 1,
-		.package.elements = dsm_argv4_package_data
-	};
+	st->calls += 1;
+	if (status)
+		st->errors += 1;
+	st->total_us += delta_us;
+	if (delta_us > st->max_us)
+		st->max_us = delta_us;
+}
+
+static int clevo_acpi_stats_show(struct seq_file *m, void *unused)
+{
+	struct clevo_acpi_driver_data_t *data = m->private;
+	struct clevo_acpi_cmd_stats *st;
+	int i;
+
+	seq_puts(m, "cmd calls errors avg_us max_us\n");
+	mutex_lock(&data->lock);
+	for (i = 0; i < CLEVO_ACPI_STATS_CMDS; ++i) {
+		st = &data->stats[i];
+		if (st->calls == 0)
+			continue;
+		seq_printf(m, "0x%02x %llu %llu %llu %llu\n", i, st->calls, st->errors,
+			   div64_u64(st->total_us, st->calls), st->max_us);
+	}
+	mutex_unlock(&data->lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(clevo_acpi_stats);
 
-	status = guid_parse(CLEVO_ACPI_DSM_UUID, &clevo_acpi_dsm_uuid);
-	if (status < 0)
+static int clevo_acpi_prepare(struct clevo_acpi_driver_data_t *data)
+{
+	mutex_init(&data->lock);
+
+	if (guid_parse(CLEVO_ACPI_DSM_UUID, &data->dsm_guid) < 0)
 		return -ENOENT;
 
-	handle = acpi_device_handle(device);
-	if (handle == NULL)
+	data->handle = acpi_device_handle(data->adev);
+	if (data->handle == NULL)
 		return -ENODEV;
 
-	out_obj = acpi_evaluate_dsm(handle, &clevo_acpi_dsm_uuid, dsm_rev_dummy, dsm_func, &dsm_argv4);
+	// Integer package data for argument
+	data->dsm_argv4_data.integer.type = ACPI_TYPE_INTEGER;
+	data->dsm_argv4.package.type = ACPI_TYPE_PACKAGE;
+	data->dsm_argv4.package.count = 1;
+	data->dsm_argv4.package.elements = &data->dsm_argv4_data;
+
+	// _DSM(uuid, rev, func, package) as built by acpi_evaluate_dsm()
+	data->dsm_params[0].type = ACPI_TYPE_BUFFER;
+	data->dsm_params[0].buffer.length = sizeof(data->dsm_guid);
+	data->dsm_params[0].buffer.pointer = (u8 *)&data->dsm_guid;
+	data->dsm_params[1].type = ACPI_TYPE_INTEGER;
+	data->dsm_params[1].integer.value = 0x00; // Dummy 0 value since not used
+	data->dsm_params[2].type = ACPI_TYPE_INTEGER;
+	data->dsm_params[3] = data->dsm_argv4;
+
+	return 0;
+}
+
+static int clevo_acpi_evaluate(struct clevo_acpi_driver_data_t *data, u8 cmd, u32 arg, union acpi_object **result)
+{
+	int status = 0;
+	u64 dsm_rev_dummy = 0x00; // Dummy 0 value since not used
+	union acpi_object *out_obj;
+	ktime_t start;
+
+	mutex_lock(&data->lock);
+
+	data->dsm_argv4_data.integer.value = arg;
+
+	start = ktime_get();
+	out_obj = acpi_evaluate_dsm(data->handle, &data->dsm_guid, dsm_rev_dummy, cmd, &data->dsm_argv4);
+	clevo_acpi_account(data, cmd, arg, out_obj ? 0 : -EIO,
+			   ktime_us_delta(ktime_get(), start));
+
+	mutex_unlock(&data->lock);
+
 	if (!out_obj) {
 		pr_err("failed to evaluate _DSM\n");
 		status = -1;
@@ -74,18 +158,65 @@ static int clevo_acpi_evaluate(struct acpi_device *device, u8 cmd, u32 arg, unio
 	else {
 		if (!IS_ERR_OR_NULL(result)) {
 			*result = out_obj;
+		} else {
+			ACPI_FREE(out_obj);
 		}
 	}
 
 	return status;
 }
 
-static int clevo_acpi_evaluate_pkgbuf(struct acpi_device *device, u8 cmd, u8 *arg, u32 length, union acpi_object **result)
+/**
+ * Evaluate a command returning an integer
+ *
+ * The result lands in the preallocated object, no ACPI allocation takes
+ * place. Results not fitting are not integers and reported as such.
+ */
+static int clevo_acpi_evaluate_int(struct clevo_acpi_driver_data_t *data, u8 cmd, u32 arg, u32 *result)
 {
-	int status;
-	acpi_handle handle;
+	struct acpi_object_list input = { ARRAY_SIZE(data->dsm_params), data->dsm_params };
+	struct acpi_buffer output;
+	acpi_status acpi_status;
+	ktime_t start;
+	int status = 0;
+
+	mutex_lock(&data->lock);
+
+	data->dsm_argv4_data.integer.value = arg;
+	data->dsm_params[2].integer.value = cmd;
+	output.length = sizeof(data->int_out_obj);
+	output.pointer = &data->int_out_obj;
+	// A method without return value leaves the object untouched
+	data->int_out_obj.type = ACPI_TYPE_ANY;
+
+	start = ktime_get();
+	acpi_status = acpi_evaluate_object(data->handle, "_DSM", &input, &output);
+	if (acpi_status == AE_BUFFER_OVERFLOW) {
+		pr_err("return type not integer, use clevo_evaluate_method2\n");
+		status = -ENODATA;
+	} else if (ACPI_FAILURE(acpi_status)) {
+		pr_err("failed to evaluate _DSM\n");
+		status = -EIO;
+	} else if (output.length == 0) {
+		pr_err("no return value\n");
+		status = -ENODATA;
+	} else if (data->int_out_obj.type != ACPI_TYPE_INTEGER) {
+		pr_err("return type not integer, use clevo_evaluate_method2\n");
+		status = -ENODATA;
+	} else if (!IS_ERR_OR_NULL(result)) {
+		*result = (u32) data->int_out_obj.integer.value;
+	}
+	clevo_acpi_account(data, cmd, arg, status, ktime_us_delta(ktime_get(), start));
+
+	mutex_unlock(&data->lock);
+
+	return status;
+}
+
+static int clevo_acpi_evaluate_pkgbuf(struct clevo_acpi_driver_data_t *data, u8 cmd, u8 *arg, u32 length, union acpi_object **result)
+{
+	int status = 0;
 	u64 dsm_rev_dummy = 0x00; // Dummy 0 value since not used
-	u64 dsm_func = cmd;
 
 	// Use a buffer inside a package
 	union acpi_object args = {
@@ -102,18 +233,18 @@ static int clevo_acpi_evaluate_pkgbuf(struct acpi_device *device, u8 cmd, u8 *ar
 	};
 
 	union acpi_object *out_obj;
+	ktime_t start;
 
-	guid_t clevo_acpi_dsm_uuid;
+	mutex_lock(&data->lock);
 
-	status = guid_parse(CLEVO_ACPI_DSM_UUID, &clevo_acpi_dsm_uuid);
-	if (status < 0)
-		return -ENOENT;
+	start = ktime_get();
+	out_obj = acpi_evaluate_dsm(data->handle, &data->dsm_guid, dsm_rev_dummy, cmd, &dsm_argv4);
+	// Buffer argument, the length is traced
+	clevo_acpi_account(data, cmd, length, out_obj ? 0 : -EIO,
+			   ktime_us_delta(ktime_get(), start));
 
-	handle = acpi_device_handle(device);
-	if (handle == NULL)
-		return -ENODEV;
+	mutex_unlock(&data->lock);
 
-	out_obj = acpi_evaluate_dsm(handle, &clevo_acpi_dsm_uuid, dsm_rev_dummy, dsm_func, &dsm_argv4);
 	if (!out_obj) {
 		pr_err("failed to evaluate _DSM\n");
 		status = -1;
@@ -121,6 +252,8 @@ static int clevo_acpi_evaluate_pkgbuf(struct acpi_device *device, u8 cmd, u8 *ar
 	else {
 		if (!IS_ERR_OR_NULL(result)) {
 			*result = out_obj;
+		} else {
+			ACPI_FREE(out_obj);
 		}
 	}
 
@@ -132,7 +265,7 @@ static int clevo_acpi_interface_method_call(u8 cmd, u32 arg, union acpi_object *
 	int status = 0;
 
 	if (!IS_ERR_OR_NULL(active_driver_data)) {
-		status = clevo_acpi_evaluate(active_driver_data->adev, cmd, arg, result_value);
+		status = clevo_acpi_evaluate(active_driver_data, cmd, arg, result_value);
 	} else {
 		pr_err("acpi method call exec, no driver data found\n");
 		pr_err("..for method_call: %0#4x arg: %0#10x\n", cmd, arg);
@@ -148,7 +281,7 @@ static int clevo_acpi_interface_method_call_pkgbuf(u8 cmd, u8 *arg, u32 length,
 	int status = 0;
 
 	if (!IS_ERR_OR_NULL(active_driver_data)) {
-		status = clevo_acpi_evaluate_pkgbuf(active_driver_data->adev, cmd, arg, length, result_value);
+		status = clevo_acpi_evaluate_pkgbuf(active_driver_data, cmd, arg, length, result_value);
 	} else {
 		pr_err("acpi method call exec, no driver data found\n");
 		pr_err("..for method_call: %0#2x\n", cmd);
@@ -158,15 +291,28 @@ static int clevo_acpi_interface_method_call_pkgbuf(u8 cmd, u8 *arg, u32 length,
 	return status;
 }
 
+static int clevo_acpi_interface_method_call_int(u8 cmd, u32 arg, u32 *result)
+{
+	if (IS_ERR_OR_NULL(active_driver_data)) {
+		pr_err("acpi method call exec, no driver data found\n");
+		pr_err("..for method_call: %0#4x arg: %0#10x\n", cmd, arg);
+		return -ENODATA;
+	}
+
+	return clevo_acpi_evaluate_int(active_driver_data, cmd, arg, result);
+}
+
 struct clevo_interface_t clevo_acpi_interface = {
 	.string_id = CLEVO_INTERFACE_ACPI_STRID,
 	.method_call = clevo_acpi_interface_method_call,
 	.method_call_pkgbuf = clevo_acpi_interface_method_call_pkgbuf,
+	.method_call_int = clevo_acpi_interface_method_call_int,
 };
 
 static int clevo_acpi_add(struct acpi_device *device)
 {
 	struct clevo_acpi_driver_data_t *driver_data;
+	int err;
 
 	driver_data = devm_kzalloc(&device->dev, sizeof(*driver_data), GFP_KERNEL);
 	if (!driver_data)
@@ -175,8 +321,17 @@ static int clevo_acpi_add(struct acpi_device *device)
 	driver_data->adev = device;
 	driver_data->clevo_interface = &clevo_acpi_interface;
 
+	err = clevo_acpi_prepare(driver_data);
+	if (err)
+		return err;
+
+	device->driver_data = driver_data;
 	active_driver_data = driver_data;
 
+	driver_data->debugfs_dir = debugfs_create_dir(DRIVER_NAME, NULL);
+	debugfs_create_file("method_stats", 0444, driver_data->debugfs_dir, driver_data,
+			    &clevo_acpi_stats_fops);
+
 	pr_debug("clevo_acpi driver add\n");
 
 	// Add this interface
@@ -193,9 +348,12 @@ static int clevo_acpi_remove(struct acpi_device *device)
 static void clevo_acpi_remove(struct acpi_device *device)
 #endif
 {
+	struct clevo_acpi_driver_data_t *driver_data = acpi_driver_data(device);
+
 	pr_debug("clevo_acpi driver remove\n");
 	clevo_keyboard_remove_interface(&clevo_acpi_interface);
 	active_driver_data = NULL;
+	debugfs_remove_recursive(driver_data->debugfs_dir);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
 	return 0;
 #endif
@@ -203,20 +361,10 @@ static void clevo_acpi_remove(struct acpi_device *device)
 
 static void clevo_acpi_notify(struct acpi_device *device, u32 event)
 {
-	u32 event_value;
-	union acpi_object *out_obj;
-	int status;
+	u32 event_value = 0;
 	// struct clevo_acpi_driver_data_t *clevo_acpi_driver_data;
 
-	status = clevo_acpi_evaluate(device, 0x01, 0, &out_obj);
-	if (!status) {
-			if (out_obj->type == ACPI_TYPE_INTEGER) {
-				event_value = (u32)out_obj->integer.value;
-			} else {
-				pr_err("return type not integer, use clevo_evaluate_method2\n");
-			}
-			ACPI_FREE(out_obj);
-	}
+	clevo_acpi_evaluate_int(acpi_driver_data(device), 0x01, 0, &event_value);
 	pr_debug("clevo_acpi event: %0#6x, clevo event value: %0#6x\n", event, event_value);
 
 	// clevo_acpi_driver_data = container_of(&device, struct clevo_acpi_driver_data_t, adev);
@@ -73,11 +73,19 @@
 #define CLEVO_CMD_OPT			0x79
 #define CLEVO_CMD_OPT_SUB_SET_PERF_PROF	0x19
 
+// Performance profile values for CLEVO_CMD_OPT_SUB_SET_PERF_PROF
+#define CLEVO_PERF_PROF_QUIET		0x00
+#define CLEVO_PERF_PROF_POWERSAVE	0x01
+#define CLEVO_PERF_PROF_PERFORMANCE	0x02
+#define CLEVO_PERF_PROF_ENTERTAINMENT	0x03
+
 struct clevo_interface_t {
 	char *string_id;
 	void (*event_callb)(u32);
 	int (*method_call)(u8, u32, union acpi_object **);
 	int (*method_call_pkgbuf)(u8, u8 *, u32, union acpi_object **);
+	// Optional, integer result without returning an allocated object
+	int (*method_call_int)(u8, u32, u32 *);
 };
 
 int clevo_keyboard_add_interface(struct clevo_interface_t *new_interface);
@@ -85,6 +93,7 @@ int clevo_keyboard_remove_interface(struct clevo_interface_t *interface);
 int clevo_evaluate_method(u8 cmd, u32 arg, u32 *result);
 int clevo_evaluate_method2(u8 cmd, u32 arg, union acpi_object **result);
 int clevo_get_active_interface_id(char **id_str);
+int clevo_set_performance_profile(u8 profile);
 
 #define MODULE_ALIAS_CLEVO_WMI() \
 	MODULE_ALIAS("wmi:" CLEVO_WMI_EVENT_GUID); \
@@ -24,10 +24,13 @@
 #include <linux/power_supply.h>
 #include <acpi/battery.h>
 #include <linux/version.h>
+#include <linux/debugfs.h>
 
 #include "lwl_keyboard_common.h"
 #include "clevo_interfaces.h"
 #include "clevo_leds.h"
+#include "lwl_platform_profile.h"
+#include "lwl_state_restore.h"
 
 // Clevo event codes
 #define CLEVO_EVENT_KB_LEDS_DECREASE		0x81
@@ -58,6 +61,11 @@ static struct clevo_interfaces_t {
 	struct clevo_interface_t *acpi;
 } clevo_interfaces;
 
+static struct dentry *clevo_keyboard_debugfs_dir;
+
+// Settings replayed on resume
+static struct lwl_state clevo_state = lwl_STATE_INIT(clevo_state);
+
 static struct clevo_interface_t *active_clevo_interface;
 
 static struct lwl_keyboard_driver clevo_keyboard_driver;
@@ -160,6 +168,9 @@ int clevo_evaluate_method(u8 cmd, u32 arg, u32 *result)
 	int status = 0;
 	union acpi_object *out_obj;
 
+	if (!IS_ERR_OR_NULL(active_clevo_interface) && active_clevo_interface->method_call_int)
+		return active_clevo_interface->method_call_int(cmd, arg, result);
+
 	status = clevo_evaluate_method2(cmd, arg, &out_obj);
 	if (status) {
 		return status;
@@ -601,27 +612,16 @@ static int clevo_legacy_flexicharger_read(u8 *start, u8 *end, u8 *status)
 /**
  * Write flexicharger data.
  * 
- * @param start Start threshold
- * @param end End threshold
- * @param status On or Off (1 or 0)
+ * @param set_start Start threshold
+ * @param set_end End threshold
+ * @param set_status On or Off (1 or 0)
  */
-static int clevo_legacy_flexicharger_write(const u8 *param_start, const u8 *param_end, const u8 *param_status)
+static int clevo_legacy_flexicharger_write(u8 set_start, u8 set_end, u8 set_status)
 {
 	// Two different subcommands for writing
 	u32 write_data_thresholds = (0x06 << 0x18);
 	u32 write_data_status = (0x05 << 0x18);
 
-	u8 previous_start, previous_end, previous_status;
-	u8 set_start, set_end, set_status;
-
-	if (clevo_legacy_flexicharger_read(&previous_start, &previous_end, &previous_status) != 0)
-		return -EIO;
-
-	// Set choosen parameters, leave nulled ones with previous value
-	set_start = param_start != NULL ? *param_start : previous_start;
-	set_end = param_end != NULL ? *param_end : previous_end;
-	set_status = param_status != NULL ? *param_status : previous_status;
-
 	write_data_thresholds |= set_start;
 	write_data_thresholds |= (set_end << 0x08);
 	write_data_status |= set_status & 0x01;
@@ -679,23 +679,11 @@ static int clevo_has_cc4_flexicharger(bool *status)
 	return 0;
 }
 
-static int clevo_cc4_flexicharger_write(const u8 *param_start,
-					const u8 *param_end,
-					const u8 *param_status)
+static int clevo_cc4_flexicharger_write(u8 set_start, u8 set_end, u8 set_status)
 {
 	union acpi_object *dummy_out;
-	u8 previous_start, previous_end, previous_status;
-	u8 set_start, set_end, set_status;
 	u8 buffer_set[0xff] = { 0x1f };
 
-	if (clevo_cc4_flexicharger_read(&previous_start, &previous_end, &previous_status))
-		return -EIO;
-
-	// Set choosen parameters, leave nulled ones with previous value
-	set_start = param_start != NULL ? *param_start : previous_start;
-	set_end = param_end != NULL ? *param_end : previous_end;
-	set_status = param_status != NULL ? *param_status : previous_status;
-
 	buffer_set[1] = set_status;
 	buffer_set[2] = set_start;
 	buffer_set[3] = set_end;
@@ -708,26 +696,173 @@ static int clevo_cc4_flexicharger_write(const u8 *param_start,
 	return 0;
 }
 
-static int clevo_flexicharger_read(u8 *start, u8 *end, u8 *status)
+enum clevo_flexicharger_type {
+	CLEVO_FLEXICHARGER_NONE,
+	CLEVO_FLEXICHARGER_LEGACY,
+	CLEVO_FLEXICHARGER_CC4,
+};
+
+/*
+ * Flexicharger type is identified once, the last read or written values
+ * are kept so that reads don't reach firmware. Nothing else changes the
+ * values at runtime, the cache is refreshed on resume.
+ */
+static struct {
+	struct mutex lock;
+	enum clevo_flexicharger_type type;
+	bool valid;
+	u8 start;
+	u8 end;
+	u8 status;
+} clevo_flexicharger;
+
+static enum clevo_flexicharger_type clevo_flexicharger_identify(void)
 {
+	bool has_legacy_flexicharger;
 	bool has_cc4_flexicharger;
+
 	clevo_has_cc4_flexicharger(&has_cc4_flexicharger);
-	if (has_cc4_flexicharger)
-		return clevo_cc4_flexicharger_read(start, end, status);
+	if (has_cc4_flexicharger) {
+		pr_debug("cc4 flexicharger identified\n");
+		return CLEVO_FLEXICHARGER_CC4;
+	}
+
+	clevo_has_legacy_flexicharger(&has_legacy_flexicharger);
+	if (has_legacy_flexicharger) {
+		pr_debug("legacy flexicharger identified\n");
+		return CLEVO_FLEXICHARGER_LEGACY;
+	}
+
+	return CLEVO_FLEXICHARGER_NONE;
+}
+
+static int __clevo_flexicharger_refresh(void)
+{
+	int result;
+
+	clevo_flexicharger.valid = false;
+
+	switch (clevo_flexicharger.type) {
+	case CLEVO_FLEXICHARGER_CC4:
+		result = clevo_cc4_flexicharger_read(&clevo_flexicharger.start,
+						     &clevo_flexicharger.end,
+						     &clevo_flexicharger.status);
+		break;
+	case CLEVO_FLEXICHARGER_LEGACY:
+		result = clevo_legacy_flexicharger_read(&clevo_flexicharger.start,
+							&clevo_flexicharger.end,
+							&clevo_flexicharger.status);
+		break;
+	default:
+		return -ENODEV;
+	}
+
+	if (result)
+		return result;
+
+	clevo_flexicharger.valid = true;
+
+	return 0;
+}
+
+static int clevo_flexicharger_read(u8 *start, u8 *end, u8 *status)
+{
+	int result = 0;
+
+	mutex_lock(&clevo_flexicharger.lock);
+
+	if (!clevo_flexicharger.valid)
+		result = __clevo_flexicharger_refresh();
+
+	if (!result) {
+		if (start != NULL)
+			*start = clevo_flexicharger.start;
+		if (end != NULL)
+			*end = clevo_flexicharger.end;
+		if (status != NULL)
+			*status = clevo_flexicharger.status;
+	}
+
+	mutex_unlock(&clevo_flexicharger.lock);
+
+	return result;
+}
+
+/**
+ * Write all values, called with lock held
+ */
+static int __clevo_flexicharger_write(u8 set_start, u8 set_end, u8 set_status)
+{
+	int result;
+
+	if (clevo_flexicharger.type == CLEVO_FLEXICHARGER_CC4)
+		result = clevo_cc4_flexicharger_write(set_start, set_end, set_status);
 	else
-		return clevo_legacy_flexicharger_read(start, end, status);
+		result = clevo_legacy_flexicharger_write(set_start, set_end, set_status);
+
+	if (result) {
+		// Partial writes possible, read back next time
+		clevo_flexicharger.valid = false;
+	} else {
+		clevo_flexicharger.start = set_start;
+		clevo_flexicharger.end = set_end;
+		clevo_flexicharger.status = set_status;
+	}
+
+	return result;
+}
+
+// Start, end and status packed into one value
+#define CLEVO_FLEXICHARGER_STATE(start, end, status) \
+	((u64)(start) | ((u64)(end) << 8) | ((u64)(status) << 16))
+
+static int clevo_flexicharger_restore(struct lwl_state_item *item, u64 value)
+{
+	int result;
+
+	if (clevo_flexicharger.type == CLEVO_FLEXICHARGER_NONE)
+		return -ENODEV;
+
+	mutex_lock(&clevo_flexicharger.lock);
+	result = __clevo_flexicharger_write(value & 0xff, (value >> 8) & 0xff, (value >> 16) & 0xff);
+	mutex_unlock(&clevo_flexicharger.lock);
+
+	return result;
 }
 
+static struct lwl_state_item clevo_state_flexicharger =
+	lwl_STATE_ITEM("flexicharger", lwl_STATE_STAGE_CHARGING, clevo_flexicharger_restore);
+
 static int clevo_flexicharger_write(const u8 *param_start,
 				    const u8 *param_end,
 				    const u8 *param_status)
 {
-	bool has_cc4_flexicharger;
-	clevo_has_cc4_flexicharger(&has_cc4_flexicharger);
-	if (has_cc4_flexicharger)
-		return clevo_cc4_flexicharger_write(param_start, param_end, param_status);
-	else
-		return clevo_legacy_flexicharger_write(param_start, param_end, param_status);
+	u8 set_start, set_end, set_status;
+	int result = 0;
+
+	mutex_lock(&clevo_flexicharger.lock);
+
+	if (!clevo_flexicharger.valid)
+		result = __clevo_flexicharger_refresh();
+	if (result) {
+		mutex_unlock(&clevo_flexicharger.lock);
+		return -EIO;
+	}
+
+	// Set choosen parameters, leave nulled ones with previous value
+	set_start = param_start != NULL ? *param_start : clevo_flexicharger.start;
+	set_end = param_end != NULL ? *param_end : clevo_flexicharger.end;
+	set_status = param_status != NULL ? *param_status : clevo_flexicharger.status;
+
+	result = __clevo_flexicharger_write(set_start, set_end, set_status);
+
+	mutex_unlock(&clevo_flexicharger.lock);
+
+	if (result == 0)
+		lwl_state_record(&clevo_state, &clevo_state_flexicharger,
+				 CLEVO_FLEXICHARGER_STATE(set_start, set_end, set_status));
+
+	return result;
 }
 
 static ssize_t charge_type_show(struct device *device,
@@ -921,22 +1056,8 @@ static int clevo_battery_add(struct power_supply *battery)
 static int clevo_battery_add(struct power_supply *battery, struct acpi_battery_hook *hook)
 #endif
 {
-	bool has_legacy_flexicharger;
-	bool has_cc4_flexicharger;
-
-	clevo_has_legacy_flexicharger(&has_legacy_flexicharger);
-	clevo_has_cc4_flexicharger(&has_cc4_flexicharger);
-
-	if (has_cc4_flexicharger) {
-		pr_debug("cc4 flexicharger identified\n");
-	}
-
-	if (has_legacy_flexicharger) {
-		pr_debug("legacy flexicharger identified\n");
-	}
-
-	// Check support and type
-	if (!has_legacy_flexicharger && !has_cc4_flexicharger)
+	// Check support, type identified on init
+	if (clevo_flexicharger.type == CLEVO_FLEXICHARGER_NONE)
 		return -ENODEV;
 
 	if (device_add_groups(&battery->dev, clevo_battery_groups))
@@ -965,15 +1086,184 @@ static struct acpi_battery_hook battery_hook = {
 
 static void clevo_flexicharger_init(void)
 {
+	mutex_init(&clevo_flexicharger.lock);
+	clevo_flexicharger.type = clevo_flexicharger_identify();
+	clevo_flexicharger.valid = false;
+
+	if (clevo_flexicharger.type == CLEVO_FLEXICHARGER_NONE)
+		return;
+
+	lwl_state_add(&clevo_state, &clevo_state_flexicharger);
 	battery_hook_register(&battery_hook);
 }
 
+/**
+ * Reread values after resume, firmware may have reset them. The type is
+ * only identified again when the known interface stops answering.
+ */
+static void clevo_flexicharger_resume(void)
+{
+	enum clevo_flexicharger_type type;
+
+	if (clevo_flexicharger.type == CLEVO_FLEXICHARGER_NONE)
+		return;
+
+	mutex_lock(&clevo_flexicharger.lock);
+	if (__clevo_flexicharger_refresh()) {
+		type = clevo_flexicharger_identify();
+		if (type != clevo_flexicharger.type) {
+			pr_debug("flexicharger type changed on resume: %d -> %d\n",
+				 clevo_flexicharger.type, type);
+			// Attributes stay registered, they return -ENODEV for none
+			clevo_flexicharger.type = type;
+			__clevo_flexicharger_refresh();
+		}
+	}
+	mutex_unlock(&clevo_flexicharger.lock);
+}
+
 static void clevo_flexicharger_remove(void)
 {
 	if (charge_control_registered)
 		battery_hook_unregister(&battery_hook);
 }
 
+// Performance profile
+
+static struct lwl_platform_profile clevo_platform_profile;
+static DEFINE_MUTEX(clevo_platform_profile_lock);
+static struct device *clevo_platform_profile_parent;
+
+// Not readable from firmware, last written value, only valid once written
+static u8 clevo_perf_profile = CLEVO_PERF_PROF_ENTERTAINMENT;
+static bool clevo_perf_profile_known;
+
+static const struct lwl_platform_profile_map clevo_platform_profile_map[] = {
+	{ .profile = PLATFORM_PROFILE_LOW_POWER,	.native = CLEVO_PERF_PROF_POWERSAVE },
+	{ .profile = PLATFORM_PROFILE_QUIET,		.native = CLEVO_PERF_PROF_QUIET },
+	{ .profile = PLATFORM_PROFILE_BALANCED,		.native = CLEVO_PERF_PROF_ENTERTAINMENT },
+	{ .profile = PLATFORM_PROFILE_PERFORMANCE,	.native = CLEVO_PERF_PROF_PERFORMANCE },
+};
+
+static int __clevo_write_performance_profile(u8 profile)
+{
+	int err;
+	u32 clevo_arg = (CLEVO_CMD_OPT_SUB_SET_PERF_PROF << 0x18) | profile;
+
+	if (profile > CLEVO_PERF_PROF_ENTERTAINMENT)
+		return -EINVAL;
+
+	err = clevo_evaluate_method(CLEVO_CMD_OPT, clevo_arg, NULL);
+	if (err)
+		return err;
+
+	clevo_perf_profile = profile;
+	clevo_perf_profile_known = true;
+
+	return 0;
+}
+
+static int clevo_performance_profile_restore(struct lwl_state_item *item, u64 value)
+{
+	return __clevo_write_performance_profile(value);
+}
+
+static struct lwl_state_item clevo_state_performance_profile =
+	lwl_STATE_ITEM("performance_profile", lwl_STATE_STAGE_PROFILE, clevo_performance_profile_restore);
+
+static void clevo_platform_profile_register(void);
+
+int clevo_set_performance_profile(u8 profile)
+{
+	int err;
+
+	err = __clevo_write_performance_profile(profile);
+	if (err)
+		return err;
+
+	lwl_state_record(&clevo_state, &clevo_state_performance_profile, profile);
+
+	mutex_lock(&clevo_platform_profile_lock);
+	if (clevo_platform_profile.registered)
+		lwl_platform_profile_notify(&clevo_platform_profile);
+	else
+		clevo_platform_profile_register();
+	mutex_unlock(&clevo_platform_profile_lock);
+
+	return 0;
+}
+EXPORT_SYMBOL(clevo_set_performance_profile);
+
+static int clevo_platform_profile_get_native(void *drvdata, u64 *native)
+{
+	*native = clevo_perf_profile;
+	return 0;
+}
+
+static int clevo_platform_profile_set_native(void *drvdata, u64 native)
+{
+	int err;
+
+	err = __clevo_write_performance_profile(native);
+	if (err)
+		return err;
+
+	lwl_state_record(&clevo_state, &clevo_state_performance_profile, native);
+
+	return 0;
+}
+
+static const struct lwl_platform_profile_ops clevo_platform_profile_ops = {
+	.get = clevo_platform_profile_get_native,
+	.set = clevo_platform_profile_set_native,
+};
+
+/**
+ * Register the handler, called with clevo_platform_profile_lock held
+ *
+ * The profile can not be read back and writing one only to probe would
+ * override the choice of the user or firmware. Registration therefore
+ * waits for the first successful write, which both shows that the method
+ * works and makes the reported profile the real one.
+ */
+static void clevo_platform_profile_register(void)
+{
+	int err;
+
+	if (!clevo_platform_profile_parent || !clevo_perf_profile_known)
+		return;
+
+	err = lwl_platform_profile_register(&clevo_platform_profile, clevo_platform_profile_parent);
+	if (err)
+		lwl_DEBUG("platform_profile handler not registered: %d\n", err);
+	// Don't retry on every write
+	clevo_platform_profile_parent = NULL;
+}
+
+static void clevo_platform_profile_init(struct platform_device *dev)
+{
+	clevo_platform_profile.name = "lwl-clevo";
+	clevo_platform_profile.map = clevo_platform_profile_map;
+	clevo_platform_profile.map_size = ARRAY_SIZE(clevo_platform_profile_map);
+	clevo_platform_profile.ops = &clevo_platform_profile_ops;
+
+	lwl_state_add(&clevo_state, &clevo_state_performance_profile);
+
+	mutex_lock(&clevo_platform_profile_lock);
+	clevo_platform_profile_parent = &dev->dev;
+	// Registers right away when the init workaround wrote a profile
+	clevo_platform_profile_register();
+	mutex_unlock(&clevo_platform_profile_lock);
+}
+
+static void clevo_platform_profile_remove(void)
+{
+	mutex_lock(&clevo_platform_profile_lock);
+	clevo_platform_profile_parent = NULL;
+	lwl_platform_profile_unregister(&clevo_platform_profile);
+	mutex_unlock(&clevo_platform_profile_lock);
+}
+
 static void clevo_keyboard_init(void)
 {
 	bool performance_profile_set_workaround;
@@ -1000,19 +1290,38 @@ static void clevo_keyboard_init(void)
 		;
 	if (performance_profile_set_workaround) {
 		lwl_INFO("Performance profile 'performance' set workaround applied\n");
-		clevo_evaluate_method(CLEVO_CMD_OPT, 0x19000002, NULL);
+		__clevo_write_performance_profile(CLEVO_PERF_PROF_PERFORMANCE);
 	}
 
 	clevo_flexicharger_init();
 }
 
+static int clevo_leds_state_restore(struct lwl_state_item *item, u64 value)
+{
+	// Sometimes clevo devices forget their last state after suspend, so
+	// let the kernel ensure it.
+	clevo_leds_restore_state_extern();
+
+	return 0;
+}
+
+static struct lwl_state_item clevo_state_leds =
+	lwl_STATE_ITEM("leds", lwl_STATE_STAGE_LEDS, clevo_leds_state_restore);
+
 static int clevo_keyboard_probe(struct platform_device *dev)
 {
+	clevo_keyboard_debugfs_dir = debugfs_create_dir("clevo_keyboard", NULL);
+	lwl_state_debugfs_init(&clevo_state, clevo_keyboard_debugfs_dir);
+
 	clevo_leds_init(dev);
+	// Backlight state is kept by the LED driver itself
+	lwl_state_record(&clevo_state, &clevo_state_leds, 0);
+	lwl_state_add(&clevo_state, &clevo_state_leds);
 	// clevo_keyboard_init_device_interface() must come after clevo_leds_init()
 	// to know keyboard backlight type
 	clevo_keyboard_init_device_interface(dev);
 	clevo_keyboard_init();
+	clevo_platform_profile_init(dev);
 
 	return 0;
 }
@@ -1030,9 +1339,14 @@ static int clevo_keyboard_remove(struct platform_device *dev)
 static void clevo_keyboard_remove(struct platform_device *dev)
 #endif
 {
+	clevo_platform_profile_remove();
 	clevo_flexicharger_remove();
 	clevo_keyboard_remove_device_interface(dev);
 	clevo_leds_remove(dev);
+	lwl_state_clear(&clevo_state);
+	lwl_state_debugfs_remove(&clevo_state);
+	debugfs_remove_recursive(clevo_keyboard_debugfs_dir);
+	clevo_keyboard_debugfs_dir = NULL;
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0)
 	return 0;
 #endif
@@ -1047,8 +1361,8 @@ static int clevo_keyboard_suspend(struct platform_device *dev, pm_message_t stat
 static int clevo_keyboard_resume(struct platform_device *dev)
 {
 	clevo_evaluate_method(CLEVO_CMD_SET_EVENTS_ENABLED, 0, NULL);
-	clevo_leds_restore_state_extern(); // Sometimes clevo devices forget their last state after
-					   // suspend, so let the kernel ensure it.
+	clevo_flexicharger_resume();
+	lwl_state_restore_all(&clevo_state);
 	clevo_leds_resume(dev);
 	return 0;
 }
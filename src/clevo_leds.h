@@ -49,10 +49,13 @@ static bool dmi_string_in(enum dmi_field f, const char *str);
 #include "clevo_leds.h"
 
 #include "clevo_interfaces.h"
+#include "lwl_led_effects.h"
 
 #include <linux/led-class-multicolor.h>
 #include <linux/delay.h>
 #include <linux/dmi.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
 
 #define CLEVO_KBD_BRIGHTNESS_MAX			0xff
 #define CLEVO_KBD_BRIGHTNESS_DEFAULT			0x00
@@ -68,9 +71,35 @@ static bool dmi_string_in(enum dmi_field f, const char *str);
 #define CLEVO_KB_COLOR_DEFAULT_BLUE			0xff
 #define CLEVO_KB_COLOR_DEFAULT				((CLEVO_KB_COLOR_DEFAULT_RED << 16) + (CLEVO_KB_COLOR_DEFAULT_GREEN << 8) + CLEVO_KB_COLOR_DEFAULT_BLUE)
 
+// RGB updates requested within one frame are written together
+#define CLEVO_KBD_RGB_FRAME_MS				16
+
 static enum clevo_kb_backlight_types clevo_kb_backlight_type = CLEVO_KB_BACKLIGHT_TYPE_NONE;
 static bool leds_initialized = false;
 
+/*
+ * RGB state requested by brightness_set and the state last written to
+ * firmware. Brightness is global in firmware, color is per zone. The work
+ * item only writes values that differ from what firmware already has.
+ */
+static struct {
+	spinlock_t lock;
+	struct delayed_work work;
+	u8 brightness;
+	u32 color[3];
+	// Set to write everything again, e.g. after resume
+	bool invalidate;
+
+	// Only accessed by the work item
+	bool fw_brightness_valid;
+	u8 fw_brightness;
+	bool fw_color_valid[3];
+	u32 fw_color[3];
+} clevo_rgb_state;
+
+// Zones as one row, left to right
+static struct lwl_led_effect clevo_led_effect;
+
 /**
  * Color scaling quirk list
  */
@@ -163,39 +192,139 @@ static void clevo_leds_set_brightness(struct led_classdev *led_cdev __always_unu
 //    the whole keyboard brightness and not just one zone
 // This is a temporary fix until KDE handles multiple keyboard backlights correctly
 static struct led_classdev_mc clevo_mcled_cdevs[3]; // forward declaration
+
+static void clevo_leds_rgb_work_func(struct work_struct *work)
+{
+	unsigned long flags;
+	int ret, i, zones;
+	u8 brightness;
+	u32 color[3];
+	bool invalidate;
+
+	spin_lock_irqsave(&clevo_rgb_state.lock, flags);
+	brightness = clevo_rgb_state.brightness;
+	memcpy(color, clevo_rgb_state.color, sizeof(color));
+	invalidate = clevo_rgb_state.invalidate;
+	clevo_rgb_state.invalidate = false;
+	spin_unlock_irqrestore(&clevo_rgb_state.lock, flags);
+
+	zones = clevo_kb_backlight_type == CLEVO_KB_BACKLIGHT_TYPE_3_ZONE_RGB ? 3 : 1;
+
+	if (invalidate) {
+		clevo_rgb_state.fw_brightness_valid = false;
+		for (i = 0; i < zones; ++i)
+			clevo_rgb_state.fw_color_valid[i] = false;
+	}
+
+	if (!clevo_rgb_state.fw_brightness_valid || clevo_rgb_state.fw_brightness != brightness) {
+		ret = clevo_evaluate_set_rgb_brightness(brightness);
+		if (ret) {
+			pr_debug("clevo_leds_rgb_work_func(): clevo_evaluate_set_rgb_brightness() failed\n");
+		} else {
+			clevo_rgb_state.fw_brightness = brightness;
+			clevo_rgb_state.fw_brightness_valid = true;
+		}
+	}
+
+	for (i = 0; i < zones; ++i) {
+		if (clevo_rgb_state.fw_color_valid[i] && clevo_rgb_state.fw_color[i] == color[i])
+			continue;
+
+		ret = clevo_evaluate_set_rgb_color(clevo_mcled_cdevs[i].subled_info[0].channel, color[i]);
+		if (ret) {
+			pr_debug("clevo_leds_rgb_work_func(): clevo_evaluate_set_rgb_color() failed\n");
+			continue;
+		}
+		clevo_rgb_state.fw_color[i] = color[i];
+		clevo_rgb_state.fw_color_valid[i] = true;
+	}
+}
+
+static u32 clevo_leds_zone_color(u8 red, u8 green, u8 blue)
+{
+	color_scaling(&clevo_kb_backlight_type, &red, &green, &blue);
+
+	return (red << 16) +
+	       (green << 8) +
+	       blue;
+}
+
 static void clevo_leds_set_brightness_mc(struct led_classdev *led_cdev, enum led_brightness brightness) {
-	int ret;
-	u32 zone, color;
-	u8 red, green, blue;
+	unsigned long flags;
+	int zone;
+	u32 color;
 	struct led_classdev_mc *mcled_cdev = lcdev_to_mccdev(led_cdev);
 
-	ret = clevo_evaluate_set_rgb_brightness(brightness);
-	if (ret) {
-		pr_debug("clevo_leds_set_brightness_mc(): clevo_evaluate_set_rgb_brightness() failed\n");
-		return;
-	}
+	zone = mcled_cdev - clevo_mcled_cdevs;
+
 	clevo_mcled_cdevs[0].led_cdev.brightness = brightness;
 	clevo_mcled_cdevs[1].led_cdev.brightness = brightness;
 	clevo_mcled_cdevs[2].led_cdev.brightness = brightness;
 
-	zone = mcled_cdev->subled_info[0].channel;
+	color = clevo_leds_zone_color(mcled_cdev->subled_info[0].intensity,
+				      mcled_cdev->subled_info[1].intensity,
+				      mcled_cdev->subled_info[2].intensity);
 
-	red = mcled_cdev->subled_info[0].intensity;
-	green = mcled_cdev->subled_info[1].intensity;
-	blue = mcled_cdev->subled_info[2].intensity;
+	spin_lock_irqsave(&clevo_rgb_state.lock, flags);
+	clevo_rgb_state.brightness = brightness;
+	// A running effect owns the zone colors, the new color shows once it ends
+	if (!lwl_led_effect_active(&clevo_led_effect))
+		clevo_rgb_state.color[zone] = color;
+	spin_unlock_irqrestore(&clevo_rgb_state.lock, flags);
 
-	color_scaling(&clevo_kb_backlight_type, &red, &green, &blue);
+	lwl_led_effect_set_enabled(&clevo_led_effect, brightness != 0);
 
-	color = (red << 16) +
-		(green << 8) +
-		blue;
+	// Already pending work picks up the new state
+	schedule_delayed_work(&clevo_rgb_state.work, msecs_to_jiffies(CLEVO_KBD_RGB_FRAME_MS));
+}
 
-	ret = clevo_evaluate_set_rgb_color(zone, color);
-	if (ret) {
-		pr_debug("clevo_leds_set_brightness_mc(): clevo_evaluate_set_rgb_color() failed\n");
+// Effect frames go to the firmware only, the classdevs keep the user's colors
+static int clevo_leds_effect_render(void *drvdata, const u8 *frame)
+{
+	unsigned long flags;
+	unsigned int zone;
+	u32 color[3];
+
+	for (zone = 0; zone < clevo_led_effect.columns; ++zone)
+		color[zone] = clevo_leds_zone_color(frame[zone * 3], frame[zone * 3 + 1], frame[zone * 3 + 2]);
+
+	spin_lock_irqsave(&clevo_rgb_state.lock, flags);
+	memcpy(clevo_rgb_state.color, color, clevo_led_effect.columns * sizeof(color[0]));
+	spin_unlock_irqrestore(&clevo_rgb_state.lock, flags);
+
+	schedule_delayed_work(&clevo_rgb_state.work, msecs_to_jiffies(CLEVO_KBD_RGB_FRAME_MS));
+
+	return 0;
+}
+
+static int clevo_leds_effect_restore(void *drvdata)
+{
+	struct led_classdev_mc *mcled_cdev;
+	unsigned long flags;
+	unsigned int zone;
+	u32 color[3];
+
+	for (zone = 0; zone < clevo_led_effect.columns; ++zone) {
+		mcled_cdev = &clevo_mcled_cdevs[zone];
+		color[zone] = clevo_leds_zone_color(mcled_cdev->subled_info[0].intensity,
+						    mcled_cdev->subled_info[1].intensity,
+						    mcled_cdev->subled_info[2].intensity);
 	}
+
+	spin_lock_irqsave(&clevo_rgb_state.lock, flags);
+	memcpy(clevo_rgb_state.color, color, clevo_led_effect.columns * sizeof(color[0]));
+	spin_unlock_irqrestore(&clevo_rgb_state.lock, flags);
+
+	schedule_delayed_work(&clevo_rgb_state.work, msecs_to_jiffies(CLEVO_KBD_RGB_FRAME_MS));
+
+	return 0;
 }
 
+static const struct lwl_led_effect_output clevo_leds_effect_output = {
+	.render = clevo_leds_effect_render,
+	.restore = clevo_leds_effect_restore,
+};
+
 static struct led_classdev clevo_led_cdev = {
 	.name = "white:" LED_FUNCTION_KBD_BACKLIGHT,
 	.max_brightness = CLEVO_KBD_BRIGHTNESS_WHITE_MAX,
@@ -301,6 +430,9 @@ int clevo_leds_init(struct platform_device *dev)
 	union acpi_object *result;
 	u32 result_fallback;
 
+	spin_lock_init(&clevo_rgb_state.lock);
+	INIT_DELAYED_WORK(&clevo_rgb_state.work, clevo_leds_rgb_work_func);
+
 	for (i = 0; i < 3; ++i) {
 		status = clevo_evaluate_method2(CLEVO_CMD_GET_SPECS, 0, &result);
 		if (!status) {
@@ -417,6 +549,16 @@ int clevo_leds_init(struct platform_device *dev)
 		}
 	}
 
+	if (clevo_kb_backlight_type == CLEVO_KB_BACKLIGHT_TYPE_1_ZONE_RGB ||
+	    clevo_kb_backlight_type == CLEVO_KB_BACKLIGHT_TYPE_3_ZONE_RGB) {
+		clevo_led_effect.rows = 1;
+		clevo_led_effect.columns = clevo_kb_backlight_type == CLEVO_KB_BACKLIGHT_TYPE_3_ZONE_RGB ? 3 : 1;
+		clevo_led_effect.output = &clevo_leds_effect_output;
+		ret = lwl_led_effect_register(&clevo_led_effect, &dev->dev);
+		if (ret)
+			pr_err("Registering led effect failed: %d\n", ret);
+	}
+
 	leds_initialized = true;
 	return 0;
 }
@@ -427,6 +569,8 @@ int clevo_leds_suspend(struct platform_device *dev)
 	switch (clevo_kb_backlight_type) {
 	case CLEVO_KB_BACKLIGHT_TYPE_1_ZONE_RGB:
 	case CLEVO_KB_BACKLIGHT_TYPE_3_ZONE_RGB:
+		lwl_led_effect_suspend(&clevo_led_effect);
+		flush_delayed_work(&clevo_rgb_state.work);
 		clevo_evaluate_set_keyboard_status(0);
 		break;
 	default:
@@ -442,6 +586,7 @@ int clevo_leds_resume(struct platform_device *dev)
 	case CLEVO_KB_BACKLIGHT_TYPE_1_ZONE_RGB:
 	case CLEVO_KB_BACKLIGHT_TYPE_3_ZONE_RGB:
 		clevo_evaluate_set_keyboard_status(1);
+		lwl_led_effect_resume(&clevo_led_effect);
 		break;
 	default:
 		break;
@@ -451,6 +596,10 @@ int clevo_leds_resume(struct platform_device *dev)
 EXPORT_SYMBOL(clevo_leds_resume);
 
 int clevo_leds_remove(struct platform_device *dev) {
+	lwl_led_effect_unregister(&clevo_led_effect);
+	// Also queued on init before registration
+	cancel_delayed_work_sync(&clevo_rgb_state.work);
+
 	if (leds_initialized) {
 		if (clevo_kb_backlight_type == CLEVO_KB_BACKLIGHT_TYPE_FIXED_COLOR) {
 			led_classdev_unregister(&clevo_led_cdev);
@@ -479,6 +628,12 @@ EXPORT_SYMBOL(clevo_leds_get_backlight_type);
 // TODO Don't reuse brightness_set as it is writing back the same brightness which could lead to race conditions.
 // Reimplement brightness_set instead without writing back brightness value like in uniwill_leds.h.
 void clevo_leds_restore_state_extern(void) {
+	unsigned long flags;
+
+	spin_lock_irqsave(&clevo_rgb_state.lock, flags);
+	clevo_rgb_state.invalidate = true;
+	spin_unlock_irqrestore(&clevo_rgb_state.lock, flags);
+
 	if (clevo_kb_backlight_type == CLEVO_KB_BACKLIGHT_TYPE_FIXED_COLOR) {
 		clevo_led_cdev.brightness_set(&clevo_led_cdev, clevo_led_cdev.brightness);
 	}
@@ -490,6 +645,10 @@ void clevo_leds_restore_state_extern(void) {
 		clevo_mcled_cdevs[1].led_cdev.brightness_set(&clevo_mcled_cdevs[1].led_cdev, clevo_mcled_cdevs[1].led_cdev.brightness);
 		clevo_mcled_cdevs[2].led_cdev.brightness_set(&clevo_mcled_cdevs[2].led_cdev, clevo_mcled_cdevs[2].led_cdev.brightness);
 	}
+
+	// Colors have to be in firmware before clevo_leds_resume() switches the
+	// keyboard on, otherwise it shows the firmware defaults for a frame
+	flush_delayed_work(&clevo_rgb_state.work);
 }
 EXPORT_SYMBOL(clevo_leds_restore_state_extern);
 
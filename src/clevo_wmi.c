@@ -23,8 +23,13 @@
 #include <linux/module.h>
 #include <linux/wmi.h>
 #include <linux/version.h>
+#include <linux/ktime.h>
 #include "clevo_interfaces.h"
 
+#define lwl_TRACE_SYSTEM lwl_clevo_wmi
+#define CREATE_TRACE_POINTS
+#include "lwl_trace.h"
+
 static int clevo_wmi_evaluate(u32 wmi_method_id, u32 wmi_arg, union acpi_object **result)
 {
 	struct acpi_buffer acpi_buffer_in = { (acpi_size)sizeof(wmi_arg),
@@ -33,10 +38,18 @@ static int clevo_wmi_evaluate(u32 wmi_method_id, u32 wmi_arg, union acpi_object
 	union acpi_object *acpi_result;
 	acpi_status status_acpi;
 	int return_status = 0;
+	ktime_t start = 0;
 
+	// Only timed while the tracepoint is enabled
+	if (trace_lwl_method_eval_enabled())
+		start = ktime_get();
 	status_acpi =
 		wmi_evaluate_method(CLEVO_WMI_METHOD_GUID, 0x00, wmi_method_id,
 				    &acpi_buffer_in, &acpi_buffer_out);
+	if (start)
+		trace_lwl_method_eval(CLEVO_WMI_METHOD_GUID, wmi_method_id, wmi_arg,
+				      ACPI_FAILURE(status_acpi) ? -EIO : 0,
+				      ktime_us_delta(ktime_get(), start));
 
 	if (unlikely(ACPI_FAILURE(status_acpi))) {
 		pr_err("failed to evaluate wmi method\n");
@@ -98,6 +98,12 @@
 #include <linux/dmi.h>
 #include <linux/led-class-multicolor.h>
 #include <linux/of.h>
+#include <linux/workqueue.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/atomic.h>
+
+#include "../lwl_led_effects.h"
 
 // USB HID control data write size
 #define HID_DATA_SIZE 8
@@ -121,6 +127,12 @@
 
 #define ITE8291_PARAM_MODE_USER		0x33
 
+#define ITE8291_ALL_ROWS		((1 << ITE8291_NR_ROWS) - 1)
+// Whole frame as written by userspace: rows 0 - 5, columns 0 - 20, 3 bytes RGB each
+#define ITE8291_FRAME_SIZE		(ITE8291_NR_ROWS * ITE8291_LEDS_PER_ROW_MAX * 3)
+// Per key updates arriving within this window are sent in one flush
+#define ITE8291_FLUSH_DELAY_MS		10
+
 struct ite8291_driver_data_t {
 	u16 bcd_device;
 	struct hid_device *hid_dev;
@@ -132,13 +144,34 @@ struct ite8291_driver_data_t {
 	int (*device_write_on)(struct hid_device *);
 	int (*device_write_off)(struct hid_device *);
 	int (*device_write_state)(struct hid_device *);
+	// USB transfer statistics
+	atomic64_t stat_control_transfers;
+	atomic64_t stat_output_reports;
+	atomic64_t stat_flushes;
+	atomic64_t stat_rows_skipped;
 };
 
 // Per key device specific defines
 typedef u8 row_data_t[ITE8291_NR_ROWS][ITE8291_ROW_DATA_LENGTH];
 struct ite8291_driver_data_perkey_t {
 	row_data_t row_data;
+	// Bit mask of rows changed since the last flush
+	u8 dirty_rows;
+	// Brightness last sent to the device, -1 if unknown
+	int flushed_brightness;
+	// Copy of row_data taken at flush time, used as transfer buffer
+	row_data_t flush_buf;
+	// Back buffer filled by frame writes, swapped in on page flip
+	row_data_t back_buf;
+	bool back_buf_valid;
+	// Protects row_data, dirty_rows and brightness
+	spinlock_t lock;
+	// Serializes flushes
+	struct mutex flush_lock;
+	struct delayed_work flush_work;
+	struct hid_device *hdev;
 	u8 brightness;
+	struct lwl_led_effect effect;
 	struct led_classdev_mc mcled_cdevs[ITE8291_NR_ROWS][ITE8291_LEDS_PER_ROW_MAX];
 	struct mc_subled mcled_cdevs_subleds[ITE8291_NR_ROWS][ITE8291_LEDS_PER_ROW_MAX][3];
 };
@@ -232,7 +265,7 @@ static void color_scaling(struct hid_device *hdev, u8 *red, u8 *green, u8 *blue,
  * @param green Green brightness 0x00 - 0xff
  * @param blue Blue brightness 0x00 - 0xff
  * 
- * @returns 0 on success, otherwise error
+ * @returns 1 if the row data changed, 0 if unchanged, otherwise error
  */
 static int row_data_set(struct hid_device *hdev, row_data_t row_data, int row, int column, u8 red, u8 green, u8 blue)
 {
@@ -250,11 +283,16 @@ static int row_data_set(struct hid_device *hdev, row_data_t row_data, int row, i
 	column_index_green = ITE8291_ROW_DATA_PADDING + (1 * ITE8291_LEDS_PER_ROW_MAX) + column;
 	column_index_blue = ITE8291_ROW_DATA_PADDING + (0 * ITE8291_LEDS_PER_ROW_MAX) + column;
 
+	if (row_data[row][column_index_red] == red &&
+	    row_data[row][column_index_green] == green &&
+	    row_data[row][column_index_blue] == blue)
+		return 0;
+
 	row_data[row][column_index_red] = red;
 	row_data[row][column_index_green] = green;
 	row_data[row][column_index_blue] = blue;
 
-	return 0;
+	return 1;
 }
 
 /**
@@ -294,9 +332,14 @@ static int ite8291_write_control(struct hid_device *hdev, u8 *ctrl_data)
 {
 	int result = 0;
 	u8 *buf;
+	struct ite8291_driver_data_t *driver_data;
 	if (hdev == NULL)
 		return -ENODEV;
 
+	driver_data = hid_get_drvdata(hdev);
+	if (driver_data)
+		atomic64_inc(&driver_data->stat_control_transfers);
+
 	buf = kzalloc(HID_DATA_SIZE, GFP_KERNEL);
 
 	memcpy(buf, ctrl_data, (size_t) 8);
@@ -367,11 +410,16 @@ static int ite8291_write_color_full(struct hid_device *hdev, u8 red, u8 green, u
 #endif
 
 /**
- * Write color (and brightness) to the whole keyboard from row data
+ * Write color (and brightness) to the keyboard from row data
+ *
+ * Only rows set in row_mask are transferred. The control packet setting
+ * user mode and brightness is only sent if write_params is set.
  */
-static int ite8291_write_rows(struct hid_device *hdev, row_data_t row_data, u8 brightness)
+static int ite8291_write_rows(struct hid_device *hdev, row_data_t row_data, u8 brightness,
+			      u8 row_mask, bool write_params)
 {
 	int result = 0, row_index;
+	struct ite8291_driver_data_t *driver_data;
 	u8 ctrl_params[] = { 0x08,
 			     0x02,
 			     ITE8291_PARAM_MODE_USER,
@@ -384,11 +432,19 @@ static int ite8291_write_rows(struct hid_device *hdev, row_data_t row_data, u8 b
 	if (hdev == NULL)
 		return -ENODEV;
 
-	ite8291_write_control(hdev, ctrl_params);
+	driver_data = hid_get_drvdata(hdev);
+
+	if (write_params)
+		ite8291_write_control(hdev, ctrl_params);
 
 	for (row_index = 0; row_index < ITE8291_NR_ROWS; ++row_index) {
+		if (!(row_mask & (1 << row_index))) {
+			atomic64_inc(&driver_data->stat_rows_skipped);
+			continue;
+		}
 		ctrl_announce_row_data[2] = row_index;
 		ite8291_write_control(hdev, ctrl_announce_row_data);
+		atomic64_inc(&driver_data->stat_output_reports);
 		result = hdev->ll_driver->output_report(
 			hdev, row_data[row_index], ITE8291_ROW_DATA_LENGTH);
 		if (result < 0)
@@ -455,11 +511,16 @@ static void leds_set_brightness_mc (struct led_classdev *led_cdev, enum led_brig
 	struct hid_device *hdev = to_hid_device(dev);
 	struct ite8291_driver_data_t *ite8291_driver_data = hid_get_drvdata(hdev);
 	struct ite8291_driver_data_perkey_t *device_data = ite8291_driver_data->device_data;
+	int row = mcled_cdev->subled_info[0].channel / ITE8291_LEDS_PER_ROW_MAX;
+	unsigned long flags;
+	bool pending;
 
 	pr_debug("leds_set_brightness_mc: channel: %d, brightness: %d, saved brightness: %d, red: %d, green: %d, blue: %d\n",
 		 mcled_cdev->subled_info[0].channel, brightness, device_data->brightness, mcled_cdev->subled_info[0].intensity,
 		 mcled_cdev->subled_info[1].intensity, mcled_cdev->subled_info[2].intensity);
 
+	spin_lock_irqsave(&device_data->lock, flags);
+
 	device_data->brightness = brightness;
 
 	for (i = 0; i < ITE8291_NR_ROWS; ++i) {
@@ -468,13 +529,24 @@ static void leds_set_brightness_mc (struct led_classdev *led_cdev, enum led_brig
 		}
 	}
 
-	row_data_set(hdev, device_data->row_data, mcled_cdev->subled_info[0].channel / ITE8291_LEDS_PER_ROW_MAX,
-		     mcled_cdev->subled_info[0].channel % ITE8291_LEDS_PER_ROW_MAX,
-		     mcled_cdev->subled_info[0].intensity, mcled_cdev->subled_info[1].intensity,
-		     mcled_cdev->subled_info[2].intensity);
+	// A running effect owns row_data, the new color shows once it ends
+	if (!lwl_led_effect_active(&device_data->effect) &&
+	    row_data_set(hdev, device_data->row_data, row,
+			 mcled_cdev->subled_info[0].channel % ITE8291_LEDS_PER_ROW_MAX,
+			 mcled_cdev->subled_info[0].intensity, mcled_cdev->subled_info[1].intensity,
+			 mcled_cdev->subled_info[2].intensity) > 0)
+		device_data->dirty_rows |= 1 << row;
+
+	pending = device_data->dirty_rows != 0 ||
+		  device_data->brightness != device_data->flushed_brightness;
+
+	spin_unlock_irqrestore(&device_data->lock, flags);
+
+	lwl_led_effect_set_enabled(&device_data->effect, brightness != 0);
 
-	if (!ite8291_driver_data->device_buffer_input)
-		ite8291_perkey_write_state(hdev);
+	// Collect updates of a short time window into one flush
+	if (pending && !ite8291_driver_data->device_buffer_input)
+		schedule_delayed_work(&device_data->flush_work, msecs_to_jiffies(ITE8291_FLUSH_DELAY_MS));
 }
 
 static int register_leds(struct hid_device *hdev)
@@ -527,6 +599,164 @@ static void unregister_leds(struct hid_device *hdev) {
 	}
 }
 
+/**
+ * Send changed rows (or everything if full is set) to the device
+ */
+static int ite8291_perkey_flush(struct hid_device *hdev, bool full)
+{
+	struct ite8291_driver_data_t *driver_data = hid_get_drvdata(hdev);
+	struct ite8291_driver_data_perkey_t *device_data = driver_data->device_data;
+	unsigned long flags;
+	u8 row_mask, brightness;
+	bool write_params;
+	int result = 0;
+
+	mutex_lock(&device_data->flush_lock);
+
+	spin_lock_irqsave(&device_data->lock, flags);
+	row_mask = full ? ITE8291_ALL_ROWS : device_data->dirty_rows;
+	device_data->dirty_rows = 0;
+	brightness = device_data->brightness;
+	memcpy(device_data->flush_buf, device_data->row_data, sizeof(row_data_t));
+	spin_unlock_irqrestore(&device_data->lock, flags);
+
+	write_params = full || brightness != device_data->flushed_brightness;
+
+	if (row_mask || write_params) {
+		atomic64_inc(&driver_data->stat_flushes);
+		result = ite8291_write_rows(hdev, device_data->flush_buf, brightness, row_mask, write_params);
+		if (result < 0) {
+			// Resend everything next time
+			spin_lock_irqsave(&device_data->lock, flags);
+			device_data->dirty_rows = ITE8291_ALL_ROWS;
+			spin_unlock_irqrestore(&device_data->lock, flags);
+			device_data->flushed_brightness = -1;
+		} else {
+			device_data->flushed_brightness = brightness;
+		}
+	}
+
+	mutex_unlock(&device_data->flush_lock);
+
+	return result;
+}
+
+static void ite8291_perkey_flush_work_handler(struct work_struct *work)
+{
+	struct ite8291_driver_data_perkey_t *device_data =
+		container_of(to_delayed_work(work), struct ite8291_driver_data_perkey_t, flush_work);
+
+	ite8291_perkey_flush(device_data->hdev, false);
+}
+
+/**
+ * Make the back buffer the current frame and send the rows that differ
+ */
+static int ite8291_perkey_flip(struct hid_device *hdev)
+{
+	struct ite8291_driver_data_t *driver_data = hid_get_drvdata(hdev);
+	struct ite8291_driver_data_perkey_t *device_data = driver_data->device_data;
+	unsigned long flags;
+	int row;
+
+	spin_lock_irqsave(&device_data->lock, flags);
+	if (!device_data->back_buf_valid) {
+		spin_unlock_irqrestore(&device_data->lock, flags);
+		return 0;
+	}
+	for (row = 0; row < ITE8291_NR_ROWS; ++row) {
+		if (memcmp(device_data->row_data[row], device_data->back_buf[row], ITE8291_ROW_DATA_LENGTH) != 0) {
+			memcpy(device_data->row_data[row], device_data->back_buf[row], ITE8291_ROW_DATA_LENGTH);
+			device_data->dirty_rows |= 1 << row;
+		}
+	}
+	device_data->back_buf_valid = false;
+	spin_unlock_irqrestore(&device_data->lock, flags);
+
+	return ite8291_perkey_flush(hdev, false);
+}
+
+/**
+ * Fill the back buffer from a frame of RGB per key, row by row
+ *
+ * Userspace frames also become the colors of the LED classdevs, effect
+ * frames only go to the device.
+ */
+static void ite8291_perkey_frame_set(struct hid_device *hdev, const u8 *frame, bool set_cdevs)
+{
+	struct ite8291_driver_data_t *driver_data = hid_get_drvdata(hdev);
+	struct ite8291_driver_data_perkey_t *device_data = driver_data->device_data;
+	struct led_classdev_mc *mcled_cdev;
+	unsigned long flags;
+	int row, column;
+	const u8 *color;
+
+	spin_lock_irqsave(&device_data->lock, flags);
+	for (row = 0; row < ITE8291_NR_ROWS; ++row) {
+		for (column = 0; column < ITE8291_LEDS_PER_ROW_MAX; ++column) {
+			color = &frame[(row * ITE8291_LEDS_PER_ROW_MAX + column) * 3];
+			row_data_set(hdev, device_data->back_buf, row, column, color[0], color[1], color[2]);
+			if (!set_cdevs)
+				continue;
+			mcled_cdev = &device_data->mcled_cdevs[row][column];
+			mcled_cdev->subled_info[0].intensity = color[0];
+			mcled_cdev->subled_info[1].intensity = color[1];
+			mcled_cdev->subled_info[2].intensity = color[2];
+		}
+	}
+	device_data->back_buf_valid = true;
+	spin_unlock_irqrestore(&device_data->lock, flags);
+}
+
+/**
+ * A running effect renders through the back buffer, userspace frames
+ * would be mixed into its frames
+ */
+static bool ite8291_perkey_effect_busy(struct hid_device *hdev)
+{
+	struct ite8291_driver_data_t *driver_data = hid_get_drvdata(hdev);
+	struct ite8291_driver_data_perkey_t *device_data = driver_data->device_data;
+
+	return lwl_led_effect_active(&device_data->effect);
+}
+
+static int ite8291_perkey_effect_render(void *drvdata, const u8 *frame)
+{
+	struct hid_device *hdev = drvdata;
+
+	ite8291_perkey_frame_set(hdev, frame, false);
+
+	return ite8291_perkey_flip(hdev);
+}
+
+static int ite8291_perkey_effect_restore(void *drvdata)
+{
+	struct hid_device *hdev = drvdata;
+	struct ite8291_driver_data_t *driver_data = hid_get_drvdata(hdev);
+	struct ite8291_driver_data_perkey_t *device_data = driver_data->device_data;
+	struct mc_subled *subleds;
+	unsigned long flags;
+	int row, column;
+
+	spin_lock_irqsave(&device_data->lock, flags);
+	for (row = 0; row < ITE8291_NR_ROWS; ++row) {
+		for (column = 0; column < ITE8291_LEDS_PER_ROW_MAX; ++column) {
+			subleds = device_data->mcled_cdevs[row][column].subled_info;
+			if (row_data_set(hdev, device_data->row_data, row, column, subleds[0].intensity,
+					 subleds[1].intensity, subleds[2].intensity) > 0)
+				device_data->dirty_rows |= 1 << row;
+		}
+	}
+	spin_unlock_irqrestore(&device_data->lock, flags);
+
+	return ite8291_perkey_flush(hdev, false);
+}
+
+static const struct lwl_led_effect_output ite8291_perkey_effect_output = {
+	.render = ite8291_perkey_effect_render,
+	.restore = ite8291_perkey_effect_restore,
+};
+
 static int ite8291_perkey_add(struct hid_device *hdev)
 {
 	struct ite8291_driver_data_t *driver_data;
@@ -541,6 +771,12 @@ static int ite8291_perkey_add(struct hid_device *hdev)
 
 	driver_data->device_data = perkey_data;
 
+	perkey_data->hdev = hdev;
+	spin_lock_init(&perkey_data->lock);
+	mutex_init(&perkey_data->flush_lock);
+	INIT_DELAYED_WORK(&perkey_data->flush_work, ite8291_perkey_flush_work_handler);
+	perkey_data->flushed_brightness = -1;
+
 	perkey_data->brightness = ITE8291_KBD_BRIGHTNESS_DEFAULT;
 	for (i = 0; i < ITE8291_NR_ROWS; ++i) {
 		for (j = 0; j < ITE8291_LEDS_PER_ROW_MAX; ++j) {
@@ -550,6 +786,7 @@ static int ite8291_perkey_add(struct hid_device *hdev)
 				     ITE8291_KB_COLOR_DEFAULT_BLUE);
 		}
 	}
+	memcpy(perkey_data->back_buf, perkey_data->row_data, sizeof(row_data_t));
 
 	/*
 	for (i = 0; i < ITE8291_NR_ROWS; ++i) {
@@ -566,31 +803,58 @@ static int ite8291_perkey_add(struct hid_device *hdev)
 	if (result)
 		return result;
 
+	// Row 0 is the bottom row
+	perkey_data->effect.rows = ITE8291_NR_ROWS;
+	perkey_data->effect.columns = ITE8291_LEDS_PER_ROW_MAX;
+	perkey_data->effect.rows_bottom_up = true;
+	perkey_data->effect.output = &ite8291_perkey_effect_output;
+	perkey_data->effect.drvdata = hdev;
+	result = lwl_led_effect_register(&perkey_data->effect, &hdev->dev);
+	if (result)
+		pr_err("led effect registration failed: %d\n", result);
+
 	return 0;
 }
 
 static int ite8291_perkey_remove(struct hid_device *hdev)
 {
+	struct ite8291_driver_data_t *driver_data = hid_get_drvdata(hdev);
+	struct ite8291_driver_data_perkey_t *device_data = driver_data->device_data;
+
+	lwl_led_effect_unregister(&device_data->effect);
 	unregister_leds(hdev);
+	cancel_delayed_work_sync(&device_data->flush_work);
 	return 0;
 }
 
 static int ite8291_perkey_write_on(struct hid_device *hdev)
 {
+	struct ite8291_driver_data_t *driver_data = hid_get_drvdata(hdev);
+	struct ite8291_driver_data_perkey_t *device_data = driver_data->device_data;
+
+	lwl_led_effect_resume(&device_data->effect);
+
 	return 0;
 }
 
 static int ite8291_perkey_write_off(struct hid_device *hdev)
 {
+	struct ite8291_driver_data_t *driver_data = hid_get_drvdata(hdev);
+	struct ite8291_driver_data_perkey_t *device_data = driver_data->device_data;
 	u8 ctrl_params_off[] = {0x08, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+	lwl_led_effect_suspend(&device_data->effect);
+
+	// Changes not yet flushed stay in row_data for the next full write
+	cancel_delayed_work_sync(&device_data->flush_work);
+	device_data->flushed_brightness = -1;
+
 	return ite8291_write_control(hdev, ctrl_params_off);
 }
 
 static int ite8291_perkey_write_state(struct hid_device *hdev)
 {
-	struct ite8291_driver_data_t *driver_data = hid_get_drvdata(hdev);
-	struct ite8291_driver_data_perkey_t *device_data = driver_data->device_data;
-	return ite8291_write_rows(hdev, device_data->row_data, device_data->brightness);
+	return ite8291_perkey_flush(hdev, true);
 }
 
 static void leds_zones_set_brightness_mc(struct led_classdev *led_cdev, enum led_brightness brightness) {
@@ -776,11 +1040,99 @@ static ssize_t buffer_input_store(struct device *device,
 
 DEVICE_ATTR_RW(buffer_input);
 
+static ssize_t transfer_stats_show(struct device *device,
+				   struct device_attribute *attr,
+				   char *buf)
+{
+	struct hid_device *hdev;
+	struct ite8291_driver_data_t *driver_data;
+	hdev = container_of(device, struct hid_device, dev);
+	driver_data = hid_get_drvdata(hdev);
+	return sysfs_emit(buf, "control_transfers %lld\noutput_reports %lld\nflushes %lld\nrows_skipped %lld\n",
+			  (long long) atomic64_read(&driver_data->stat_control_transfers),
+			  (long long) atomic64_read(&driver_data->stat_output_reports),
+			  (long long) atomic64_read(&driver_data->stat_flushes),
+			  (long long) atomic64_read(&driver_data->stat_rows_skipped));
+}
+
+DEVICE_ATTR_RO(transfer_stats);
+
+static ssize_t frame_flip_store(struct device *device,
+				struct device_attribute *attr,
+				const char *buf,
+				size_t size)
+{
+	struct hid_device *hdev;
+	int result;
+	hdev = container_of(device, struct hid_device, dev);
+
+	if (ite8291_perkey_effect_busy(hdev))
+		return -EBUSY;
+
+	result = ite8291_perkey_flip(hdev);
+	if (result < 0)
+		return result;
+
+	return size;
+}
+
+DEVICE_ATTR_WO(frame_flip);
+
 static struct attribute *control_group_attrs[] = {
 	&dev_attr_buffer_input.attr,
+	&dev_attr_transfer_stats.attr,
+	&dev_attr_frame_flip.attr,
 	NULL
 };
 
+/**
+ * Whole frame write
+ *
+ * Takes exactly ITE8291_FRAME_SIZE bytes, RGB per key, row by row. The
+ * frame goes to the back buffer and is flipped in right away unless
+ * buffer_input is set, in which case controls/frame_flip presents it.
+ * Fails with -EBUSY while a led_effect is running.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+static ssize_t frame_write(struct file *filp, struct kobject *kobj, struct bin_attribute *attr,
+			   char *buf, loff_t off, size_t count)
+#else
+static ssize_t frame_write(struct file *filp, struct kobject *kobj, const struct bin_attribute *attr,
+			   char *buf, loff_t off, size_t count)
+#endif
+{
+	struct device *device = kobj_to_dev(kobj);
+	struct hid_device *hdev = container_of(device, struct hid_device, dev);
+	struct ite8291_driver_data_t *driver_data = hid_get_drvdata(hdev);
+	int result;
+
+	if (off != 0 || count != ITE8291_FRAME_SIZE)
+		return -EINVAL;
+
+	if (ite8291_perkey_effect_busy(hdev))
+		return -EBUSY;
+
+	ite8291_perkey_frame_set(hdev, buf, true);
+
+	if (!driver_data->device_buffer_input) {
+		result = ite8291_perkey_flip(hdev);
+		if (result < 0)
+			return result;
+	}
+
+	return count;
+}
+
+static struct bin_attribute bin_attr_frame = {
+	.attr = { .name = "frame", .mode = 0200 },
+	.size = ITE8291_FRAME_SIZE,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0) && LINUX_VERSION_CODE < KERNEL_VERSION(6, 16, 0)
+	.write_new = frame_write,
+#else
+	.write = frame_write,
+#endif
+};
+
 static struct attribute_group control_group = {
 	.name = "controls",
 	.attrs = control_group_attrs
@@ -831,6 +1183,12 @@ static int driver_probe_callb(struct hid_device *hdev, const struct hid_device_i
 			stop_hw(hdev);
 			return result;
 		}
+		result = sysfs_create_bin_file(&hdev->dev.kobj, &bin_attr_frame);
+		if (result != 0) {
+			sysfs_remove_group(&hdev->dev.kobj, &control_group);
+			stop_hw(hdev);
+			return result;
+		}
 	}
 
 	return 0;
@@ -842,9 +1200,11 @@ static void driver_remove_callb(struct hid_device *hdev)
 	pr_debug("driver remove\n");
 	driver_data = hid_get_drvdata(hdev);
 	driver_data->device_write_off(hdev);
-	driver_data->device_remove(hdev);
-	if (driver_data->device_has_buffer_input_control)
+	if (driver_data->device_has_buffer_input_control) {
+		sysfs_remove_bin_file(&hdev->dev.kobj, &bin_attr_frame);
 		sysfs_remove_group(&hdev->dev.kobj, &control_group);
+	}
+	driver_data->device_remove(hdev);
 
 	stop_hw(hdev);
 }
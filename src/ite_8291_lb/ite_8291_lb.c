@@ -28,6 +28,8 @@
 #include <linux/led-class-multicolor.h>
 #include <linux/of.h>
 #include <linux/delay.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
 
 // USB HID control data write size
 #define HID_DATA_SIZE 8
@@ -38,18 +40,48 @@
 #define LIGHTBAR_DEFAULT_COLOR_GREEN	0xff
 #define LIGHTBAR_DEFAULT_COLOR_BLUE	0xff
 
+// Effect speed as shown in sysfs, slowest 1 to fastest 10
+#define LIGHTBAR_SPEED_MIN		1
+#define LIGHTBAR_SPEED_MAX		10
+#define LIGHTBAR_DEFAULT_SPEED		5
+
+#define LIGHTBAR_COLOR_LIST_MAX		7
+
 struct color_u8 {
 	u8 red;
 	u8 green;
 	u8 blue;
 };
 
+enum lightbar_mode {
+	LIGHTBAR_MODE_MONO,
+	LIGHTBAR_MODE_BREATHE,
+	LIGHTBAR_MODE_WAVE,
+	LIGHTBAR_MODE_CLASH,
+	LIGHTBAR_MODE_CATCHUP,
+	LIGHTBAR_MODE_FLASH,
+	LIGHTBAR_MODES,
+};
+
+static const char * const lightbar_mode_names[] = {
+	[LIGHTBAR_MODE_MONO] = "mono",
+	[LIGHTBAR_MODE_BREATHE] = "breathe",
+	[LIGHTBAR_MODE_WAVE] = "wave",
+	[LIGHTBAR_MODE_CLASH] = "clash",
+	[LIGHTBAR_MODE_CATCHUP] = "catchup",
+	[LIGHTBAR_MODE_FLASH] = "flash",
+};
+
 struct ite8291_driver_data_t {
 	struct hid_device *hid_dev;
 	struct led_classdev_mc mcled_cdev_lightbar;
 	struct mc_subled mcled_cdev_subleds_lightbar[3];
 	struct color_u8 *color_list;
 	int color_list_length;
+	// Protects mode, speed, color list and device writes
+	struct mutex lock;
+	enum lightbar_mode mode;
+	u8 speed;
 };
 
 /**
@@ -231,7 +263,7 @@ static int ite8291_write_lightbar_mono(struct hid_device *hdev, u8 red, u8 green
  * @param brightness Range 0x00 - 0x64
  * @param speed Range slowest 0x0a to fastest 0x01
  */
-static int __attribute__ ((unused)) ite8291_write_lightbar_breathe(struct hid_device *hdev, u8 brightness, u8 speed)
+static int ite8291_write_lightbar_breathe(struct hid_device *hdev, u8 brightness, u8 speed)
 {
 	if (hdev == NULL)
 		return -ENODEV;
@@ -266,7 +298,7 @@ static int __attribute__ ((unused)) ite8291_write_lightbar_breathe(struct hid_de
  * @param brightness Range 0x00 - 0x64
  * @param speed Range slowest 0x0a to fastest 0x01
  */
-static int __attribute__ ((unused)) ite8291_write_lightbar_wave(struct hid_device *hdev, u8 brightness, u8 speed)
+static int ite8291_write_lightbar_wave(struct hid_device *hdev, u8 brightness, u8 speed)
 {
 	if (hdev == NULL)
 		return -ENODEV;
@@ -297,7 +329,7 @@ static int __attribute__ ((unused)) ite8291_write_lightbar_wave(struct hid_devic
  * @param brightness Range 0x00 - 0x64
  * @param speed Range slowest 0x0a to fastest 0x01
  */
-static int __attribute__ ((unused)) ite8291_write_lightbar_clash(struct hid_device *hdev, u8 brightness, u8 speed)
+static int ite8291_write_lightbar_clash(struct hid_device *hdev, u8 brightness, u8 speed)
 {
 	if (hdev == NULL)
 		return -ENODEV;
@@ -328,7 +360,7 @@ static int __attribute__ ((unused)) ite8291_write_lightbar_clash(struct hid_devi
  * @param brightness Range 0x00 - 0x64
  * @param speed Range slowest 0x0a to fastest 0x01
  */
-static int __attribute__ ((unused)) ite8291_write_lightbar_catchup(struct hid_device *hdev, u8 brightness, u8 speed)
+static int ite8291_write_lightbar_catchup(struct hid_device *hdev, u8 brightness, u8 speed)
 {
 	if (hdev == NULL)
 		return -ENODEV;
@@ -360,7 +392,7 @@ static int __attribute__ ((unused)) ite8291_write_lightbar_catchup(struct hid_de
  * @param speed Range slowest 0x0a to fastest 0x01
  * @param direction 0x00: no, 0x01: right, 0x02 left
  */
-static int __attribute__ ((unused)) ite8291_write_lightbar_flash(struct hid_device *hdev, u8 brightness, u8 speed, u8 direction)
+static int ite8291_write_lightbar_flash(struct hid_device *hdev, u8 brightness, u8 speed, u8 direction)
 {
 	if (hdev == NULL)
 		return -ENODEV;
@@ -433,7 +465,7 @@ static int ite8291_write_off(struct hid_device *hdev)
 	return 0;
 }
 
-static void __attribute__ ((unused)) ite8291_set_testcolors(struct hid_device *hdev)
+static void ite8291_set_testcolors(struct hid_device *hdev)
 {
 	ite8291_set_color_list_entry(hdev, 0, 0xff, 0x00, 0x00);
 	ite8291_set_color_list_entry(hdev, 1, 0xff, 0xff, 0x00);
@@ -444,26 +476,235 @@ static void __attribute__ ((unused)) ite8291_set_testcolors(struct hid_device *h
 	ite8291_set_color_list_entry(hdev, 6, 0x00, 0x00, 0xff);
 }
 
-static int ite8291_write_state(struct hid_device *hdev)
+/**
+ * Hardware effects available per product
+ */
+static bool ite8291_mode_supported(struct hid_device *hdev, enum lightbar_mode mode)
+{
+	switch (mode) {
+	case LIGHTBAR_MODE_MONO:
+		return true;
+	case LIGHTBAR_MODE_BREATHE:
+		return hdev->product == 0x6010 || hdev->product == 0x7000;
+	case LIGHTBAR_MODE_WAVE:
+	case LIGHTBAR_MODE_CLASH:
+	case LIGHTBAR_MODE_CATCHUP:
+		return hdev->product == 0x7000;
+	case LIGHTBAR_MODE_FLASH:
+		return hdev->product == 0x6010;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Write mode, color and brightness, called with lock held
+ */
+static int __ite8291_write_state(struct hid_device *hdev)
 {
 	struct ite8291_driver_data_t *ite8291_driver_data = hid_get_drvdata(hdev);
 	struct led_classdev_mc *mcled_cdev = &ite8291_driver_data->mcled_cdev_lightbar;
+	u8 brightness = mcled_cdev->led_cdev.brightness;
+	// Device speed counts from fastest 0x01 to slowest 0x0a
+	u8 speed = LIGHTBAR_SPEED_MAX + 1 - ite8291_driver_data->speed;
+
+	switch (ite8291_driver_data->mode) {
+	case LIGHTBAR_MODE_BREATHE:
+		return ite8291_write_lightbar_breathe(hdev, brightness, speed);
+	case LIGHTBAR_MODE_WAVE:
+		return ite8291_write_lightbar_wave(hdev, brightness, speed);
+	case LIGHTBAR_MODE_CLASH:
+		return ite8291_write_lightbar_clash(hdev, brightness, speed);
+	case LIGHTBAR_MODE_CATCHUP:
+		return ite8291_write_lightbar_catchup(hdev, brightness, speed);
+	case LIGHTBAR_MODE_FLASH:
+		return ite8291_write_lightbar_flash(hdev, brightness, speed, 0x00);
+	default:
+		return ite8291_write_lightbar_mono(hdev,
+						   mcled_cdev->subled_info[0].intensity,
+						   mcled_cdev->subled_info[1].intensity,
+						   mcled_cdev->subled_info[2].intensity,
+						   brightness);
+	}
+}
 
-	// For now only supports mono color state saved in sysfs structure
-	return ite8291_write_lightbar_mono(hdev,
-					   mcled_cdev->subled_info[0].intensity,
-					   mcled_cdev->subled_info[1].intensity,
-					   mcled_cdev->subled_info[2].intensity,
-					   ite8291_driver_data->mcled_cdev_lightbar.led_cdev.brightness);
+static int ite8291_write_state(struct hid_device *hdev)
+{
+	struct ite8291_driver_data_t *ite8291_driver_data = hid_get_drvdata(hdev);
+	int result;
+
+	mutex_lock(&ite8291_driver_data->lock);
+	result = __ite8291_write_state(hdev);
+	mutex_unlock(&ite8291_driver_data->lock);
+
+	return result;
 }
 
-static void leds_set_brightness_mc_lightbar(struct led_classdev *led_cdev, enum led_brightness brightness) {
+static int leds_set_brightness_mc_lightbar(struct led_classdev *led_cdev, enum led_brightness brightness) {
 	struct device *dev = led_cdev->dev->parent;
 	struct hid_device *hdev = to_hid_device(dev);
+	int result;
 
-	ite8291_write_state(hdev);
+	// Takes the driver lock, only called from process context
+	result = ite8291_write_state(hdev);
+	if (result < 0)
+		return result;
+
+	return 0;
+}
+
+static struct ite8291_driver_data_t *lightbar_dev_to_driver_data(struct device *dev)
+{
+	struct led_classdev *led_cdev = dev_get_drvdata(dev);
+	struct led_classdev_mc *mcled_cdev = lcdev_to_mccdev(led_cdev);
+
+	return container_of(mcled_cdev, struct ite8291_driver_data_t, mcled_cdev_lightbar);
+}
+
+static ssize_t mode_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ite8291_driver_data_t *driver_data = lightbar_dev_to_driver_data(dev);
+	int i, mode, len = 0;
+
+	mutex_lock(&driver_data->lock);
+	mode = driver_data->mode;
+	mutex_unlock(&driver_data->lock);
+
+	for (i = 0; i < LIGHTBAR_MODES; ++i) {
+		if (!ite8291_mode_supported(driver_data->hid_dev, i))
+			continue;
+		len += sysfs_emit_at(buf, len, i == mode ? "%s[%s]" : "%s%s",
+				     len > 0 ? " " : "", lightbar_mode_names[i]);
+	}
+	len += sysfs_emit_at(buf, len, "\n");
+
+	return len;
+}
+
+static ssize_t mode_store(struct device *dev, struct device_attribute *attr,
+			  const char *buf, size_t size)
+{
+	struct ite8291_driver_data_t *driver_data = lightbar_dev_to_driver_data(dev);
+	int i, result;
+
+	for (i = 0; i < LIGHTBAR_MODES; ++i)
+		if (sysfs_streq(buf, lightbar_mode_names[i]))
+			break;
+
+	if (i == LIGHTBAR_MODES || !ite8291_mode_supported(driver_data->hid_dev, i))
+		return -EINVAL;
+
+	mutex_lock(&driver_data->lock);
+	driver_data->mode = i;
+	result = __ite8291_write_state(driver_data->hid_dev);
+	mutex_unlock(&driver_data->lock);
+
+	if (result < 0)
+		return result;
+
+	return size;
+}
+
+static ssize_t speed_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ite8291_driver_data_t *driver_data = lightbar_dev_to_driver_data(dev);
+	u8 speed;
+
+	mutex_lock(&driver_data->lock);
+	speed = driver_data->speed;
+	mutex_unlock(&driver_data->lock);
+
+	return sysfs_emit(buf, "%u\n", speed);
 }
 
+static ssize_t speed_store(struct device *dev, struct device_attribute *attr,
+			   const char *buf, size_t size)
+{
+	struct ite8291_driver_data_t *driver_data = lightbar_dev_to_driver_data(dev);
+	u8 value;
+	int result;
+
+	result = kstrtou8(buf, 10, &value);
+	if (result)
+		return result;
+
+	if (value < LIGHTBAR_SPEED_MIN || value > LIGHTBAR_SPEED_MAX)
+		return -EINVAL;
+
+	mutex_lock(&driver_data->lock);
+	driver_data->speed = value;
+	result = __ite8291_write_state(driver_data->hid_dev);
+	mutex_unlock(&driver_data->lock);
+
+	if (result < 0)
+		return result;
+
+	return size;
+}
+
+static ssize_t color_list_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct ite8291_driver_data_t *driver_data = lightbar_dev_to_driver_data(dev);
+	int i, len = 0;
+
+	mutex_lock(&driver_data->lock);
+	for (i = 0; i < driver_data->color_list_length; ++i)
+		len += sysfs_emit_at(buf, len, "%s%02x%02x%02x", i > 0 ? " " : "",
+				     driver_data->color_list[i].red,
+				     driver_data->color_list[i].green,
+				     driver_data->color_list[i].blue);
+	mutex_unlock(&driver_data->lock);
+	len += sysfs_emit_at(buf, len, "\n");
+
+	return len;
+}
+
+/**
+ * Colors used by the effects as RRGGBB separated by spaces, entries not
+ * given are cleared
+ */
+static ssize_t color_list_store(struct device *dev, struct device_attribute *attr,
+				const char *buf, size_t size)
+{
+	struct ite8291_driver_data_t *driver_data = lightbar_dev_to_driver_data(dev);
+	struct hid_device *hdev = driver_data->hid_dev;
+	u32 colors[LIGHTBAR_COLOR_LIST_MAX] = { 0 };
+	int i, count, offset, n, result;
+
+	for (count = 0, offset = 0; count < driver_data->color_list_length; ++count) {
+		if (sscanf(buf + offset, " %6x%n", &colors[count], &n) != 1)
+			break;
+		offset += n;
+	}
+
+	if (count == 0 || *skip_spaces(buf + offset) != '\0')
+		return -EINVAL;
+
+	mutex_lock(&driver_data->lock);
+	for (i = 0; i < driver_data->color_list_length; ++i)
+		ite8291_set_color_list_entry(hdev, i, (colors[i] >> 16) & 0xff,
+					     (colors[i] >> 8) & 0xff, colors[i] & 0xff);
+	result = __ite8291_write_state(hdev);
+	mutex_unlock(&driver_data->lock);
+
+	if (result < 0)
+		return result;
+
+	return size;
+}
+
+static DEVICE_ATTR_RW(mode);
+static DEVICE_ATTR_RW(speed);
+static DEVICE_ATTR_RW(color_list);
+
+static struct attribute *lightbar_effect_attrs[] = {
+	&dev_attr_mode.attr,
+	&dev_attr_speed.attr,
+	&dev_attr_color_list.attr,
+	NULL
+};
+ATTRIBUTE_GROUPS(lightbar_effect);
+
 static int ite8291_init_leds(struct hid_device *hdev)
 {
 	struct ite8291_driver_data_t *ite8291_driver_data = hid_get_drvdata(hdev);
@@ -471,7 +712,7 @@ static int ite8291_init_leds(struct hid_device *hdev)
 
 	ite8291_driver_data->mcled_cdev_lightbar.led_cdev.name = "rgb:" "lightbar";
 	ite8291_driver_data->mcled_cdev_lightbar.led_cdev.max_brightness = LIGHTBAR_MAX_BRIGHTNESS;
-	ite8291_driver_data->mcled_cdev_lightbar.led_cdev.brightness_set = &leds_set_brightness_mc_lightbar;
+	ite8291_driver_data->mcled_cdev_lightbar.led_cdev.brightness_set_blocking = &leds_set_brightness_mc_lightbar;
 	ite8291_driver_data->mcled_cdev_lightbar.led_cdev.brightness = LIGHTBAR_DEFAULT_BRIGHTNESS;
 	ite8291_driver_data->mcled_cdev_lightbar.num_colors = 3;
 	ite8291_driver_data->mcled_cdev_lightbar.subled_info = ite8291_driver_data->mcled_cdev_subleds_lightbar;
@@ -484,6 +725,9 @@ static int ite8291_init_leds(struct hid_device *hdev)
 	ite8291_driver_data->mcled_cdev_lightbar.subled_info[2].color_index = LED_COLOR_ID_BLUE;
 	ite8291_driver_data->mcled_cdev_lightbar.subled_info[2].intensity = LIGHTBAR_DEFAULT_COLOR_BLUE;
 	ite8291_driver_data->mcled_cdev_lightbar.subled_info[2].channel = 0;
+	// Devices without color list only have mono
+	if (ite8291_driver_data->color_list_length != 0)
+		ite8291_driver_data->mcled_cdev_lightbar.led_cdev.groups = lightbar_effect_groups;
 
 	retval = devm_led_classdev_multicolor_register(&hdev->dev, &ite8291_driver_data->mcled_cdev_lightbar);
 	if (retval != 0)
@@ -497,13 +741,16 @@ static int ite8291_driver_data_setup(struct hid_device *hdev, struct ite8291_dri
 	int i;
 
 	driver_data->hid_dev = hdev;
+	mutex_init(&driver_data->lock);
+	driver_data->mode = LIGHTBAR_MODE_MONO;
+	driver_data->speed = LIGHTBAR_DEFAULT_SPEED;
 
 	switch (hdev->product) {
 	case 0x6010:
 		// Reference usage writes 9 entries but only 7 seem to be in
 		// effect. Therefore defining 7.
 	case 0x7000:
-		driver_data->color_list_length = 7;
+		driver_data->color_list_length = LIGHTBAR_COLOR_LIST_MAX;
 		break;
 
 	default:
@@ -568,6 +815,9 @@ static int driver_probe_callb(struct hid_device *hdev, const struct hid_device_i
 
 	hid_set_drvdata(hdev, ite8291_driver_data);
 
+	// Visible colors for the effects until userspace sets its own
+	ite8291_set_testcolors(hdev);
+
 	result = ite8291_init_leds(hdev);
 	if (result != 0)
 		return result;
@@ -33,6 +33,13 @@
 #include <linux/keyboard.h>
 #include <linux/dmi.h>
 #include <linux/led-class-multicolor.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/version.h>
+
+#include "../lwl_led_effects.h"
 
 MODULE_DESCRIPTION("TUXEDO Computers, ITE backlight driver");
 MODULE_AUTHOR("TUXEDO Computers GmbH <tux@tuxedocomputers.com>");
@@ -45,6 +52,9 @@ MODULE_LICENSE("GPL");
 
 #define HID_DATA_SIZE 6
 
+// Whole frame as written by userspace: rows 0 - 5, columns 0 - 19, 3 bytes RGB each
+#define ITE829X_FRAME_SIZE	(KEYBOARD_ROWS * KEYBOARD_COLUMNS * 3)
+
 // Keyboard events
 #define INT_KEY_B_NEXT		KEY_LIGHTS_TOGGLE
 
@@ -52,6 +62,26 @@ static struct hid_device *kbdev = NULL;
 static struct mutex dev_lock;
 static struct mutex input_lock;
 
+// Feature report buffer, allocated once on probe, protected by dev_lock
+static u8 *hid_buf;
+
+// Colors last sent per key, protected by dev_lock
+static u8 sent_colors[KEYBOARD_ROWS][KEYBOARD_COLUMNS][3];
+static bool sent_colors_valid = false;
+
+static struct ite829x_frame_stats_t {
+	u64 frames;
+	u64 keys_sent;
+	u64 keys_skipped;
+	u64 total_us;
+	u64 last_us;
+	u64 max_us;
+} frame_stats;
+
+static struct dentry *debugfs_dir;
+
+static struct lwl_led_effect led_effect;
+
 // Brightness (0-10)
 #define ITE829X_KBD_BRIGHTNESS_MAX	0x0a
 #define ITE829X_KBD_BRIGHTNESS_DEFAULT	0x00
@@ -76,29 +106,116 @@ static const int MODE_MAP_LENGTH = sizeof(mode_to_color)/sizeof(mode_to_color[0]
 // Amount of extra modes in addition to the color ones
 static const int MODE_EXTRAS_LENGTH = 2;
 
+/**
+ * Send one feature report, called with dev_lock held
+ */
+static int __keyb_send_data(struct hid_device *dev, u8 cmd, u8 d0, u8 d1, u8 d2, u8 d3)
+{
+	pr_debug("keyb_send_data: cmd: %hhu, d0: %hhu, d1: %hhu, d2: %hhu, d3: %hhu\n", cmd, d0, d1, d2, d3);
+
+	if (dev == NULL || hid_buf == NULL) {
+		return -ENODEV;
+	}
+
+	hid_buf[0] = 0xcc;
+	hid_buf[1] = cmd;
+	hid_buf[2] = d0;
+	hid_buf[3] = d1;
+	hid_buf[4] = d2;
+	hid_buf[5] = d3;
+
+	return hid_hw_raw_request(dev, hid_buf[0], hid_buf, HID_DATA_SIZE, HID_FEATURE_REPORT, HID_REQ_SET_REPORT);
+}
+
 static int keyb_send_data(struct hid_device *dev, u8 cmd, u8 d0, u8 d1, u8 d2, u8 d3)
 {
-	int result = 0;
-	u8 *buf;
+	int result;
 
-	pr_debug("keyb_send_data: cmd: %hhu, d0: %hhu, d1: %hhu, d2: %hhu, d3: %hhu\n", cmd, d0, d1, d2, d3);
+	mutex_lock(&dev_lock);
+	result = __keyb_send_data(dev, cmd, d0, d1, d2, d3);
+	mutex_unlock(&dev_lock);
+
+	return result;
+}
+
+/**
+ * Send color for one key and remember it, called with dev_lock held
+ */
+static int __keyb_send_key(struct hid_device *dev, int row, int col, u8 red, u8 green, u8 blue)
+{
+	int result;
+
+	result = __keyb_send_data(dev, 0x01, get_led_id(row, col), red, green, blue);
+	if (result >= 0) {
+		sent_colors[row][col][0] = red;
+		sent_colors[row][col][1] = green;
+		sent_colors[row][col][2] = blue;
+	} else {
+		sent_colors_valid = false;
+	}
+
+	return result;
+}
+
+/**
+ * Send a frame of RGB per key, row by row, or the colors of all LED
+ * classdevs when frame is NULL
+ *
+ * Holds dev_lock for the whole frame and skips keys whose color is
+ * unchanged since the last write unless force is set.
+ */
+static int keyb_write_frame(struct hid_device *dev, const u8 *frame, bool force)
+{
+	int row, col, result = 0;
+	u64 sent = 0, skipped = 0, delta_us;
+	struct mc_subled *subleds;
+	u8 key_color[3];
+	const u8 *color;
+	ktime_t start;
 
 	if (dev == NULL) {
 		return -ENODEV;
 	}
 
 	mutex_lock(&dev_lock);
+	start = ktime_get();
 
-	buf = kzalloc(HID_DATA_SIZE, GFP_KERNEL);
-	buf[0] = 0xcc;
-	buf[1] = cmd;
-	buf[2] = d0;
-	buf[3] = d1;
-	buf[4] = d2;
-	buf[5] = d3;
+	if (!sent_colors_valid)
+		force = true;
+	sent_colors_valid = true;
 
-	result = hid_hw_raw_request(dev, buf[0], buf, HID_DATA_SIZE, HID_FEATURE_REPORT, HID_REQ_SET_REPORT);
-	kfree(buf);
+	for (row = 0; row < KEYBOARD_ROWS; ++row) {
+		for (col = 0; col < KEYBOARD_COLUMNS; ++col) {
+			if (frame) {
+				color = &frame[(row * KEYBOARD_COLUMNS + col) * 3];
+			} else {
+				subleds = clevo_mcled_cdevs[row][col].subled_info;
+				key_color[0] = subleds[0].intensity;
+				key_color[1] = subleds[1].intensity;
+				key_color[2] = subleds[2].intensity;
+				color = key_color;
+			}
+			if (!force && memcmp(sent_colors[row][col], color, 3) == 0) {
+				++skipped;
+				continue;
+			}
+			result = __keyb_send_key(dev, row, col, color[0], color[1], color[2]);
+			if (result < 0)
+				goto out;
+			++sent;
+		}
+	}
+	result = 0;
+
+out:
+	delta_us = ktime_us_delta(ktime_get(), start);
+	frame_stats.frames += 1;
+	frame_stats.keys_sent += sent;
+	frame_stats.keys_skipped += skipped;
+	frame_stats.total_us += delta_us;
+	frame_stats.last_us = delta_us;
+	if (delta_us > frame_stats.max_us)
+		frame_stats.max_us = delta_us;
 
 	mutex_unlock(&dev_lock);
 
@@ -113,9 +230,9 @@ static void keyb_set_all(struct hid_device *dev, u8 color_red, u8 color_green, u
 			clevo_mcled_cdevs[row][col].subled_info[0].intensity = color_red;
 			clevo_mcled_cdevs[row][col].subled_info[1].intensity = color_green;
 			clevo_mcled_cdevs[row][col].subled_info[2].intensity = color_blue;
-			keyb_send_data(dev, 0x01, get_led_id(row, col), color_red, color_green, color_blue);
 		}
 	}
+	keyb_write_frame(dev, NULL, false);
 }
 
 static void send_mode(struct hid_device *dev, int mode)
@@ -148,18 +265,21 @@ static void send_mode(struct hid_device *dev, int mode)
 					clevo_mcled_cdevs[row][col].subled_info[0].intensity = 0xff;
 					clevo_mcled_cdevs[row][col].subled_info[1].intensity = 0x00;
 					clevo_mcled_cdevs[row][col].subled_info[2].intensity = 0x00;
-					keyb_send_data(dev, 0x01, get_led_id(row, col), 0xff, 0x00, 0x00);
 				} else {
 					clevo_mcled_cdevs[row][col].subled_info[0].intensity = 0xff;
 					clevo_mcled_cdevs[row][col].subled_info[1].intensity = 0xff;
 					clevo_mcled_cdevs[row][col].subled_info[2].intensity = 0xff;
-					keyb_send_data(dev, 0x01, get_led_id(row, col), 0xff, 0xff, 0xff);
 				}
 			}
 		}
+		keyb_write_frame(dev, NULL, false);
 	} else if (mode == MODE_MAP_LENGTH + 1) {
-		// Random color animating effect, special mode
-		keyb_send_data(dev, 0x00, 0x09, 0x00, 0x00, 0x00);
+		// Random color animating effect, special mode. It changes every
+		// key, the next frame has to be sent in full.
+		mutex_lock(&dev_lock);
+		__keyb_send_data(dev, 0x00, 0x09, 0x00, 0x00, 0x00);
+		sent_colors_valid = false;
+		mutex_unlock(&dev_lock);
 	}
 }
 
@@ -205,6 +325,7 @@ static void leds_set_brightness_mc(struct led_classdev *led_cdev, enum led_brigh
 		 led_cdev_mc->subled_info[1].intensity, led_cdev_mc->subled_info[2].intensity);
 
 	ti_data.brightness = brightness;
+	lwl_led_effect_set_enabled(&led_effect, brightness != 0);
 
 	for (i = 0; i < KEYBOARD_ROWS; ++i) {
 		for (j = 0; j < KEYBOARD_COLUMNS; ++j) {
@@ -212,20 +333,122 @@ static void leds_set_brightness_mc(struct led_classdev *led_cdev, enum led_brigh
 		}
 	}
 
-	keyb_send_data(kbdev, 0x09, brightness, 0x02, 0x00, 0x00);
+	mutex_lock(&dev_lock);
+	__keyb_send_data(kbdev, 0x09, brightness, 0x02, 0x00, 0x00);
+	// A running effect owns the key colors, the new color shows once it ends
+	if (!lwl_led_effect_active(&led_effect))
+		__keyb_send_key(kbdev, (led_cdev_mc->subled_info[0].channel >> 5) & 0x07,
+				led_cdev_mc->subled_info[0].channel & 0x1f,
+				led_cdev_mc->subled_info[0].intensity,
+				led_cdev_mc->subled_info[1].intensity,
+				led_cdev_mc->subled_info[2].intensity);
+	mutex_unlock(&dev_lock);
+}
+
+/**
+ * Set all keys from a frame of RGB per key, row by row, and send it
+ */
+static int keyb_set_frame(const u8 *frame)
+{
+	int row, col, result;
+	const u8 *color;
+
+	mutex_lock(&input_lock);
+	for (row = 0; row < KEYBOARD_ROWS; ++row) {
+		for (col = 0; col < KEYBOARD_COLUMNS; ++col) {
+			color = &frame[(row * KEYBOARD_COLUMNS + col) * 3];
+			clevo_mcled_cdevs[row][col].subled_info[0].intensity = color[0];
+			clevo_mcled_cdevs[row][col].subled_info[1].intensity = color[1];
+			clevo_mcled_cdevs[row][col].subled_info[2].intensity = color[2];
+		}
+	}
+	result = keyb_write_frame(kbdev, NULL, false);
+	mutex_unlock(&input_lock);
+
+	return result;
+}
+
+// Effect frames go to the device only, the classdevs keep the user's colors
+static int led_effect_render(void *drvdata, const u8 *frame)
+{
+	return keyb_write_frame(kbdev, frame, false);
+}
+
+static int led_effect_restore(void *drvdata)
+{
+	return keyb_write_frame(kbdev, NULL, false);
+}
+
+static const struct lwl_led_effect_output led_effect_output = {
+	.render = led_effect_render,
+	.restore = led_effect_restore,
+};
+
+static int frame_stats_show(struct seq_file *m, void *unused)
+{
+	mutex_lock(&dev_lock);
+	seq_printf(m, "frames: %llu\n", frame_stats.frames);
+	seq_printf(m, "keys_sent: %llu\n", frame_stats.keys_sent);
+	seq_printf(m, "keys_skipped: %llu\n", frame_stats.keys_skipped);
+	seq_printf(m, "avg_us: %llu\n", frame_stats.frames ? div64_u64(frame_stats.total_us, frame_stats.frames) : 0);
+	seq_printf(m, "last_us: %llu\n", frame_stats.last_us);
+	seq_printf(m, "max_us: %llu\n", frame_stats.max_us);
+	mutex_unlock(&dev_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(frame_stats);
+
+/**
+ * Whole frame write
+ *
+ * Takes exactly ITE829X_FRAME_SIZE bytes, RGB per key, row by row, and
+ * sends the changed keys in one go. Fails with -EBUSY while a led_effect
+ * is running.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+static ssize_t frame_write(struct file *filp, struct kobject *kobj, struct bin_attribute *attr,
+			   char *buf, loff_t off, size_t count)
+#else
+static ssize_t frame_write(struct file *filp, struct kobject *kobj, const struct bin_attribute *attr,
+			   char *buf, loff_t off, size_t count)
+#endif
+{
+	int result;
+
+	if (off != 0 || count != ITE829X_FRAME_SIZE)
+		return -EINVAL;
 
-	keyb_send_data(kbdev, 0x01, led_cdev_mc->subled_info[0].channel,
-		       led_cdev_mc->subled_info[0].intensity,
-		       led_cdev_mc->subled_info[1].intensity,
-		       led_cdev_mc->subled_info[2].intensity);
+	if (lwl_led_effect_active(&led_effect))
+		return -EBUSY;
+
+	result = keyb_set_frame(buf);
+	if (result < 0)
+		return result;
+
+	return count;
 }
 
+static struct bin_attribute bin_attr_frame = {
+	.attr = { .name = "frame", .mode = 0200 },
+	.size = ITE829X_FRAME_SIZE,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0) && LINUX_VERSION_CODE < KERNEL_VERSION(6, 16, 0)
+	.write_new = frame_write,
+#else
+	.write = frame_write,
+#endif
+};
+
 static void key_actions(unsigned long key_code)
 {
 	mutex_lock(&input_lock);
 
 	switch (key_code) {
 	case INT_KEY_B_NEXT:
+		// The mode would be drawn over the running effect
+		if (lwl_led_effect_active(&led_effect))
+			break;
+
 		// Next mode
 		ti_data.mode += 1;
 
@@ -287,20 +510,16 @@ static int probe_callb(struct hid_device *dev, const struct hid_device_id *id)
 
 	mutex_init(&dev_lock);
 
+	hid_buf = devm_kzalloc(&dev->dev, HID_DATA_SIZE, GFP_KERNEL);
+	if (!hid_buf)
+		return -ENOMEM;
+	sent_colors_valid = false;
+
 	result = start_hw(dev);
 	if (result != 0) {
 		return result;
 	}
 
-	keyb_send_data(kbdev, 0x09, ti_data.brightness, 0x02, 0x00, 0x00);
-	for (i = 0; i < KEYBOARD_ROWS; ++i) {
-		for (j = 0; j < KEYBOARD_COLUMNS; ++j) {
-			pr_debug("Initialize led %d to %d %d %d.\n", get_led_id(i, j), 255, 255, 255);
-
-			keyb_send_data(dev, 0x01, get_led_id(i, j), 255, 255, 255);
-		}
-	}
-
 	for (i = 0; i < KEYBOARD_ROWS; ++i) {
 		for (j = 0; j < KEYBOARD_COLUMNS; ++j) {
 			clevo_mcled_cdevs[i][j].led_cdev.name = "rgb:" LED_FUNCTION_KBD_BACKLIGHT;
@@ -323,15 +542,36 @@ static int probe_callb(struct hid_device *dev, const struct hid_device_id *id)
 		}
 	}
 
+	// Initialize all leds to white
+	keyb_send_data(kbdev, 0x09, ti_data.brightness, 0x02, 0x00, 0x00);
+	keyb_write_frame(dev, NULL, true);
+
+	if (sysfs_create_bin_file(&dev->dev.kobj, &bin_attr_frame))
+		pr_err("Creating frame attribute failed\n");
+
+	debugfs_dir = debugfs_create_dir(KBUILD_MODNAME, NULL);
+	debugfs_create_file("frame_stats", 0444, debugfs_dir, NULL, &frame_stats_fops);
+
 	register_keyboard_notifier(&keyboard_notifier_block);
 
+	led_effect.rows = KEYBOARD_ROWS;
+	led_effect.columns = KEYBOARD_COLUMNS;
+	led_effect.output = &led_effect_output;
+	result = lwl_led_effect_register(&led_effect, &dev->dev);
+	if (result)
+		pr_err("led effect registration failed: %d\n", result);
+
 	return 0;
 }
 
 static void remove_callb(struct hid_device *dev)
 {
 	int i, j;
+	lwl_led_effect_unregister(&led_effect);
 	unregister_keyboard_notifier(&keyboard_notifier_block);
+	debugfs_remove_recursive(debugfs_dir);
+	debugfs_dir = NULL;
+	sysfs_remove_bin_file(&dev->dev.kobj, &bin_attr_frame);
 	for (i = 0; i < KEYBOARD_ROWS; ++i) {
 		for (j = 0; j < KEYBOARD_COLUMNS; ++j) {
 			devm_led_classdev_multicolor_unregister(&dev->dev, &clevo_mcled_cdevs[i][j]);
@@ -344,23 +584,25 @@ static void remove_callb(struct hid_device *dev)
 static int driver_suspend_callb(struct device *dev)
 {
 	pr_debug("driver suspend\n");
+	lwl_led_effect_suspend(&led_effect);
 	return 0;
 }
 
 static int driver_resume_callb(struct device *dev)
 {
-	int i, j;
 	pr_debug("driver resume\n");
 	keyb_send_data(kbdev, 0x09, ti_data.brightness, 0x02, 0x00, 0x00);
-	for (i = 0; i < KEYBOARD_ROWS; ++i) {
-		for (j = 0; j < KEYBOARD_COLUMNS; ++j) {
-			keyb_send_data(kbdev, 0x01, get_led_id(i, j),
-				       clevo_mcled_cdevs[i][j].subled_info[0].intensity,
-				       clevo_mcled_cdevs[i][j].subled_info[1].intensity,
-				       clevo_mcled_cdevs[i][j].subled_info[2].intensity);
-		}
+	if (lwl_led_effect_active(&led_effect)) {
+		// Device state is lost, the next effect frame goes out in full
+		mutex_lock(&dev_lock);
+		sent_colors_valid = false;
+		mutex_unlock(&dev_lock);
+	} else {
+		// Device state is lost, resend every key
+		keyb_write_frame(kbdev, NULL, true);
+		send_mode(kbdev, ti_data.mode);
 	}
-	send_mode(kbdev, ti_data.mode);
+	lwl_led_effect_resume(&led_effect);
 	return 0;
 }
 
@@ -30,13 +30,24 @@
 #include <linux/delay.h>
 #include <linux/version.h>
 #include <linux/dmi.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/suspend.h>
+#include <linux/string.h>
 #include "../clevo_interfaces.h"
 #include "../uniwill_interfaces.h"
+#include "../lwl_state_restore.h"
 #include "lwl_io_ioctl.h"
 
 MODULE_DESCRIPTION("Hardware interface for TUXEDO laptops");
 MODULE_AUTHOR("TUXEDO Computers GmbH <tux@tuxedocomputers.com>");
-MODULE_VERSION("0.3.9");
+MODULE_VERSION("0.3.11");
 MODULE_LICENSE("GPL");
 
 MODULE_ALIAS_CLEVO_INTERFACES();
@@ -55,21 +66,15 @@ static u32 id_check_uniwill;
 
 static struct uniwill_device_features_t *uw_feats;
 
-enum uw_perf_profiles_v1 {
-	PROFILE_POWERSAVE = 1,
-	PROFILE_ENTHUSIAST = 2,
-	PROFILE_OVERBOOST = 3,
-};
-
 static int set_full_fan_mode(bool enable);
 static int uw_init_fan(void);
-static u32 uw_set_fan(u32 fan_index, u8 fan_speed);
+static int uw_set_fan(u32 fan_index, u8 fan_speed);
 static u32 uw_set_fan_auto(void);
 static int uw_get_tdp_min(u8 tdp_index);
 static int uw_get_tdp_max(u8 tdp_index);
 static int uw_get_tdp(u8 tdp_index);
 static int uw_set_tdp(u8 tdp_index, int tdp_value);
-static u32 uw_set_performance_profile_v1(enum uw_perf_profiles_v1 profile);
+static int uw_fan_curve_start(void);
 
 /**
  * strstr version of dmi_match
@@ -256,6 +261,70 @@ static int fop_release(struct inode *inode, struct file *file)
 	return 0;
 }*/
 
+/*
+ * Settings replayed after resume
+ *
+ * Values applied through the ioctl and sysfs interfaces are recorded,
+ * firmware may have reset TDP and fan control while suspended. The
+ * performance profile is replayed by lwl_keyboard before this.
+ */
+static struct lwl_state lwl_io_state = lwl_STATE_INIT(lwl_io_state);
+
+static int cl_fan_restore(struct lwl_state_item *item, u64 value)
+{
+	u32 result;
+
+	return clevo_evaluate_method(CLEVO_CMD_SET_FANSPEED_VALUE, value, &result);
+}
+
+static int uw_tdp_restore(struct lwl_state_item *item, u64 value)
+{
+	return uw_set_tdp((uintptr_t)item->drvdata, value);
+}
+
+static int uw_fan_restore(struct lwl_state_item *item, u64 value)
+{
+	return uw_set_fan((uintptr_t)item->drvdata, value);
+}
+
+static int uw_fan_curve_restore(struct lwl_state_item *item, u64 value)
+{
+	return uw_fan_curve_start();
+}
+
+static struct lwl_state_item cl_state_fan =
+	lwl_STATE_ITEM("clevo_fan", lwl_STATE_STAGE_FAN, cl_fan_restore);
+
+static struct lwl_state_item uw_state_tdp[] = {
+	lwl_STATE_ITEM("tdp0", lwl_STATE_STAGE_POWER, uw_tdp_restore),
+	lwl_STATE_ITEM("tdp1", lwl_STATE_STAGE_POWER, uw_tdp_restore),
+	lwl_STATE_ITEM("tdp2", lwl_STATE_STAGE_POWER, uw_tdp_restore),
+};
+
+static struct lwl_state_item uw_state_fan[] = {
+	lwl_STATE_ITEM("fan1", lwl_STATE_STAGE_FAN, uw_fan_restore),
+	lwl_STATE_ITEM("fan2", lwl_STATE_STAGE_FAN, uw_fan_restore),
+};
+
+static struct lwl_state_item uw_state_fan_curve =
+	lwl_STATE_ITEM("fan_curve", lwl_STATE_STAGE_FAN, uw_fan_curve_restore);
+
+static void lwl_io_state_init(void)
+{
+	uintptr_t i;
+
+	lwl_state_add(&lwl_io_state, &cl_state_fan);
+	for (i = 0; i < ARRAY_SIZE(uw_state_tdp); ++i) {
+		uw_state_tdp[i].drvdata = (void *)i;
+		lwl_state_add(&lwl_io_state, &uw_state_tdp[i]);
+	}
+	for (i = 0; i < ARRAY_SIZE(uw_state_fan); ++i) {
+		uw_state_fan[i].drvdata = (void *)i;
+		lwl_state_add(&lwl_io_state, &uw_state_fan[i]);
+	}
+	lwl_state_add(&lwl_io_state, &uw_state_fan_curve);
+}
+
 static long clevo_ioctl_interface(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	u32 result = 0, status;
@@ -263,7 +332,6 @@ static long clevo_ioctl_interface(struct file *file, unsigned int cmd, unsigned
 	u32 argument = (u32) arg;
 	int i;
 
-	u32 clevo_arg;
 
 	const char str_no_if[] = "";
 	char *str_clevo_if;
@@ -325,7 +393,8 @@ static long clevo_ioctl_interface(struct file *file, unsigned int cmd, unsigned
 			argument |= fanspeeds[1] << 8;
 			argument |= fanspeeds[2] << 16;
 
-			clevo_evaluate_method(CLEVO_CMD_SET_FANSPEED_VALUE, argument, &result);
+			if (clevo_evaluate_method(CLEVO_CMD_SET_FANSPEED_VALUE, argument, &result) == 0)
+				lwl_state_record(&lwl_io_state, &cl_state_fan, argument);
 			// Note: Delay needed to let hardware catch up with the written value.
 			// No known ready flag. If the value is read too soon, the old value
 			// will still be read out.
@@ -336,6 +405,7 @@ static long clevo_ioctl_interface(struct file *file, unsigned int cmd, unsigned
 		case W_CL_FANAUTO:
 			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
 			clevo_evaluate_method(CLEVO_CMD_SET_FANSPEED_AUTO, argument, &result);
+			lwl_state_forget(&lwl_io_state, &cl_state_fan);
 			break;
 		case W_CL_WEBCAM_SW:
 			if (dmi_match(DMI_PRODUCT_SKU, "AURA14GEN3") ||
@@ -359,8 +429,7 @@ static long clevo_ioctl_interface(struct file *file, unsigned int cmd, unsigned
 			break;
 		case W_CL_PERF_PROFILE:
 			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
-			clevo_arg = (CLEVO_CMD_OPT_SUB_SET_PERF_PROF << 0x18) | (argument & 0xff);
-			clevo_evaluate_method(CLEVO_CMD_OPT, clevo_arg, &result);
+			clevo_set_performance_profile(argument & 0xff);
 			break;
 	}
 
@@ -384,25 +453,181 @@ static int set_full_fan_mode(bool enable) {
 	return 0;
 }
 
+/*
+ * Custom fan tables
+ *
+ * The 0x0fxx tables are written by a work item queued at module load,
+ * entries already holding the expected value are skipped. uw_init_fan()
+ * waits for it, with a timeout, and then only switches the custom tables
+ * on, which is also all that is needed again after uw_set_fan_auto().
+ */
+#define UW_FAN_TABLE_ENTRIES	0x10
+#define UW_FAN_TABLE_OPS	(6 * UW_FAN_TABLE_ENTRIES)
+
+#define UW_FAN_TABLE_CPU_END_TEMP	0x0f00
+#define UW_FAN_TABLE_CPU_START_TEMP	0x0f10
+#define UW_FAN_TABLE_CPU_FAN_SPEED	0x0f20
+#define UW_FAN_TABLE_GPU_END_TEMP	0x0f30
+#define UW_FAN_TABLE_GPU_START_TEMP	0x0f40
+#define UW_FAN_TABLE_GPU_FAN_SPEED	0x0f50
+
+/**
+ * Fan table init, see uw_init_fan()
+ *
+ * lock serializes the users of queued, status and fans_initialized. The
+ * work itself does not take it, its results are published by done.
+ */
+struct uw_fan_init_state_t {
+	struct work_struct work;
+	struct completion done;
+	struct mutex lock;
+	bool queued;
+	int status;
+	u64 duration_us;
+	unsigned int written;
+	unsigned int skipped;
+	// Time fan requests spent waiting for the table
+	u64 wait_us;
+};
+
+static struct uw_fan_init_state_t uw_fan_init;
 static bool fans_initialized = false;
 
-static int uw_init_fan(void) {
-	int i, temp_offset;
+/**
+ * Setup
+ * - one controllable zone 0-115 deg
+ * - rest 116-117, 117-118 etc single non reachable dummy zones
+ *   with increasing ranges and max fan (same or increasing)
+ */
+static void uw_fan_table_fill(struct uniwill_ec_op_t *table_ops)
+{
+	int i, n = 0, temp_offset = 115;
+	u8 start_temp, fan_speed;
+
+	for (i = 0x0; i < UW_FAN_TABLE_ENTRIES; ++i) {
+		start_temp = i == 0 ? 0 : temp_offset + i;
+		fan_speed = i == 0 ? 0x00 : 0xc8;
+		table_ops[n++] = (struct uniwill_ec_op_t) { .type = UW_EC_OP_WRITE_VERIFY,
+			.addr = UW_FAN_TABLE_CPU_END_TEMP + i, .data = i == 0 ? 115 : temp_offset + i + 1 };
+		table_ops[n++] = (struct uniwill_ec_op_t) { .type = UW_EC_OP_WRITE_VERIFY,
+			.addr = UW_FAN_TABLE_CPU_START_TEMP + i, .data = start_temp };
+		table_ops[n++] = (struct uniwill_ec_op_t) { .type = UW_EC_OP_WRITE_VERIFY,
+			.addr = UW_FAN_TABLE_CPU_FAN_SPEED + i, .data = fan_speed };
+		table_ops[n++] = (struct uniwill_ec_op_t) { .type = UW_EC_OP_WRITE_VERIFY,
+			.addr = UW_FAN_TABLE_GPU_END_TEMP + i, .data = i == 0 ? 120 : temp_offset + i + 1 };
+		table_ops[n++] = (struct uniwill_ec_op_t) { .type = UW_EC_OP_WRITE_VERIFY,
+			.addr = UW_FAN_TABLE_GPU_START_TEMP + i, .data = start_temp };
+		table_ops[n++] = (struct uniwill_ec_op_t) { .type = UW_EC_OP_WRITE_VERIFY,
+			.addr = UW_FAN_TABLE_GPU_FAN_SPEED + i, .data = fan_speed };
+	}
+}
+
+/**
+ * Read the tables in one transaction and write the differing entries
+ *
+ * The speed of the controllable zone is set by uw_set_fan() right after
+ * the tables are switched on, its current value is accepted as is.
+ */
+static int uw_fan_table_write(void)
+{
+	struct uniwill_ec_op_t *table_ops, *read_ops;
+	int i, n, status;
+
+	table_ops = kcalloc(UW_FAN_TABLE_OPS, sizeof(*table_ops), GFP_KERNEL);
+	read_ops = kcalloc(UW_FAN_TABLE_OPS, sizeof(*read_ops), GFP_KERNEL);
+	if (!table_ops || !read_ops) {
+		kfree(table_ops);
+		kfree(read_ops);
+		return -ENOMEM;
+	}
+
+	uw_fan_table_fill(table_ops);
+
+	// Entries not read successfully are written
+	for (i = 0; i < UW_FAN_TABLE_OPS; ++i)
+		read_ops[i] = (struct uniwill_ec_op_t) { .type = UW_EC_OP_READ,
+			.addr = table_ops[i].addr, .status = -ENODATA };
+	uniwill_ec_transaction(read_ops, UW_FAN_TABLE_OPS);
+
+	n = 0;
+	for (i = 0; i < UW_FAN_TABLE_OPS; ++i) {
+		if (read_ops[i].status == 0 &&
+		    (read_ops[i].data == table_ops[i].data ||
+		     table_ops[i].addr == UW_FAN_TABLE_CPU_FAN_SPEED ||
+		     table_ops[i].addr == UW_FAN_TABLE_GPU_FAN_SPEED))
+			continue;
+		table_ops[n++] = table_ops[i];
+	}
+
+	uw_fan_init.written = n;
+	uw_fan_init.skipped = UW_FAN_TABLE_OPS - n;
+
+	status = n > 0 ? uniwill_ec_transaction_with_retry(table_ops, n, 3) : 0;
 
+	kfree(table_ops);
+	kfree(read_ops);
+
+	return status;
+}
+
+static void uw_fan_init_work_func(struct work_struct *work)
+{
+	ktime_t start = ktime_get();
+
+	uw_fan_init.status = uw_fan_table_write();
+	uw_fan_init.duration_us = ktime_us_delta(ktime_get(), start);
+
+	if (uw_fan_init.status)
+		pr_err("fan table init failed: %d\n", uw_fan_init.status);
+	pr_debug("fan table init: %u written, %u skipped, %llu us\n",
+		 uw_fan_init.written, uw_fan_init.skipped, uw_fan_init.duration_us);
+
+	complete_all(&uw_fan_init.done);
+}
+
+/**
+ * Queue the table write, called with uw_fan_init.lock held
+ */
+static void uw_init_fan_async(void)
+{
+	if (uw_fan_init.queued || !uw_feats->uniwill_has_universal_ec_fan_control)
+		return;
+
+	uw_fan_init.queued = true;
+	schedule_work(&uw_fan_init.work);
+}
+
+// Longest a fan request waits for the table work before giving up
+#define UW_FAN_INIT_TIMEOUT_MS	2000
+
+static int uw_init_fan(void) {
+	ktime_t start;
+	unsigned long time_left;
+	int status;
 	u16 addr_use_custom_fan_table_0 = 0x07c5; // use different tables for both fans (0x0f00-0x0f2f and 0x0f30-0x0f5f respectivly)
 	u16 addr_use_custom_fan_table_1 = 0x07c6; // enable 0x0fxx fantables
 	u8 offset_use_custom_fan_table_0 = 7;
 	u8 offset_use_custom_fan_table_1 = 2;
 	u8 value_use_custom_fan_table_0;
 	u8 value_use_custom_fan_table_1;
-	u16 addr_cpu_custom_fan_table_end_temp = 0x0f00;
-	u16 addr_cpu_custom_fan_table_start_temp = 0x0f10;
-	u16 addr_cpu_custom_fan_table_fan_speed = 0x0f20;
-	u16 addr_gpu_custom_fan_table_end_temp = 0x0f30;
-	u16 addr_gpu_custom_fan_table_start_temp = 0x0f40;
-	u16 addr_gpu_custom_fan_table_fan_speed = 0x0f50;
 
+	// Held across the wait, so the completion is not reinitialized under a
+	// waiter. The work does not take the lock.
+	mutex_lock(&uw_fan_init.lock);
 	if (!fans_initialized && uw_feats->uniwill_has_universal_ec_fan_control) {
+		// Identification may have happened after module load
+		uw_init_fan_async();
+
+		start = ktime_get();
+		time_left = wait_for_completion_timeout(&uw_fan_init.done,
+							msecs_to_jiffies(UW_FAN_INIT_TIMEOUT_MS));
+		uw_fan_init.wait_us += ktime_us_delta(ktime_get(), start);
+		if (!time_left) {
+			pr_err("fan table init timed out\n");
+			status = -ETIMEDOUT;
+			goto out;
+		}
+
 		set_full_fan_mode(false);
 
 		uniwill_read_ec_ram(addr_use_custom_fan_table_0, &value_use_custom_fan_table_0);
@@ -410,24 +635,15 @@ static int uw_init_fan(void) {
 			uniwill_write_ec_ram_with_retry(addr_use_custom_fan_table_0, value_use_custom_fan_table_0 + (1 << offset_use_custom_fan_table_0), 3);
 		}
 
-		// Setup
-		// - one controllable zone 0-115 deg
-		// - rest 116-117, 117-118 etc single non reachable dummy zones
-		//   with increasing ranges and max fan (same or increasing)
-		uniwill_write_ec_ram_with_retry(addr_cpu_custom_fan_table_end_temp, 115, 3);
-		uniwill_write_ec_ram_with_retry(addr_cpu_custom_fan_table_start_temp, 0, 3);
-		uniwill_write_ec_ram_with_retry(addr_cpu_custom_fan_table_fan_speed, 0x00, 3);
-		uniwill_write_ec_ram_with_retry(addr_gpu_custom_fan_table_end_temp, 120, 3);
-		uniwill_write_ec_ram_with_retry(addr_gpu_custom_fan_table_start_temp, 0, 3);
-		uniwill_write_ec_ram_with_retry(addr_gpu_custom_fan_table_fan_speed, 0x00, 3);
-		temp_offset = 115;
-		for (i = 0x1; i <= 0xf; ++i) {
-			uniwill_write_ec_ram_with_retry(addr_cpu_custom_fan_table_end_temp + i, temp_offset + i + 1, 3);
-			uniwill_write_ec_ram_with_retry(addr_cpu_custom_fan_table_start_temp + i, temp_offset + i, 3);
-			uniwill_write_ec_ram_with_retry(addr_cpu_custom_fan_table_fan_speed + i, 0xc8, 3);
-			uniwill_write_ec_ram_with_retry(addr_gpu_custom_fan_table_end_temp + i, temp_offset + i + 1, 3);
-			uniwill_write_ec_ram_with_retry(addr_gpu_custom_fan_table_start_temp + i, temp_offset + i, 3);
-			uniwill_write_ec_ram_with_retry(addr_gpu_custom_fan_table_fan_speed + i, 0xc8, 3);
+		// The tables are only used once enabled below. If the early write
+		// failed, e.g. refused in full fan mode, redo it in the baseline order.
+		if (uw_fan_init.status) {
+			status = uw_fan_table_write();
+			uw_fan_init.status = status;
+			if (status) {
+				pr_err("fan table write failed: %d\n", status);
+				goto out;
+			}
 		}
 
 		uniwill_read_ec_ram(addr_use_custom_fan_table_1, &value_use_custom_fan_table_1);
@@ -437,9 +653,31 @@ static int uw_init_fan(void) {
 	}
 
 	fans_initialized = true;
+	status = 0;
+
+out:
+	mutex_unlock(&uw_fan_init.lock);
+
+	return status;
+}
+
+static int uw_fan_init_show(struct seq_file *m, void *unused)
+{
+	if (!uw_fan_init.queued)
+		seq_puts(m, "state: idle\n");
+	else if (!completion_done(&uw_fan_init.done))
+		seq_puts(m, "state: pending\n");
+	else
+		seq_puts(m, "state: done\n");
+	seq_printf(m, "status: %d\n", uw_fan_init.status);
+	seq_printf(m, "duration_us: %llu\n", uw_fan_init.duration_us);
+	seq_printf(m, "written: %u\n", uw_fan_init.written);
+	seq_printf(m, "skipped: %u\n", uw_fan_init.skipped);
+	seq_printf(m, "wait_us: %llu\n", uw_fan_init.wait_us);
 
 	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(uw_fan_init);
 
 static int direct_fan_control(u32 fan_index, u8 fan_speed, bool prevent_rampup)
 {
@@ -468,8 +706,11 @@ static int direct_fan_control(u32 fan_index, u8 fan_speed, bool prevent_rampup)
 		// Attempt to write both fans as quick as possible before complete ramp-up
 		pr_debug("prevent ramp-up start\n");
 		for (i = 0; i < 10; ++i) {
-			uniwill_write_ec_ram(addr_fan0, fan_speed & 0xff);
-			uniwill_write_ec_ram(addr_fan1, fan_speed & 0xff);
+			struct uniwill_ec_op_t ops[] = {
+				{ .type = UW_EC_OP_WRITE, .addr = addr_fan0, .data = fan_speed & 0xff },
+				{ .type = UW_EC_OP_WRITE, .addr = addr_fan1, .data = fan_speed & 0xff }
+			};
+			uniwill_ec_transaction(ops, ARRAY_SIZE(ops));
 			msleep(10);
 		}
 		pr_debug("prevent ramp-up done\n");
@@ -481,22 +722,27 @@ static int direct_fan_control(u32 fan_index, u8 fan_speed, bool prevent_rampup)
 	return 0;
 }
 
-static u32 uw_set_fan(u32 fan_index, u8 fan_speed)
+static int uw_set_fan(u32 fan_index, u8 fan_speed)
 {
 	u16 addr_for_fan;
-
-	u16 addr_cpu_custom_fan_table_fan_speed = 0x0f20;
-	u16 addr_gpu_custom_fan_table_fan_speed = 0x0f50;
+	u16 addr_fan0 = 0x1804;
+	u16 addr_fan1 = 0x1809;
+	struct uniwill_ec_op_t ops[2];
+	int err, i;
 
 	if (uw_feats->uniwill_has_universal_ec_fan_control) {
-		uw_init_fan();
+		err = uw_init_fan();
+		if (err)
+			return err;
 
 		if (fan_index == 0)
-			addr_for_fan = addr_cpu_custom_fan_table_fan_speed;
+			addr_for_fan = UW_FAN_TABLE_CPU_FAN_SPEED;
 		else if (fan_index == 1)
-			addr_for_fan = addr_gpu_custom_fan_table_fan_speed;
+			addr_for_fan = UW_FAN_TABLE_GPU_FAN_SPEED;
 		else
 			return -EINVAL;
+		ops[0].addr = addr_for_fan;
+		ops[1].addr = fan_index == 0 ? addr_fan0 : addr_fan1;
 
 		if (fan_speed > NB02_FAN_SPEED_MAX)
 			return -EINVAL;
@@ -518,9 +764,18 @@ static u32 uw_set_fan(u32 fan_index, u8 fan_speed)
 			fan_speed = 1;
 		}
 
-		uniwill_write_ec_ram(addr_for_fan, fan_speed & 0xff);
-
-		direct_fan_control(fan_index, fan_speed, false);
+		// Fan table entry and direct fan register in one go
+		ops[0].type = UW_EC_OP_WRITE;
+		ops[0].data = fan_speed & 0xff;
+		ops[1].type = UW_EC_OP_WRITE;
+		ops[1].data = fan_speed & 0xff;
+		err = uniwill_ec_transaction(ops, ARRAY_SIZE(ops));
+		if (err == -EOPNOTSUPP) {
+			for (i = 0, err = 0; i < ARRAY_SIZE(ops) && !err; ++i)
+				err = uniwill_write_ec_ram(ops[i].addr, ops[i].data);
+		}
+		if (err)
+			return err;
 	}
 	else { // old workaround using full fan mode
 		direct_fan_control(fan_index, fan_speed, true);
@@ -548,7 +803,9 @@ static u32 uw_set_fan_auto(void)
 		if ((value_use_custom_fan_table_0 >> offset_use_custom_fan_table_0) & 1) {
 			uniwill_write_ec_ram_with_retry(addr_use_custom_fan_table_0, value_use_custom_fan_table_0 - (1 << offset_use_custom_fan_table_0), 3);
 		}
+		mutex_lock(&uw_fan_init.lock);
 		fans_initialized = false;
+		mutex_unlock(&uw_fan_init.lock);
 	}
 	else {
 		// Get current mode
@@ -625,7 +882,7 @@ static int uw_set_tdp(u8 tdp_index, int tdp_value)
 	if (uw_feats->uniwill_custom_profile_mode_needed) {
 		// Ensure that "enthusiast" profile is chosen when using TDP set
 		// for devices that require this
-		uw_set_performance_profile_v1(PROFILE_ENTHUSIAST);
+		uniwill_set_performance_profile_v1(PROFILE_ENTHUSIAST);
 	}
 
 	// Use min tdp to detect support for chosen tdp parameter
@@ -648,41 +905,438 @@ static int uw_set_tdp(u8 tdp_index, int tdp_value)
 	return 0;
 }
 
+/*
+ * Fan curve engine
+ *
+ * Evaluates a per fan temperature -> duty curve periodically and writes the
+ * result through uw_set_fan(). Increases are applied right away, decreases
+ * only when the temperature has dropped by at least the hysteresis below
+ * the temperature of the last change and the dwell time has passed. On
+ * repeated failure to read temperatures the engine stops and hands control
+ * back to the EC (uw_set_fan_auto).
+ */
+#define UW_FAN_CURVE_FANS			2
+#define UW_FAN_CURVE_INTERVAL_MS_DEFAULT	1000
+#define UW_FAN_CURVE_INTERVAL_MS_MIN		100
+#define UW_FAN_CURVE_INTERVAL_MS_MAX		10000
+#define UW_FAN_CURVE_HYSTERESIS_DEFAULT		3
+#define UW_FAN_CURVE_DWELL_MS_DEFAULT		5000
+#define UW_FAN_CURVE_MAX_FAILURES		3
+
+struct uw_fan_curve_t {
+	unsigned int count;
+	u8 temp[LWL_IO_FAN_CURVE_POINTS];
+	u8 duty[LWL_IO_FAN_CURVE_POINTS];
+};
+
+struct uw_fan_curve_state_t {
+	int duty;		// last written duty, -1 if none
+	u8 temp;		// temperature at last change
+	unsigned long changed;	// jiffies of last change
+};
+
+static struct uw_fan_curve_engine_t {
+	struct mutex lock;
+	struct delayed_work work;
+	bool enabled;
+	unsigned int interval_ms;
+	unsigned int dwell_ms;
+	u8 hysteresis;
+	unsigned int failures;
+	struct uw_fan_curve_t curves[UW_FAN_CURVE_FANS];
+	struct uw_fan_curve_state_t state[UW_FAN_CURVE_FANS];
+} uw_fc = {
+	.interval_ms = UW_FAN_CURVE_INTERVAL_MS_DEFAULT,
+	.dwell_ms = UW_FAN_CURVE_DWELL_MS_DEFAULT,
+	.hysteresis = UW_FAN_CURVE_HYSTERESIS_DEFAULT,
+};
+
+static u8 uw_fan_curve_duty_max(void)
+{
+	return uw_feats->uniwill_has_universal_ec_fan_control ? NB02_FAN_SPEED_MAX : NB01_FAN_SPEED_MAX;
+}
+
+static int uw_fan_curve_validate(const struct uw_fan_curve_t *curve)
+{
+	unsigned int i;
+
+	if (curve->count > LWL_IO_FAN_CURVE_POINTS)
+		return -EINVAL;
+
+	for (i = 0; i < curve->count; ++i) {
+		if (curve->duty[i] > uw_fan_curve_duty_max())
+			return -EINVAL;
+		if (i > 0 && curve->temp[i] <= curve->temp[i - 1])
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
 /**
- * Set profile 1-3 to 0xa0, 0x00 or 0x10 depending on
- * device support.
+ * Piecewise linear interpolation of the curve at temp
  */
-static u32 uw_set_performance_profile_v1(enum uw_perf_profiles_v1 profile)
+static u8 uw_fan_curve_eval(const struct uw_fan_curve_t *curve, u8 temp)
 {
-	u8 current_value = 0x00, next_value;
-	u8 clear_bits = 0xa0 | 0x10;
-	u32 result;
-	result = uniwill_read_ec_ram(0x0751, &current_value);
-	if (result >= 0) {
-		next_value = current_value & ~clear_bits;
-		switch (profile) {
-		case 0x01:
-			next_value |= 0xa0;
-			break;
-		case 0x02:
-			next_value |= 0x00;
-			break;
-		case 0x03:
-			next_value |= 0x10;
-			break;
-		default:
-			result = -EINVAL;
-			break;
+	unsigned int i;
+	int dt, dd;
+
+	if (temp <= curve->temp[0])
+		return curve->duty[0];
+
+	for (i = 1; i < curve->count; ++i) {
+		if (temp <= curve->temp[i]) {
+			dt = curve->temp[i] - curve->temp[i - 1];
+			dd = curve->duty[i] - curve->duty[i - 1];
+			return curve->duty[i - 1] + dd * (temp - curve->temp[i - 1]) / dt;
 		}
+	}
+
+	return curve->duty[curve->count - 1];
+}
+
+/**
+ * Decide the duty to write for one fan, -1 if it should stay unchanged
+ */
+static int uw_fan_curve_step(const struct uw_fan_curve_t *curve, struct uw_fan_curve_state_t *state,
+			     u8 temp, unsigned long now, u8 hysteresis, unsigned int dwell_ms)
+{
+	int target = uw_fan_curve_eval(curve, temp);
+
+	if (state->duty < 0 || target > state->duty)
+		goto change;
+
+	if (target < state->duty &&
+	    temp + hysteresis <= state->temp &&
+	    time_after_eq(now, state->changed + msecs_to_jiffies(dwell_ms)))
+		goto change;
+
+	return -1;
+
+change:
+	state->duty = target;
+	state->temp = temp;
+	state->changed = now;
+	return target;
+}
+
+static void uw_fan_curve_work_func(struct work_struct *work)
+{
+	struct uniwill_ec_op_t ops[] = {
+		{ .type = UW_EC_OP_READ, .addr = 0x043e, .status = -ENODATA },
+		{ .type = UW_EC_OP_READ, .addr = 0x044f, .status = -ENODATA },
+	};
+	int duty[UW_FAN_CURVE_FANS];
+	bool write_failed[UW_FAN_CURVE_FANS] = { false };
+	int i, status;
+	bool failed = false;
+
+	status = uniwill_ec_transaction(ops, ARRAY_SIZE(ops));
+	if (status == -EOPNOTSUPP) {
+		for (i = 0; i < ARRAY_SIZE(ops); ++i)
+			ops[i].status = uniwill_read_ec_ram(ops[i].addr, &ops[i].data);
+	}
 
-		if (result != -EINVAL) {
-			result = uniwill_write_ec_ram(0x0751, next_value);
+	mutex_lock(&uw_fc.lock);
+	if (!uw_fc.enabled)
+		goto out;
+
+	for (i = 0; i < UW_FAN_CURVE_FANS; ++i) {
+		duty[i] = -1;
+		if (uw_fc.curves[i].count == 0)
+			continue;
+		if (ops[i].status != 0) {
+			failed = true;
+			continue;
+		}
+		duty[i] = uw_fan_curve_step(&uw_fc.curves[i], &uw_fc.state[i], ops[i].data,
+					    jiffies, uw_fc.hysteresis, uw_fc.dwell_ms);
+	}
+	mutex_unlock(&uw_fc.lock);
+
+	// uw_set_fan() can wait for the fan table init, don't block the
+	// sysfs handlers meanwhile. uw_fan_curve_stop() waits for this work
+	// before it hands control back to the EC.
+	for (i = 0; i < UW_FAN_CURVE_FANS; ++i)
+		if (duty[i] >= 0 && uw_set_fan(i, duty[i]) != 0)
+			write_failed[i] = true;
+
+	mutex_lock(&uw_fc.lock);
+	if (!uw_fc.enabled)
+		goto out;
+
+	for (i = 0; i < UW_FAN_CURVE_FANS; ++i) {
+		if (write_failed[i]) {
+			uw_fc.state[i].duty = -1;
+			failed = true;
 		}
 	}
 
-	return result;
+	uw_fc.failures = failed ? uw_fc.failures + 1 : 0;
+	if (uw_fc.failures >= UW_FAN_CURVE_MAX_FAILURES) {
+		pr_err("fan curve: giving up after %u failures, back to auto\n", uw_fc.failures);
+		uw_fc.enabled = false;
+		// Don't bring the failing curve back on resume
+		lwl_state_forget(&lwl_io_state, &uw_state_fan_curve);
+		uw_set_fan_auto();
+		goto out;
+	}
+
+	schedule_delayed_work(&uw_fc.work, msecs_to_jiffies(uw_fc.interval_ms));
+out:
+	mutex_unlock(&uw_fc.lock);
+}
+
+static int uw_fan_curve_start(void)
+{
+	int i;
+
+	if (!id_check_uniwill)
+		return -ENODEV;
+
+	mutex_lock(&uw_fc.lock);
+	if (uw_fc.curves[0].count == 0 && uw_fc.curves[1].count == 0) {
+		mutex_unlock(&uw_fc.lock);
+		return -EINVAL;
+	}
+	for (i = 0; i < UW_FAN_CURVE_FANS; ++i)
+		uw_fc.state[i].duty = -1;
+	uw_fc.failures = 0;
+	uw_fc.enabled = true;
+	mutex_unlock(&uw_fc.lock);
+
+	// The curve replaces manual speeds
+	for (i = 0; i < UW_FAN_CURVE_FANS; ++i)
+		lwl_state_forget(&lwl_io_state, &uw_state_fan[i]);
+	lwl_state_record(&lwl_io_state, &uw_state_fan_curve, 1);
+
+	mod_delayed_work(system_wq, &uw_fc.work, 0);
+
+	return 0;
 }
 
+/**
+ * Stop the engine, optionally handing control back to the EC
+ */
+static void uw_fan_curve_stop(bool restore_auto)
+{
+	bool was_enabled;
+
+	mutex_lock(&uw_fc.lock);
+	was_enabled = uw_fc.enabled;
+	uw_fc.enabled = false;
+	mutex_unlock(&uw_fc.lock);
+
+	lwl_state_forget(&lwl_io_state, &uw_state_fan_curve);
+	cancel_delayed_work_sync(&uw_fc.work);
+
+	if (was_enabled && restore_auto)
+		uw_set_fan_auto();
+}
+
+static int uw_fan_curve_set(unsigned int fan_index, const struct uw_fan_curve_t *curve)
+{
+	int result;
+
+	if (!id_check_uniwill)
+		return -ENODEV;
+
+	if (fan_index >= UW_FAN_CURVE_FANS)
+		return -EINVAL;
+
+	result = uw_fan_curve_validate(curve);
+	if (result)
+		return result;
+
+	mutex_lock(&uw_fc.lock);
+	uw_fc.curves[fan_index] = *curve;
+	uw_fc.state[fan_index].duty = -1;
+	mutex_unlock(&uw_fc.lock);
+
+	return 0;
+}
+
+static ssize_t fan_curve_show(unsigned int fan_index, char *buf)
+{
+	unsigned int i;
+	ssize_t len = 0;
+
+	mutex_lock(&uw_fc.lock);
+	for (i = 0; i < uw_fc.curves[fan_index].count; ++i)
+		len += sysfs_emit_at(buf, len, "%s%u:%u", i ? " " : "",
+				     uw_fc.curves[fan_index].temp[i], uw_fc.curves[fan_index].duty[i]);
+	mutex_unlock(&uw_fc.lock);
+	len += sysfs_emit_at(buf, len, "\n");
+
+	return len;
+}
+
+/**
+ * Parses "temp:duty temp:duty ..."
+ */
+static ssize_t fan_curve_store(unsigned int fan_index, const char *buf, size_t size)
+{
+	struct uw_fan_curve_t curve = { 0 };
+	unsigned int temp, duty;
+	int consumed, result;
+	const char *p = buf;
+
+	while (sscanf(p, " %u:%u%n", &temp, &duty, &consumed) == 2) {
+		if (curve.count >= LWL_IO_FAN_CURVE_POINTS || temp > 0xff || duty > 0xff)
+			return -EINVAL;
+		curve.temp[curve.count] = temp;
+		curve.duty[curve.count] = duty;
+		curve.count += 1;
+		p += consumed;
+	}
+
+	if (*skip_spaces(p) != '\0')
+		return -EINVAL;
+
+	result = uw_fan_curve_set(fan_index, &curve);
+	if (result)
+		return result;
+
+	return size;
+}
+
+static ssize_t fan1_curve_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return fan_curve_show(0, buf);
+}
+
+static ssize_t fan1_curve_store(struct device *dev, struct device_attribute *attr,
+				const char *buf, size_t size)
+{
+	return fan_curve_store(0, buf, size);
+}
+
+static ssize_t fan2_curve_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return fan_curve_show(1, buf);
+}
+
+static ssize_t fan2_curve_store(struct device *dev, struct device_attribute *attr,
+				const char *buf, size_t size)
+{
+	return fan_curve_store(1, buf, size);
+}
+
+static ssize_t fan_curve_enable_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%d\n", uw_fc.enabled ? 1 : 0);
+}
+
+static ssize_t fan_curve_enable_store(struct device *dev, struct device_attribute *attr,
+				      const char *buf, size_t size)
+{
+	bool enable;
+	int result;
+
+	if (kstrtobool(buf, &enable))
+		return -EINVAL;
+
+	if (enable) {
+		result = uw_fan_curve_start();
+		if (result)
+			return result;
+	} else {
+		uw_fan_curve_stop(true);
+	}
+
+	return size;
+}
+
+static ssize_t fan_curve_interval_ms_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%u\n", uw_fc.interval_ms);
+}
+
+static ssize_t fan_curve_interval_ms_store(struct device *dev, struct device_attribute *attr,
+					   const char *buf, size_t size)
+{
+	unsigned int value;
+
+	if (kstrtouint(buf, 0, &value))
+		return -EINVAL;
+
+	if (value < UW_FAN_CURVE_INTERVAL_MS_MIN || value > UW_FAN_CURVE_INTERVAL_MS_MAX)
+		return -EINVAL;
+
+	mutex_lock(&uw_fc.lock);
+	uw_fc.interval_ms = value;
+	mutex_unlock(&uw_fc.lock);
+
+	return size;
+}
+
+static ssize_t fan_curve_hysteresis_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%u\n", uw_fc.hysteresis);
+}
+
+static ssize_t fan_curve_hysteresis_store(struct device *dev, struct device_attribute *attr,
+					  const char *buf, size_t size)
+{
+	u8 value;
+
+	if (kstrtou8(buf, 0, &value))
+		return -EINVAL;
+
+	mutex_lock(&uw_fc.lock);
+	uw_fc.hysteresis = value;
+	mutex_unlock(&uw_fc.lock);
+
+	return size;
+}
+
+static ssize_t fan_curve_dwell_ms_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%u\n", uw_fc.dwell_ms);
+}
+
+static ssize_t fan_curve_dwell_ms_store(struct device *dev, struct device_attribute *attr,
+					const char *buf, size_t size)
+{
+	unsigned int value;
+
+	if (kstrtouint(buf, 0, &value))
+		return -EINVAL;
+
+	mutex_lock(&uw_fc.lock);
+	uw_fc.dwell_ms = value;
+	mutex_unlock(&uw_fc.lock);
+
+	return size;
+}
+
+static DEVICE_ATTR_RW(fan1_curve);
+static DEVICE_ATTR_RW(fan2_curve);
+static DEVICE_ATTR_RW(fan_curve_enable);
+static DEVICE_ATTR_RW(fan_curve_interval_ms);
+static DEVICE_ATTR_RW(fan_curve_hysteresis);
+static DEVICE_ATTR_RW(fan_curve_dwell_ms);
+
+static struct attribute *uw_fan_curve_attrs[] = {
+	&dev_attr_fan1_curve.attr,
+	&dev_attr_fan2_curve.attr,
+	&dev_attr_fan_curve_enable.attr,
+	&dev_attr_fan_curve_interval_ms.attr,
+	&dev_attr_fan_curve_hysteresis.attr,
+	&dev_attr_fan_curve_dwell_ms.attr,
+	NULL
+};
+
+static struct attribute_group uw_fan_curve_attr_group = {
+	.name = "fan_curve",
+	.attrs = uw_fan_curve_attrs
+};
+
+static const struct attribute_group *lwl_io_attr_groups[] = {
+	&uw_fan_curve_attr_group,
+	NULL
+};
+
 static long uniwill_ioctl_interface(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	u32 result = 0;
@@ -691,6 +1345,8 @@ static long uniwill_ioctl_interface(struct file *file, unsigned int cmd, unsigne
 	u8 byte_data;
 	const char str_no_if[] = "";
 	char *str_uniwill_if;
+	struct lwl_io_fan_curve fan_curve;
+	struct uw_fan_curve_t curve;
 
 #ifdef DEBUG
 	union uw_ec_read_return reg_read_return;
@@ -837,12 +1493,17 @@ static long uniwill_ioctl_interface(struct file *file, unsigned int cmd, unsigne
 		case W_UW_FANSPEED:
 			// Get fan speed argument
 			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
-			uw_set_fan(0, argument);
+			// Manual speed overrides the fan curve
+			uw_fan_curve_stop(false);
+			if (uw_set_fan(0, argument) == 0)
+				lwl_state_record(&lwl_io_state, &uw_state_fan[0], argument & 0xff);
 			break;
 		case W_UW_FANSPEED2:
 			// Get fan speed argument
 			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
-			uw_set_fan(1, argument);
+			uw_fan_curve_stop(false);
+			if (uw_set_fan(1, argument) == 0)
+				lwl_state_record(&lwl_io_state, &uw_state_fan[1], argument & 0xff);
 			break;
 		case W_UW_MODE:
 			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
@@ -856,23 +1517,44 @@ static long uniwill_ioctl_interface(struct file *file, unsigned int cmd, unsigne
 			*/
 			break;
 		case W_UW_FANAUTO:
+			uw_fan_curve_stop(false);
 			uw_set_fan_auto();
+			lwl_state_forget(&lwl_io_state, &uw_state_fan[0]);
+			lwl_state_forget(&lwl_io_state, &uw_state_fan[1]);
 			break;
 		case W_UW_TDP0:
 			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
-			uw_set_tdp(0, argument);
+			if (uw_set_tdp(0, argument) == 0)
+				lwl_state_record(&lwl_io_state, &uw_state_tdp[0], argument);
 			break;
 		case W_UW_TDP1:
 			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
-			uw_set_tdp(1, argument);
+			if (uw_set_tdp(1, argument) == 0)
+				lwl_state_record(&lwl_io_state, &uw_state_tdp[1], argument);
 			break;
 		case W_UW_TDP2:
 			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
-			uw_set_tdp(2, argument);
+			if (uw_set_tdp(2, argument) == 0)
+				lwl_state_record(&lwl_io_state, &uw_state_tdp[2], argument);
 			break;
 		case W_UW_PERF_PROF:
 			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
-			uw_set_performance_profile_v1(argument);
+			uniwill_set_performance_profile_v1(argument);
+			break;
+		case W_UW_FAN_CURVE:
+			if (copy_from_user(&fan_curve, (void *) arg, sizeof(fan_curve)))
+				return -EFAULT;
+			if (fan_curve.count > LWL_IO_FAN_CURVE_POINTS)
+				return -EINVAL;
+			curve.count = fan_curve.count;
+			memcpy(curve.temp, fan_curve.temp, sizeof(curve.temp));
+			memcpy(curve.duty, fan_curve.duty, sizeof(curve.duty));
+			return uw_fan_curve_set(fan_curve.fan_index, &curve);
+		case W_UW_FAN_CURVE_ENABLE:
+			copy_result = copy_from_user(&argument, (int32_t *) arg, sizeof(argument));
+			if (argument)
+				return uw_fan_curve_start();
+			uw_fan_curve_stop(true);
 			break;
 #ifdef DEBUG
 		case W_TF_BC:
@@ -899,6 +1581,131 @@ static long uniwill_ioctl_interface(struct file *file, unsigned int cmd, unsigne
 	return 0;
 }
 
+static void uw_fill_telemetry(struct lwl_io_telemetry *tm)
+{
+	struct uniwill_ec_op_t ops[] = {
+		{ .type = UW_EC_OP_READ, .addr = 0x1804, .status = -ENODATA },
+		{ .type = UW_EC_OP_READ, .addr = 0x1809, .status = -ENODATA },
+		{ .type = UW_EC_OP_READ, .addr = 0x043e, .status = -ENODATA },
+		{ .type = UW_EC_OP_READ, .addr = 0x044f, .status = -ENODATA },
+		{ .type = UW_EC_OP_READ, .addr = 0x0751, .status = -ENODATA },
+		{ .type = UW_EC_OP_READ, .addr = 0x0741, .status = -ENODATA },
+		{ .type = UW_EC_OP_READ, .addr = 0x0783, .status = -ENODATA },
+		{ .type = UW_EC_OP_READ, .addr = 0x0784, .status = -ENODATA },
+		{ .type = UW_EC_OP_READ, .addr = 0x0785, .status = -ENODATA },
+	};
+	int i, status, n_ops = ARRAY_SIZE(ops);
+
+	// TDP registers are only read where a TDP definition exists
+	for (i = 2; i >= 0 && uw_get_tdp_min(i) < 0; --i)
+		n_ops -= 1;
+
+	status = uniwill_ec_transaction(ops, n_ops);
+	if (status == -EOPNOTSUPP) {
+		for (i = 0; i < n_ops; ++i)
+			ops[i].status = uniwill_read_ec_ram(ops[i].addr, &ops[i].data);
+	}
+
+	if (ops[0].status == 0) {
+		tm->fanspeed = ops[0].data;
+		if (uw_feats->uniwill_has_universal_ec_fan_control && tm->fanspeed == 1)
+			tm->fanspeed = 0; // 1 is 0 behaviour see: uw_set_fan
+		tm->valid |= LWL_IO_TM_FANSPEED;
+	}
+	if (ops[1].status == 0) {
+		tm->fanspeed2 = ops[1].data;
+		if (uw_feats->uniwill_has_universal_ec_fan_control && tm->fanspeed2 == 1)
+			tm->fanspeed2 = 0;
+		tm->valid |= LWL_IO_TM_FANSPEED2;
+	}
+	if (ops[2].status == 0) {
+		tm->fan_temp = ops[2].data;
+		tm->valid |= LWL_IO_TM_FAN_TEMP;
+	}
+	if (ops[3].status == 0) {
+		tm->fan_temp2 = ops[3].data;
+		tm->valid |= LWL_IO_TM_FAN_TEMP2;
+	}
+	if (ops[4].status == 0) {
+		tm->mode = ops[4].data;
+		tm->valid |= LWL_IO_TM_MODE;
+	}
+	if (ops[5].status == 0) {
+		tm->mode_enable = ops[5].data;
+		tm->valid |= LWL_IO_TM_MODE_ENABLE;
+	}
+
+	for (i = 0; i < 3 && 6 + i < n_ops; ++i) {
+		if (ops[6 + i].status != 0 || uw_get_tdp_min(i) < 0)
+			continue;
+		if (i == 2 && uw_feats->uniwill_has_double_pl4)
+			tm->tdp[i] = (int)ops[6 + i].data * 2;
+		else
+			tm->tdp[i] = ops[6 + i].data;
+		tm->tdp_min[i] = uw_get_tdp_min(i);
+		tm->tdp_max[i] = uw_get_tdp_max(i);
+		tm->valid |= LWL_IO_TM_TDP0 << i;
+	}
+
+	tm->fans_min_speed = FAN_ON_MIN_SPEED_PERCENT;
+	tm->valid |= LWL_IO_TM_FANS_MIN_SPEED;
+	tm->profs_available = 0;
+	if (uw_feats->uniwill_profile_v1_two_profs)
+		tm->profs_available = 2;
+	else if (uw_feats->uniwill_profile_v1_three_profs || uw_feats->uniwill_profile_v1_three_profs_leds_only)
+		tm->profs_available = 3;
+	tm->valid |= LWL_IO_TM_PROFS_AVAILABLE;
+}
+
+static void clevo_fill_telemetry(struct lwl_io_telemetry *tm)
+{
+	static const u8 faninfo_cmds[] = {
+		CLEVO_CMD_GET_FANINFO1, CLEVO_CMD_GET_FANINFO2, CLEVO_CMD_GET_FANINFO3
+	};
+	u32 result;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(faninfo_cmds); ++i) {
+		result = 0;
+		if (clevo_evaluate_method(faninfo_cmds[i], 0, &result) != 0)
+			continue;
+		tm->cl_faninfo[i] = result;
+		tm->valid |= LWL_IO_TM_CL_FANINFO1 << i;
+	}
+}
+
+/**
+ * Collect all available sensor values and limits in one call
+ */
+static long telemetry_snapshot(unsigned long arg)
+{
+	struct lwl_io_telemetry tm;
+	u32 user_size;
+
+	if (copy_from_user(&tm, (void *) arg, 2 * sizeof(u32)))
+		return -EFAULT;
+
+	user_size = tm.size;
+	if (user_size < offsetof(struct lwl_io_telemetry, fanspeed))
+		return -EINVAL;
+	if (user_size > sizeof(tm))
+		user_size = sizeof(tm);
+
+	memset(&tm, 0, sizeof(tm));
+	tm.version = LWL_IO_TELEMETRY_VERSION;
+	tm.size = user_size;
+
+	if (id_check_uniwill)
+		uw_fill_telemetry(&tm);
+	if (id_check_clevo)
+		clevo_fill_telemetry(&tm);
+
+	if (copy_to_user((void *) arg, &tm, user_size))
+		return -EFAULT;
+
+	return 0;
+}
+
 static long fop_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	u32 status;
@@ -919,6 +1726,8 @@ static long fop_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			id_check_uniwill = uniwill_identify();
 			copy_result = copy_to_user((void *) arg, (void *) &id_check_uniwill, sizeof(id_check_uniwill));
 			break;
+		case R_TELEMETRY_SNAPSHOT:
+			return telemetry_snapshot(arg);
 	}
 
 	status = clevo_ioctl_interface(file, cmd, arg);
@@ -929,6 +1738,48 @@ static long fop_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	return 0;
 }
 
+/**
+ * Custom fan tables may be lost while suspended, check them again on next use
+ */
+static void uw_fan_resume(void)
+{
+	mutex_lock(&uw_fan_init.lock);
+	fans_initialized = false;
+
+	if (uw_fan_init.queued) {
+		// A table write still running would complete the new round early
+		flush_work(&uw_fan_init.work);
+		reinit_completion(&uw_fan_init.done);
+		uw_fan_init.queued = false;
+		uw_init_fan_async();
+	}
+	mutex_unlock(&uw_fan_init.lock);
+}
+
+static int lwl_io_pm_notify(struct notifier_block *nb, unsigned long action, void *data)
+{
+	switch (action) {
+	case PM_SUSPEND_PREPARE:
+	case PM_HIBERNATION_PREPARE:
+		// Curve engine is restarted by the state replay
+		cancel_delayed_work_sync(&uw_fc.work);
+		flush_work(&uw_fan_init.work);
+		break;
+	case PM_POST_SUSPEND:
+	case PM_POST_HIBERNATION:
+		if (id_check_uniwill)
+			uw_fan_resume();
+		lwl_state_restore_all(&lwl_io_state);
+		break;
+	}
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block lwl_io_pm_nb = {
+	.notifier_call = lwl_io_pm_notify,
+};
+
 static struct file_operations fops_dev = {
 	.owner              = THIS_MODULE,
 	.unlocked_ioctl     = fop_ioctl
@@ -941,6 +1792,8 @@ dev_t lwl_io_device_handle;
 
 static struct cdev lwl_io_cdev;
 
+static struct dentry *lwl_io_debugfs_dir;
+
 static int __init lwl_io_init(void)
 {
 	int err;
@@ -975,7 +1828,27 @@ static int __init lwl_io_init(void)
 	lwl_io_device_class = class_create("lwl_io");
 #endif
 
-	device_create(lwl_io_device_class, NULL, lwl_io_device_handle, NULL, "lwl_io");
+	mutex_init(&uw_fc.lock);
+	INIT_DELAYED_WORK(&uw_fc.work, uw_fan_curve_work_func);
+
+	INIT_WORK(&uw_fan_init.work, uw_fan_init_work_func);
+	init_completion(&uw_fan_init.done);
+	mutex_init(&uw_fan_init.lock);
+	if (id_check_uniwill) {
+		mutex_lock(&uw_fan_init.lock);
+		uw_init_fan_async();
+		mutex_unlock(&uw_fan_init.lock);
+	}
+
+	lwl_io_debugfs_dir = debugfs_create_dir("lwl_io", NULL);
+	debugfs_create_file("fan_init", 0444, lwl_io_debugfs_dir, NULL, &uw_fan_init_fops);
+
+	lwl_io_state_init();
+	lwl_state_debugfs_init(&lwl_io_state, lwl_io_debugfs_dir);
+	register_pm_notifier(&lwl_io_pm_nb);
+
+	device_create_with_groups(lwl_io_device_class, NULL, lwl_io_device_handle, NULL,
+				  lwl_io_attr_groups, "lwl_io");
 	pr_debug("Module init successful\n");
 	
 	return 0;
@@ -983,6 +1856,12 @@ static int __init lwl_io_init(void)
 
 static void __exit lwl_io_exit(void)
 {
+	unregister_pm_notifier(&lwl_io_pm_nb);
+	if (id_check_uniwill)
+		uw_fan_curve_stop(true);
+	cancel_work_sync(&uw_fan_init.work);
+	lwl_state_debugfs_remove(&lwl_io_state);
+	debugfs_remove_recursive(lwl_io_debugfs_dir);
 	device_destroy(lwl_io_device_class, lwl_io_device_handle);
 	class_destroy(lwl_io_device_class);
 	cdev_del(&lwl_io_cdev);
@@ -29,7 +29,68 @@
 #define MAGIC_READ_UW	IOCTL_MAGIC + 3
 #define MAGIC_WRITE_UW	IOCTL_MAGIC + 4
 
-#define MOD_API_MIN_VERSION "0.2.6" // IMPORTANT: Needs to be updated when a new ioctl is added
+#define MOD_API_MIN_VERSION "0.3.11" // IMPORTANT: Needs to be updated when a new ioctl is added
+
+/**
+ * Telemetry snapshot, filled in one call by R_TELEMETRY_SNAPSHOT
+ *
+ * Caller sets version and size, the driver fills at most size bytes and
+ * returns the version it implements. Fields are only meaningful when their
+ * bit is set in valid. New fields are only ever appended.
+ */
+#define LWL_IO_TELEMETRY_VERSION	1
+
+#define LWL_IO_TM_FANSPEED		(1 << 0)
+#define LWL_IO_TM_FANSPEED2		(1 << 1)
+#define LWL_IO_TM_FAN_TEMP		(1 << 2)
+#define LWL_IO_TM_FAN_TEMP2		(1 << 3)
+#define LWL_IO_TM_MODE			(1 << 4)
+#define LWL_IO_TM_MODE_ENABLE		(1 << 5)
+#define LWL_IO_TM_TDP0			(1 << 6)
+#define LWL_IO_TM_TDP1			(1 << 7)
+#define LWL_IO_TM_TDP2			(1 << 8)
+#define LWL_IO_TM_PROFS_AVAILABLE	(1 << 9)
+#define LWL_IO_TM_CL_FANINFO1		(1 << 10)
+#define LWL_IO_TM_CL_FANINFO2		(1 << 11)
+#define LWL_IO_TM_CL_FANINFO3		(1 << 12)
+#define LWL_IO_TM_FANS_MIN_SPEED	(1 << 13)
+
+struct lwl_io_telemetry {
+	uint32_t version;
+	uint32_t size;
+	uint32_t valid;
+	// Uniwill, same values as the respective R_UW_* ioctls
+	int32_t fanspeed;
+	int32_t fanspeed2;
+	int32_t fan_temp;
+	int32_t fan_temp2;
+	int32_t mode;
+	int32_t mode_enable;
+	int32_t fans_min_speed;
+	int32_t profs_available;
+	int32_t tdp[3];
+	int32_t tdp_min[3];
+	int32_t tdp_max[3];
+	// Clevo, same values as the respective R_CL_* ioctls
+	int32_t cl_faninfo[3];
+};
+
+/**
+ * Fan curve for the in kernel fan control of one fan, set by W_UW_FAN_CURVE
+ *
+ * Up to LWL_IO_FAN_CURVE_POINTS points with strictly increasing temperature
+ * (deg C). Duty uses the same scale as W_UW_FANSPEED. Between points the duty
+ * is interpolated linearly, outside the first/last point's duty is used.
+ * A count of 0 leaves the fan out of the curve control.
+ */
+#define LWL_IO_FAN_CURVE_POINTS		8
+
+struct lwl_io_fan_curve {
+	uint32_t fan_index;
+	uint32_t count;
+	uint8_t temp[LWL_IO_FAN_CURVE_POINTS];
+	uint8_t duty[LWL_IO_FAN_CURVE_POINTS];
+};
 
 // General
 #define R_MOD_VERSION		_IOR(IOCTL_MAGIC, 0x00, char*)
@@ -37,6 +98,8 @@
 #define R_HWCHECK_CL		_IOR(IOCTL_MAGIC, 0x05, int32_t*)
 #define R_HWCHECK_UW		_IOR(IOCTL_MAGIC, 0x06, int32_t*)
 
+#define R_TELEMETRY_SNAPSHOT	_IOWR(IOCTL_MAGIC, 0x07, struct lwl_io_telemetry*)
+
 /**
  * Clevo interface
  */
@@ -111,4 +174,7 @@
 
 #define W_UW_PERF_PROF		_IOW(MAGIC_WRITE_UW, 0x18, int32_t*)
 
+#define W_UW_FAN_CURVE		_IOW(MAGIC_WRITE_UW, 0x19, struct lwl_io_fan_curve*)
+#define W_UW_FAN_CURVE_ENABLE	_IOW(MAGIC_WRITE_UW, 0x1a, int32_t*) // 1 starts, 0 stops and returns to auto
+
 #endif
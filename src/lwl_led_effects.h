@@ -0,0 +1,688 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*!
+ * Copyright (c) 2024 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+ *
+ * This file is part of lwl-drivers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef lwl_LED_EFFECTS_H
+#define lwl_LED_EFFECTS_H
+
+/*
+ * Keyboard lighting effect engine
+ *
+ * Renders effects into a grid of rows x columns RGB keys and hands whole
+ * frames to the backend, which converts them to its native format. Frames
+ * are timed by an hrtimer and rendered from a work item so that the
+ * backend output may sleep. Effects without animation are rendered once.
+ *
+ * Like an LED trigger the effect is chosen per device, in the led_effect
+ * directory below the backend device:
+ *   effect     [none] static_gradient breathe wave ripple
+ *   colors     foreground and background as RRGGBB
+ *   period_ms  length of one animation cycle
+ *   frames     number of frames rendered
+ *
+ * The backend reports backlight on/off with lwl_led_effect_set_enabled()
+ * and calls lwl_led_effect_suspend()/resume() from its PM callbacks. A
+ * backend without render op only renders into the frame buffer. Frames
+ * go to the backend's output only, the LED classdev colors stay those set
+ * by the user and are shown again through the restore op once the effect
+ * is set to none.
+ */
+
+#include <linux/kernel.h>
+#include <linux/device.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/keyboard.h>
+#include <linux/input.h>
+#include <linux/version.h>
+
+#define lwl_LED_EFFECT_FPS			30
+#define lwl_LED_EFFECT_RIPPLES			4
+#define lwl_LED_EFFECT_PERIOD_MS_DEFAULT	3000
+#define lwl_LED_EFFECT_PERIOD_MS_MIN		200
+#define lwl_LED_EFFECT_PERIOD_MS_MAX		60000
+
+// Ripple ring width, in 1/16 key
+#define lwl_LED_EFFECT_RIPPLE_WIDTH		24
+
+enum lwl_led_effect_mode {
+	lwl_LED_EFFECT_NONE,
+	lwl_LED_EFFECT_STATIC_GRADIENT,
+	lwl_LED_EFFECT_BREATHE,
+	lwl_LED_EFFECT_WAVE,
+	lwl_LED_EFFECT_RIPPLE,
+	lwl_LED_EFFECT_MODES,
+};
+
+static const char * const lwl_led_effect_names[] = {
+	[lwl_LED_EFFECT_NONE] = "none",
+	[lwl_LED_EFFECT_STATIC_GRADIENT] = "static_gradient",
+	[lwl_LED_EFFECT_BREATHE] = "breathe",
+	[lwl_LED_EFFECT_WAVE] = "wave",
+	[lwl_LED_EFFECT_RIPPLE] = "ripple",
+};
+
+struct lwl_led_effect_output {
+	// Show rows * columns RGB triplets, row by row, process context
+	int (*render)(void *drvdata, const u8 *frame);
+	// Show the backend's own colors again, process context
+	int (*restore)(void *drvdata);
+};
+
+struct lwl_led_effect_ripple {
+	bool active;
+	ktime_t start;
+	int row;
+	int column;
+};
+
+// Outlives the effect while sysfs still holds a reference
+struct lwl_led_effect_kobj {
+	struct kobject kobj;
+	struct lwl_led_effect *effect;
+};
+
+struct lwl_led_effect {
+	// Set by the backend before lwl_led_effect_register()
+	unsigned int rows;
+	unsigned int columns;
+	// Row 0 of the frame is the bottom row of the keyboard
+	bool rows_bottom_up;
+	const struct lwl_led_effect_output *output;
+	void *drvdata;
+
+	struct lwl_led_effect_kobj *kobj;
+	bool registered;
+	// Protects settings and the frame buffer
+	struct mutex lock;
+	enum lwl_led_effect_mode mode;
+	u8 colors[2][3];
+	unsigned int period_ms;
+	ktime_t start;
+	u8 *frame;
+	u64 frames;
+	// Backlight on, may be changed from atomic context
+	bool enabled;
+	bool suspended;
+
+	// Key presses arrive in atomic context
+	spinlock_t ripple_lock;
+	struct lwl_led_effect_ripple ripples[lwl_LED_EFFECT_RIPPLES];
+	unsigned int next_ripple;
+	// Only registered while the ripple effect is selected, under lock
+	struct notifier_block keyboard_nb;
+	bool keyboard_nb_registered;
+
+	struct hrtimer timer;
+	struct work_struct work;
+};
+
+static bool lwl_led_effect_running(struct lwl_led_effect *effect)
+{
+	return effect->mode != lwl_LED_EFFECT_NONE && READ_ONCE(effect->enabled) &&
+	       !effect->suspended;
+}
+
+static void lwl_led_effect_blend(const u8 *from, const u8 *to, u32 pos, u32 max, u8 *out)
+{
+	int i;
+
+	if (max == 0) {
+		memcpy(out, from, 3);
+		return;
+	}
+
+	for (i = 0; i < 3; ++i)
+		out[i] = from[i] + ((int)to[i] - (int)from[i]) * (int)pos / (int)max;
+}
+
+static void lwl_led_effect_hue_to_rgb(u32 hue, u8 *out)
+{
+	u8 rise = (hue % 60) * 255 / 60;
+	u8 fall = 255 - rise;
+
+	switch ((hue % 360) / 60) {
+	case 0: out[0] = 255; out[1] = rise; out[2] = 0; break;
+	case 1: out[0] = fall; out[1] = 255; out[2] = 0; break;
+	case 2: out[0] = 0; out[1] = 255; out[2] = rise; break;
+	case 3: out[0] = 0; out[1] = fall; out[2] = 255; break;
+	case 4: out[0] = rise; out[1] = 0; out[2] = 255; break;
+	default: out[0] = 255; out[1] = 0; out[2] = fall; break;
+	}
+}
+
+static u32 lwl_led_effect_isqrt(u32 value)
+{
+	u32 result = 0, bit = 1u << 30;
+
+	while (bit > value)
+		bit >>= 2;
+
+	while (bit) {
+		if (value >= result + bit) {
+			value -= result + bit;
+			result = (result >> 1) + bit;
+		} else {
+			result >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return result;
+}
+
+static u8 *lwl_led_effect_key(struct lwl_led_effect *effect, unsigned int row, unsigned int column)
+{
+	return &effect->frame[(row * effect->columns + column) * 3];
+}
+
+/**
+ * Render the frame for time t_ms since the effect was started
+ *
+ * Called with lock held. Returns true when the next frame differs.
+ */
+static bool lwl_led_effect_render_frame(struct lwl_led_effect *effect, u32 t_ms)
+{
+	struct lwl_led_effect_ripple ripples[lwl_LED_EFFECT_RIPPLES];
+	const u8 *fg = effect->colors[0], *bg = effect->colors[1];
+	u32 period = effect->period_ms, phase = t_ms % period;
+	unsigned int row, column, i;
+	u32 level, hue, elapsed, radius, dist, diff, max_level;
+	s32 dx, dy;
+	unsigned long flags;
+	ktime_t now;
+	bool animate = false;
+	u8 *key;
+
+	switch (effect->mode) {
+	case lwl_LED_EFFECT_STATIC_GRADIENT:
+		for (row = 0; row < effect->rows; ++row)
+			for (column = 0; column < effect->columns; ++column)
+				lwl_led_effect_blend(fg, bg, column, effect->columns - 1,
+						     lwl_led_effect_key(effect, row, column));
+		break;
+	case lwl_LED_EFFECT_BREATHE:
+		// Triangle, squared for a smoother look at low levels
+		level = phase * 510 / period;
+		if (level > 255)
+			level = 510 - level;
+		level = level * level / 255;
+		for (row = 0; row < effect->rows; ++row)
+			for (column = 0; column < effect->columns; ++column)
+				lwl_led_effect_blend(bg, fg, level, 255,
+						     lwl_led_effect_key(effect, row, column));
+		animate = true;
+		break;
+	case lwl_LED_EFFECT_WAVE:
+		for (row = 0; row < effect->rows; ++row)
+			for (column = 0; column < effect->columns; ++column) {
+				hue = 360 - (phase * 360 / period) + column * 360 / effect->columns;
+				lwl_led_effect_hue_to_rgb(hue, lwl_led_effect_key(effect, row, column));
+			}
+		animate = true;
+		break;
+	case lwl_LED_EFFECT_RIPPLE:
+		now = ktime_get();
+		spin_lock_irqsave(&effect->ripple_lock, flags);
+		for (i = 0; i < lwl_LED_EFFECT_RIPPLES; ++i) {
+			if (effect->ripples[i].active &&
+			    ktime_ms_delta(now, effect->ripples[i].start) >= period)
+				effect->ripples[i].active = false;
+			animate |= effect->ripples[i].active;
+		}
+		memcpy(ripples, effect->ripples, sizeof(ripples));
+		spin_unlock_irqrestore(&effect->ripple_lock, flags);
+
+		for (row = 0; row < effect->rows; ++row)
+			for (column = 0; column < effect->columns; ++column) {
+				max_level = 0;
+				for (i = 0; i < lwl_LED_EFFECT_RIPPLES; ++i) {
+					if (!ripples[i].active)
+						continue;
+					// One period to cross the keyboard, fading out
+					elapsed = ktime_ms_delta(now, ripples[i].start);
+					radius = elapsed * 16 * effect->columns / period;
+					dx = ((s32)column - ripples[i].column) * 16;
+					dy = ((s32)row - ripples[i].row) * 16;
+					dist = lwl_led_effect_isqrt(dx * dx + dy * dy);
+					diff = dist > radius ? dist - radius : radius - dist;
+					if (diff >= lwl_LED_EFFECT_RIPPLE_WIDTH)
+						continue;
+					level = 255 * (lwl_LED_EFFECT_RIPPLE_WIDTH - diff) / lwl_LED_EFFECT_RIPPLE_WIDTH;
+					level = level * (period - elapsed) / period;
+					max_level = max(max_level, level);
+				}
+				lwl_led_effect_blend(bg, fg, max_level, 255,
+						     lwl_led_effect_key(effect, row, column));
+			}
+		break;
+	default:
+		break;
+	}
+
+	return animate;
+}
+
+static void lwl_led_effect_work_func(struct work_struct *work)
+{
+	struct lwl_led_effect *effect = container_of(work, struct lwl_led_effect, work);
+	bool animate;
+
+	mutex_lock(&effect->lock);
+
+	if (!lwl_led_effect_running(effect)) {
+		mutex_unlock(&effect->lock);
+		return;
+	}
+
+	animate = lwl_led_effect_render_frame(effect, ktime_ms_delta(ktime_get(), effect->start));
+	if (effect->output->render)
+		effect->output->render(effect->drvdata, effect->frame);
+	effect->frames += 1;
+
+	if (animate)
+		hrtimer_start(&effect->timer, ms_to_ktime(1000 / lwl_LED_EFFECT_FPS), HRTIMER_MODE_REL);
+
+	mutex_unlock(&effect->lock);
+}
+
+static enum hrtimer_restart lwl_led_effect_timer_func(struct hrtimer *timer)
+{
+	struct lwl_led_effect *effect = container_of(timer, struct lwl_led_effect, timer);
+
+	schedule_work(&effect->work);
+
+	return HRTIMER_NORESTART;
+}
+
+static void lwl_led_effect_stop(struct lwl_led_effect *effect)
+{
+	// The work item only rearms the timer while running
+	hrtimer_cancel(&effect->timer);
+	cancel_work_sync(&effect->work);
+	hrtimer_cancel(&effect->timer);
+}
+
+/**
+ * Approximate key position from its keycode, rows counted from the top
+ * and columns relative to a main block 15 keys wide
+ */
+static const struct {
+	u16 first;
+	u16 last;
+	u8 row;
+	u8 offset;
+} lwl_led_effect_key_rows[] = {
+	{ KEY_F1, KEY_F10, 0, 1 },
+	{ KEY_1, KEY_BACKSPACE, 1, 1 },
+	{ KEY_Q, KEY_RIGHTBRACE, 2, 1 },
+	{ KEY_A, KEY_APOSTROPHE, 3, 2 },
+	{ KEY_Z, KEY_SLASH, 4, 2 },
+	{ KEY_SPACE, KEY_SPACE, 5, 7 },
+};
+
+static void lwl_led_effect_key_position(struct lwl_led_effect *effect, unsigned int keycode,
+					int *row, int *column)
+{
+	unsigned int i;
+
+	// Unknown keys start in the middle
+	*row = effect->rows / 2;
+	*column = effect->columns / 2;
+
+	for (i = 0; i < ARRAY_SIZE(lwl_led_effect_key_rows); ++i) {
+		if (keycode < lwl_led_effect_key_rows[i].first ||
+		    keycode > lwl_led_effect_key_rows[i].last)
+			continue;
+		*row = lwl_led_effect_key_rows[i].row * effect->rows / 6;
+		*column = (keycode - lwl_led_effect_key_rows[i].first + lwl_led_effect_key_rows[i].offset)
+			  * effect->columns / 15;
+		if (*column >= effect->columns)
+			*column = effect->columns - 1;
+		break;
+	}
+
+	if (effect->rows_bottom_up)
+		*row = effect->rows - 1 - *row;
+}
+
+static int lwl_led_effect_keyboard_callb(struct notifier_block *nb, unsigned long code, void *_param)
+{
+	struct lwl_led_effect *effect = container_of(nb, struct lwl_led_effect, keyboard_nb);
+	struct keyboard_notifier_param *param = _param;
+	struct lwl_led_effect_ripple *ripple;
+	unsigned long flags;
+
+	if (code != KBD_KEYCODE || !param->down || READ_ONCE(effect->mode) != lwl_LED_EFFECT_RIPPLE)
+		return NOTIFY_OK;
+
+	spin_lock_irqsave(&effect->ripple_lock, flags);
+	ripple = &effect->ripples[effect->next_ripple];
+	effect->next_ripple = (effect->next_ripple + 1) % lwl_LED_EFFECT_RIPPLES;
+	lwl_led_effect_key_position(effect, param->value, &ripple->row, &ripple->column);
+	ripple->start = ktime_get();
+	ripple->active = true;
+	spin_unlock_irqrestore(&effect->ripple_lock, flags);
+
+	// A running animation picks it up with the next frame
+	if (!hrtimer_active(&effect->timer))
+		schedule_work(&effect->work);
+
+	return NOTIFY_OK;
+}
+
+/**
+ * Listen to key presses only while the ripple effect needs them
+ *
+ * Called with lock held, from process context.
+ */
+static void lwl_led_effect_update_keyboard_nb(struct lwl_led_effect *effect)
+{
+	bool ripple = effect->mode == lwl_LED_EFFECT_RIPPLE;
+
+	if (ripple == effect->keyboard_nb_registered)
+		return;
+
+	if (ripple)
+		register_keyboard_notifier(&effect->keyboard_nb);
+	else
+		unregister_keyboard_notifier(&effect->keyboard_nb);
+	effect->keyboard_nb_registered = ripple;
+}
+
+// sysfs interface
+
+static struct lwl_led_effect *kobj_to_lwl_led_effect(struct kobject *kobj)
+{
+	return container_of(kobj, struct lwl_led_effect_kobj, kobj)->effect;
+}
+
+static ssize_t effect_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+	struct lwl_led_effect *effect = kobj_to_lwl_led_effect(kobj);
+	int i, len = 0;
+
+	for (i = 0; i < lwl_LED_EFFECT_MODES; ++i)
+		len += sysfs_emit_at(buf, len, i == effect->mode ? "%s[%s]" : "%s%s",
+				     i > 0 ? " " : "", lwl_led_effect_names[i]);
+	len += sysfs_emit_at(buf, len, "\n");
+
+	return len;
+}
+
+static ssize_t effect_store(struct kobject *kobj, struct kobj_attribute *attr,
+			    const char *buf, size_t size)
+{
+	struct lwl_led_effect *effect = kobj_to_lwl_led_effect(kobj);
+	enum lwl_led_effect_mode old_mode;
+	unsigned long flags;
+	int i;
+
+	for (i = 0; i < lwl_LED_EFFECT_MODES; ++i)
+		if (sysfs_streq(buf, lwl_led_effect_names[i]))
+			break;
+	if (i == lwl_LED_EFFECT_MODES)
+		return -EINVAL;
+
+	mutex_lock(&effect->lock);
+	old_mode = effect->mode;
+	WRITE_ONCE(effect->mode, i);
+	effect->start = ktime_get();
+	lwl_led_effect_update_keyboard_nb(effect);
+	mutex_unlock(&effect->lock);
+
+	spin_lock_irqsave(&effect->ripple_lock, flags);
+	memset(effect->ripples, 0, sizeof(effect->ripples));
+	spin_unlock_irqrestore(&effect->ripple_lock, flags);
+
+	lwl_led_effect_stop(effect);
+
+	if (i != lwl_LED_EFFECT_NONE) {
+		schedule_work(&effect->work);
+		return size;
+	}
+
+	// Replace the last frame, unless another effect got selected meanwhile
+	mutex_lock(&effect->lock);
+	if (old_mode != lwl_LED_EFFECT_NONE && effect->mode == lwl_LED_EFFECT_NONE &&
+	    !effect->suspended && effect->output->restore)
+		effect->output->restore(effect->drvdata);
+	mutex_unlock(&effect->lock);
+
+	return size;
+}
+
+static ssize_t colors_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+	struct lwl_led_effect *effect = kobj_to_lwl_led_effect(kobj);
+
+	return sysfs_emit(buf, "%02x%02x%02x %02x%02x%02x\n",
+			  effect->colors[0][0], effect->colors[0][1], effect->colors[0][2],
+			  effect->colors[1][0], effect->colors[1][1], effect->colors[1][2]);
+}
+
+static ssize_t colors_store(struct kobject *kobj, struct kobj_attribute *attr,
+			    const char *buf, size_t size)
+{
+	struct lwl_led_effect *effect = kobj_to_lwl_led_effect(kobj);
+	u32 fg, bg;
+	int i;
+
+	if (sscanf(buf, "%6x %6x", &fg, &bg) != 2)
+		return -EINVAL;
+
+	mutex_lock(&effect->lock);
+	for (i = 0; i < 3; ++i) {
+		effect->colors[0][i] = (fg >> (16 - 8 * i)) & 0xff;
+		effect->colors[1][i] = (bg >> (16 - 8 * i)) & 0xff;
+	}
+	mutex_unlock(&effect->lock);
+
+	schedule_work(&effect->work);
+
+	return size;
+}
+
+static ssize_t period_ms_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%u\n", kobj_to_lwl_led_effect(kobj)->period_ms);
+}
+
+static ssize_t period_ms_store(struct kobject *kobj, struct kobj_attribute *attr,
+			       const char *buf, size_t size)
+{
+	struct lwl_led_effect *effect = kobj_to_lwl_led_effect(kobj);
+	unsigned int value;
+	int err;
+
+	err = kstrtouint(buf, 10, &value);
+	if (err)
+		return err;
+
+	if (value < lwl_LED_EFFECT_PERIOD_MS_MIN || value > lwl_LED_EFFECT_PERIOD_MS_MAX)
+		return -EINVAL;
+
+	mutex_lock(&effect->lock);
+	effect->period_ms = value;
+	mutex_unlock(&effect->lock);
+
+	schedule_work(&effect->work);
+
+	return size;
+}
+
+static ssize_t frames_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%llu\n", kobj_to_lwl_led_effect(kobj)->frames);
+}
+
+static struct kobj_attribute lwl_led_effect_attr_effect = __ATTR_RW(effect);
+static struct kobj_attribute lwl_led_effect_attr_colors = __ATTR_RW(colors);
+static struct kobj_attribute lwl_led_effect_attr_period_ms = __ATTR_RW(period_ms);
+static struct kobj_attribute lwl_led_effect_attr_frames = __ATTR_RO(frames);
+
+static struct attribute *lwl_led_effect_attrs[] = {
+	&lwl_led_effect_attr_effect.attr,
+	&lwl_led_effect_attr_colors.attr,
+	&lwl_led_effect_attr_period_ms.attr,
+	&lwl_led_effect_attr_frames.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(lwl_led_effect);
+
+static void lwl_led_effect_kobj_release(struct kobject *kobj)
+{
+	kfree(container_of(kobj, struct lwl_led_effect_kobj, kobj));
+}
+
+static struct kobj_type lwl_led_effect_ktype = {
+	.release = lwl_led_effect_kobj_release,
+	.sysfs_ops = &kobj_sysfs_ops,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 2, 0)
+	.default_attrs = lwl_led_effect_attrs,
+#else
+	.default_groups = lwl_led_effect_groups,
+#endif
+};
+
+// Backend interface
+
+static int __attribute__ ((unused)) lwl_led_effect_register(struct lwl_led_effect *effect, struct device *parent)
+{
+	int err;
+
+	effect->frame = kcalloc(effect->rows * effect->columns, 3, GFP_KERNEL);
+	if (!effect->frame)
+		return -ENOMEM;
+
+	mutex_init(&effect->lock);
+	spin_lock_init(&effect->ripple_lock);
+	effect->mode = lwl_LED_EFFECT_NONE;
+	memset(effect->colors[0], 0xff, 3);
+	memset(effect->colors[1], 0x00, 3);
+	effect->period_ms = lwl_LED_EFFECT_PERIOD_MS_DEFAULT;
+	effect->enabled = true;
+	effect->suspended = false;
+	effect->frames = 0;
+	memset(effect->ripples, 0, sizeof(effect->ripples));
+	effect->next_ripple = 0;
+
+	INIT_WORK(&effect->work, lwl_led_effect_work_func);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+	hrtimer_init(&effect->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	effect->timer.function = lwl_led_effect_timer_func;
+#else
+	hrtimer_setup(&effect->timer, lwl_led_effect_timer_func, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#endif
+
+	effect->keyboard_nb.notifier_call = lwl_led_effect_keyboard_callb;
+	effect->keyboard_nb_registered = false;
+
+	effect->kobj = kzalloc(sizeof(*effect->kobj), GFP_KERNEL);
+	if (!effect->kobj) {
+		kfree(effect->frame);
+		effect->frame = NULL;
+		return -ENOMEM;
+	}
+	effect->kobj->effect = effect;
+
+	err = kobject_init_and_add(&effect->kobj->kobj, &lwl_led_effect_ktype, &parent->kobj, "led_effect");
+	if (err) {
+		kobject_put(&effect->kobj->kobj);
+		effect->kobj = NULL;
+		kfree(effect->frame);
+		effect->frame = NULL;
+		return err;
+	}
+
+	effect->registered = true;
+
+	return 0;
+}
+
+static void __attribute__ ((unused)) lwl_led_effect_unregister(struct lwl_led_effect *effect)
+{
+	if (!effect->registered)
+		return;
+
+	// No sysfs callbacks run past kobject_del()
+	kobject_del(&effect->kobj->kobj);
+	kobject_put(&effect->kobj->kobj);
+	effect->kobj = NULL;
+
+	mutex_lock(&effect->lock);
+	WRITE_ONCE(effect->mode, lwl_LED_EFFECT_NONE);
+	lwl_led_effect_update_keyboard_nb(effect);
+	mutex_unlock(&effect->lock);
+	lwl_led_effect_stop(effect);
+
+	kfree(effect->frame);
+	effect->frame = NULL;
+	effect->registered = false;
+}
+
+/**
+ * Backlight on or off, may be called from atomic context
+ */
+static void __attribute__ ((unused)) lwl_led_effect_set_enabled(struct lwl_led_effect *effect, bool enabled)
+{
+	if (!effect->registered || READ_ONCE(effect->enabled) == enabled)
+		return;
+
+	WRITE_ONCE(effect->enabled, enabled);
+	// Stops at the next frame when disabled
+	schedule_work(&effect->work);
+}
+
+static bool __attribute__ ((unused)) lwl_led_effect_active(struct lwl_led_effect *effect)
+{
+	return effect->registered && READ_ONCE(effect->mode) != lwl_LED_EFFECT_NONE;
+}
+
+static void __attribute__ ((unused)) lwl_led_effect_suspend(struct lwl_led_effect *effect)
+{
+	if (!effect->registered)
+		return;
+
+	mutex_lock(&effect->lock);
+	effect->suspended = true;
+	mutex_unlock(&effect->lock);
+
+	lwl_led_effect_stop(effect);
+}
+
+static void __attribute__ ((unused)) lwl_led_effect_resume(struct lwl_led_effect *effect)
+{
+	if (!effect->registered)
+		return;
+
+	mutex_lock(&effect->lock);
+	effect->suspended = false;
+	mutex_unlock(&effect->lock);
+
+	schedule_work(&effect->work);
+}
+
+#endif
@@ -22,11 +22,25 @@
 #include <linux/platform_device.h>
 #include <linux/delay.h>
 #include <linux/pci.h>
+#include <linux/suspend.h>
+#include <linux/debugfs.h>
 
 #include "../uniwill_interfaces.h"
+#include "../lwl_state_restore.h"
 
 #define __unused __attribute__((unused))
 
+// Settings replayed after resume
+static struct lwl_state nb02_state = lwl_STATE_INIT(nb02_state);
+
+static int ctgp_offset_restore(struct lwl_state_item *item, u64 value)
+{
+	return uniwill_write_ec_ram(UW_EC_REG_CTGP_DB_CTGP_OFFSET, value);
+}
+
+static struct lwl_state_item nb02_state_ctgp_offset =
+	lwl_STATE_ITEM("ctgp_offset", lwl_STATE_STAGE_POWER, ctgp_offset_restore);
+
 static ssize_t ctgp_offset_show(struct device * __unused dev,
 				struct device_attribute * __unused attr,
 				char *buf)
@@ -55,6 +69,8 @@ static ssize_t ctgp_offset_store(struct device * __unused dev,
 	if (result < 0)
 		return result;
 
+	lwl_state_record(&nb02_state, &nb02_state_ctgp_offset, data);
+
 	return count;
 }
 DEVICE_ATTR_RW(ctgp_offset);
@@ -251,6 +267,7 @@ static int __init init_db_and_ctgp(void)
 	result = uniwill_write_ec_ram(UW_EC_REG_CTGP_DB_CTGP_OFFSET, 0);
 	if (result < 0)
 		return result;
+	lwl_state_record(&nb02_state, &nb02_state_ctgp_offset, 0);
 
 	result = uniwill_write_ec_ram(UW_EC_REG_CTGP_DB_TPP_OFFSET, 255);
 	if (result < 0)
@@ -329,13 +346,29 @@ static int __init lwl_nb02_nvidia_power_ctrl_probe(struct platform_device *pdev)
 	if (result < 0)
 		return result;
 
+	lwl_state_add(&nb02_state, &nb02_state_ctgp_offset);
+
 	return 0;
 }
 
+static int lwl_nb02_nvidia_power_ctrl_pm_notify(struct notifier_block *nb,
+						unsigned long action, void *data)
+{
+	if (action == PM_POST_SUSPEND || action == PM_POST_HIBERNATION)
+		lwl_state_restore_all(&nb02_state);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block lwl_nb02_nvidia_power_ctrl_pm_nb = {
+	.notifier_call = lwl_nb02_nvidia_power_ctrl_pm_notify,
+};
+
 
 
 // Boilerplate
 
+static struct dentry *lwl_nb02_nvidia_power_ctrl_debugfs_dir;
 static struct platform_device *lwl_nb02_nvidia_power_ctrl_device;
 static struct platform_driver lwl_nb02_nvidia_power_ctrl_driver = {
 	.driver.name = "lwl_nvidia_power_ctrl",
@@ -361,11 +394,18 @@ static int __init lwl_nb02_nvidia_power_ctrl_init(void)
 	if (IS_ERR(lwl_nb02_nvidia_power_ctrl_device))
 		return PTR_ERR(lwl_nb02_nvidia_power_ctrl_device);
 
+	lwl_nb02_nvidia_power_ctrl_debugfs_dir = debugfs_create_dir(KBUILD_MODNAME, NULL);
+	lwl_state_debugfs_init(&nb02_state, lwl_nb02_nvidia_power_ctrl_debugfs_dir);
+	register_pm_notifier(&lwl_nb02_nvidia_power_ctrl_pm_nb);
+
 	return 0;
 }
 
 static void __exit lwl_nb02_nvidia_power_ctrl_exit(void)
 {
+	unregister_pm_notifier(&lwl_nb02_nvidia_power_ctrl_pm_nb);
+	lwl_state_debugfs_remove(&nb02_state);
+	debugfs_remove_recursive(lwl_nb02_nvidia_power_ctrl_debugfs_dir);
 	platform_device_unregister(lwl_nb02_nvidia_power_ctrl_device);
 	platform_driver_unregister(&lwl_nb02_nvidia_power_ctrl_driver);
 }
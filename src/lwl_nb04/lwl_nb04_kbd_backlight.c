@@ -23,6 +23,10 @@
 #include <linux/platform_device.h>
 #include <linux/led-class-multicolor.h>
 #include <linux/version.h>
+#include <linux/workqueue.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/bitmap.h>
 #include "lwl_nb04_wmi_ab.h"
 
 #define KEYBOARD_MAX_BRIGHTNESS		0x0a
@@ -31,24 +35,217 @@
 #define KEYBOARD_DEFAULT_COLOR_GREEN	0xff
 #define KEYBOARD_DEFAULT_COLOR_BLUE	0xff
 
+// Key ids addressable through the extended input method
+#define KEYBOARD_KEY_COUNT		128
+#define KEYBOARD_ZONE_COUNT		4
+#define KEYBOARD_FRAME_SIZE		(KEYBOARD_KEY_COUNT * 3)
+
+// Window in which key updates collapse into one firmware call
+#define KEYBOARD_FLUSH_DELAY_MS		10
+
 struct driver_data_t {
 	struct led_classdev_mc mcled_cdev_keyboard;
 	struct mc_subled mcled_cdev_subleds_keyboard[3];
 	struct device_keyboard_status_t device_status;
+
+	// Per-key / per-zone state, colors protected by lock
+	spinlock_t lock;
+	struct mutex flush_lock;
+	struct delayed_work flush_work;
+	u8 colors[KEYBOARD_KEY_COUNT][3];
+	u8 sent[KEYBOARD_KEY_COUNT][3];
+	// Keys whose firmware color is known to be sent[]
+	DECLARE_BITMAP(sent_valid, KEYBOARD_KEY_COUNT);
+	DECLARE_BITMAP(dirty, KEYBOARD_KEY_COUNT);
+	char zone_names[KEYBOARD_ZONE_COUNT][LED_MAX_NAME_SIZE];
+	struct led_classdev_mc mcled_cdev_zones[KEYBOARD_ZONE_COUNT];
+	struct mc_subled mcled_cdev_subleds_zones[KEYBOARD_ZONE_COUNT][3];
+	bool zones_registered;
+	bool frame_registered;
 };
 
+static bool keyboard_has_keys(struct driver_data_t *driver_data)
+{
+	return driver_data->device_status.keyboard_type == WMI_KEYBOARD_TYPE_PERKEY ||
+	       driver_data->device_status.keyboard_type == WMI_KEYBOARD_TYPE_4ZONE;
+}
+
 static void leds_set_brightness_mc_keyboard(struct led_classdev *led_cdev, enum led_brightness brightness)
 {
 	struct led_classdev_mc *mcled_cdev = lcdev_to_mccdev(led_cdev);
 	u8 red = mcled_cdev->subled_info[0].intensity;
 	u8 green = mcled_cdev->subled_info[1].intensity;
 	u8 blue = mcled_cdev->subled_info[2].intensity;
+	struct driver_data_t *driver_data = container_of(mcled_cdev, struct driver_data_t, mcled_cdev_keyboard);
+	unsigned long flags;
+	int i;
 
 	pr_debug("wmi_set_whole_keyboard(%u, %u, %u, %u)\n", red, green, blue, brightness);
 
-	wmi_set_whole_keyboard(red, green, blue, brightness);
+	if (wmi_set_whole_keyboard(red, green, blue, brightness))
+		return;
+
+	// All keys now carry the whole keyboard color
+	if (keyboard_has_keys(driver_data)) {
+		spin_lock_irqsave(&driver_data->lock, flags);
+		for (i = 0; i < KEYBOARD_KEY_COUNT; ++i) {
+			driver_data->colors[i][0] = driver_data->sent[i][0] = red;
+			driver_data->colors[i][1] = driver_data->sent[i][1] = green;
+			driver_data->colors[i][2] = driver_data->sent[i][2] = blue;
+		}
+		bitmap_fill(driver_data->sent_valid, KEYBOARD_KEY_COUNT);
+		bitmap_zero(driver_data->dirty, KEYBOARD_KEY_COUNT);
+		spin_unlock_irqrestore(&driver_data->lock, flags);
+	}
+}
+
+/**
+ * Send all changed keys, at most AB_KEYS_PER_CALL per firmware call
+ *
+ * A full frame of KEYBOARD_KEY_COUNT keys does not fit the extended input
+ * buffer and takes two calls.
+ */
+static int keys_flush(struct driver_data_t *driver_data)
+{
+	struct nb04_key_color_t keys[AB_KEYS_PER_CALL];
+	DECLARE_BITMAP(sending, KEYBOARD_KEY_COUNT);
+	unsigned long flags;
+	int key, count, result = 0;
+
+	mutex_lock(&driver_data->flush_lock);
+
+	do {
+		count = 0;
+		bitmap_zero(sending, KEYBOARD_KEY_COUNT);
+
+		spin_lock_irqsave(&driver_data->lock, flags);
+		for_each_set_bit(key, driver_data->dirty, KEYBOARD_KEY_COUNT) {
+			clear_bit(key, driver_data->dirty);
+			if (test_bit(key, driver_data->sent_valid) &&
+			    !memcmp(driver_data->colors[key], driver_data->sent[key], 3))
+				continue;
+			keys[count].key_id = key;
+			keys[count].red = driver_data->colors[key][0];
+			keys[count].green = driver_data->colors[key][1];
+			keys[count].blue = driver_data->colors[key][2];
+			set_bit(key, sending);
+			if (++count == AB_KEYS_PER_CALL)
+				break;
+		}
+		spin_unlock_irqrestore(&driver_data->lock, flags);
+
+		if (count == 0)
+			break;
+
+		result = wmi_set_multiple_keys(keys, count);
+
+		spin_lock_irqsave(&driver_data->lock, flags);
+		if (result) {
+			// Retry with the next update
+			bitmap_or(driver_data->dirty, driver_data->dirty, sending, KEYBOARD_KEY_COUNT);
+		} else {
+			for (key = 0; key < count; ++key) {
+				driver_data->sent[keys[key].key_id][0] = keys[key].red;
+				driver_data->sent[keys[key].key_id][1] = keys[key].green;
+				driver_data->sent[keys[key].key_id][2] = keys[key].blue;
+				set_bit(keys[key].key_id, driver_data->sent_valid);
+			}
+		}
+		spin_unlock_irqrestore(&driver_data->lock, flags);
+	} while (!result);
+
+	mutex_unlock(&driver_data->flush_lock);
+
+	if (result)
+		pr_err("Failed to write keys: %d\n", result);
+
+	return result;
+}
+
+static void keys_flush_work_func(struct work_struct *work)
+{
+	struct driver_data_t *driver_data =
+		container_of(to_delayed_work(work), struct driver_data_t, flush_work);
+
+	keys_flush(driver_data);
+}
+
+/**
+ * Set key color and schedule the write, does not sleep
+ */
+static void keys_set(struct driver_data_t *driver_data, int key, u8 red, u8 green, u8 blue)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&driver_data->lock, flags);
+	driver_data->colors[key][0] = red;
+	driver_data->colors[key][1] = green;
+	driver_data->colors[key][2] = blue;
+	set_bit(key, driver_data->dirty);
+	spin_unlock_irqrestore(&driver_data->lock, flags);
+
+	schedule_delayed_work(&driver_data->flush_work, msecs_to_jiffies(KEYBOARD_FLUSH_DELAY_MS));
 }
 
+static void leds_set_brightness_mc_zone(struct led_classdev *led_cdev, enum led_brightness brightness)
+{
+	struct led_classdev_mc *mcled_cdev = lcdev_to_mccdev(led_cdev);
+	struct driver_data_t *driver_data = dev_get_drvdata(led_cdev->dev->parent);
+	int zone = mcled_cdev->subled_info[0].channel;
+
+	if (brightness == 0)
+		keys_set(driver_data, zone, 0, 0, 0);
+	else
+		keys_set(driver_data, zone,
+			 mcled_cdev->subled_info[0].intensity,
+			 mcled_cdev->subled_info[1].intensity,
+			 mcled_cdev->subled_info[2].intensity);
+}
+
+/**
+ * Whole or partial frame write
+ *
+ * RGB per key id, starting at key id off / 3
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+static ssize_t kbd_frame_write(struct file *filp, struct kobject *kobj, struct bin_attribute *attr,
+			       char *buf, loff_t off, size_t count)
+#else
+static ssize_t kbd_frame_write(struct file *filp, struct kobject *kobj, const struct bin_attribute *attr,
+			       char *buf, loff_t off, size_t count)
+#endif
+{
+	struct driver_data_t *driver_data = dev_get_drvdata(kobj_to_dev(kobj));
+	unsigned long flags;
+	int key, first_key = off / 3;
+	size_t i;
+
+	if (off % 3 != 0 || count % 3 != 0 || off + count > KEYBOARD_FRAME_SIZE)
+		return -EINVAL;
+
+	spin_lock_irqsave(&driver_data->lock, flags);
+	for (i = 0; i < count; i += 3) {
+		key = first_key + i / 3;
+		memcpy(driver_data->colors[key], &buf[i], 3);
+		set_bit(key, driver_data->dirty);
+	}
+	spin_unlock_irqrestore(&driver_data->lock, flags);
+
+	mod_delayed_work(system_wq, &driver_data->flush_work, 0);
+
+	return count;
+}
+
+static struct bin_attribute bin_attr_kbd_frame = {
+	.attr = { .name = "kbd_frame", .mode = 0200 },
+	.size = KEYBOARD_FRAME_SIZE,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0) && LINUX_VERSION_CODE < KERNEL_VERSION(6, 16, 0)
+	.write_new = kbd_frame_write,
+#else
+	.write = kbd_frame_write,
+#endif
+};
+
 static int init_leds(struct platform_device *pdev)
 {
 	struct driver_data_t *driver_data = dev_get_drvdata(&pdev->dev);
@@ -77,6 +274,60 @@ static int init_leds(struct platform_device *pdev)
 	return 0;
 }
 
+static int init_keys(struct platform_device *pdev)
+{
+	struct driver_data_t *driver_data = dev_get_drvdata(&pdev->dev);
+	struct led_classdev_mc *mcled_cdev;
+	int i, retval;
+
+	spin_lock_init(&driver_data->lock);
+	mutex_init(&driver_data->flush_lock);
+	INIT_DELAYED_WORK(&driver_data->flush_work, keys_flush_work_func);
+
+	// Firmware state is unknown until the first write
+	for (i = 0; i < KEYBOARD_KEY_COUNT; ++i) {
+		driver_data->colors[i][0] = KEYBOARD_DEFAULT_COLOR_RED;
+		driver_data->colors[i][1] = KEYBOARD_DEFAULT_COLOR_GREEN;
+		driver_data->colors[i][2] = KEYBOARD_DEFAULT_COLOR_BLUE;
+	}
+	bitmap_zero(driver_data->sent_valid, KEYBOARD_KEY_COUNT);
+
+	if (driver_data->device_status.keyboard_type == WMI_KEYBOARD_TYPE_4ZONE) {
+		for (i = 0; i < KEYBOARD_ZONE_COUNT; ++i) {
+			mcled_cdev = &driver_data->mcled_cdev_zones[i];
+			snprintf(driver_data->zone_names[i], LED_MAX_NAME_SIZE,
+				 "rgb:" LED_FUNCTION_KBD_BACKLIGHT "_zone%d", i);
+			mcled_cdev->led_cdev.name = driver_data->zone_names[i];
+			mcled_cdev->led_cdev.max_brightness = 1;
+			mcled_cdev->led_cdev.brightness_set = &leds_set_brightness_mc_zone;
+			mcled_cdev->led_cdev.brightness = 1;
+			mcled_cdev->num_colors = 3;
+			mcled_cdev->subled_info = driver_data->mcled_cdev_subleds_zones[i];
+			mcled_cdev->subled_info[0].color_index = LED_COLOR_ID_RED;
+			mcled_cdev->subled_info[0].intensity = KEYBOARD_DEFAULT_COLOR_RED;
+			mcled_cdev->subled_info[0].channel = i;
+			mcled_cdev->subled_info[1].color_index = LED_COLOR_ID_GREEN;
+			mcled_cdev->subled_info[1].intensity = KEYBOARD_DEFAULT_COLOR_GREEN;
+			mcled_cdev->subled_info[1].channel = i;
+			mcled_cdev->subled_info[2].color_index = LED_COLOR_ID_BLUE;
+			mcled_cdev->subled_info[2].intensity = KEYBOARD_DEFAULT_COLOR_BLUE;
+			mcled_cdev->subled_info[2].channel = i;
+
+			retval = devm_led_classdev_multicolor_register(&pdev->dev, mcled_cdev);
+			if (retval)
+				return retval;
+		}
+		driver_data->zones_registered = true;
+	} else if (driver_data->device_status.keyboard_type == WMI_KEYBOARD_TYPE_PERKEY) {
+		retval = sysfs_create_bin_file(&pdev->dev.kobj, &bin_attr_kbd_frame);
+		if (retval)
+			return retval;
+		driver_data->frame_registered = true;
+	}
+
+	return 0;
+}
+
 static int __init lwl_nb04_kbd_backlight_probe(struct platform_device *pdev)
 {
 	int result;
@@ -100,9 +351,18 @@ static int __init lwl_nb04_kbd_backlight_probe(struct platform_device *pdev)
 		return result;
 	}
 
+	if (keyboard_has_keys(driver_data)) {
+		result = init_keys(pdev);
+		if (result)
+			return result;
+	}
+
 	result = init_leds(pdev);
-	if (result)
+	if (result) {
+		if (driver_data->frame_registered)
+			sysfs_remove_bin_file(&pdev->dev.kobj, &bin_attr_kbd_frame);
 		return result;
+	}
 
 	pr_debug("kbd enabled: %d\n", driver_data->device_status.keyboard_state_enabled);
 	pr_debug("kbd type: %d\n", driver_data->device_status.keyboard_type);
@@ -119,6 +379,15 @@ static void lwl_nb04_kbd_backlight_remove(struct platform_device *pdev)
 #endif
 {
 	struct driver_data_t *driver_data = dev_get_drvdata(&pdev->dev);
+	int i;
+
+	if (driver_data->frame_registered)
+		sysfs_remove_bin_file(&pdev->dev.kobj, &bin_attr_kbd_frame);
+	if (driver_data->zones_registered)
+		for (i = 0; i < KEYBOARD_ZONE_COUNT; ++i)
+			devm_led_classdev_multicolor_unregister(&pdev->dev, &driver_data->mcled_cdev_zones[i]);
+	if (keyboard_has_keys(driver_data))
+		cancel_delayed_work_sync(&driver_data->flush_work);
 	devm_led_classdev_multicolor_unregister(&pdev->dev, &driver_data->mcled_cdev_keyboard);
 	pr_debug("driver remove\n");
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0)
@@ -126,9 +395,42 @@ static void lwl_nb04_kbd_backlight_remove(struct platform_device *pdev)
 #endif
 }
 
+static int lwl_nb04_kbd_backlight_suspend(struct device *dev)
+{
+	struct driver_data_t *driver_data = dev_get_drvdata(dev);
+
+	if (keyboard_has_keys(driver_data))
+		flush_delayed_work(&driver_data->flush_work);
+
+	return 0;
+}
+
+/**
+ * The firmware key colors are unknown after resume, so no key may be
+ * skipped as unchanged
+ */
+static int lwl_nb04_kbd_backlight_resume(struct device *dev)
+{
+	struct driver_data_t *driver_data = dev_get_drvdata(dev);
+	unsigned long flags;
+
+	if (!keyboard_has_keys(driver_data))
+		return 0;
+
+	spin_lock_irqsave(&driver_data->lock, flags);
+	bitmap_zero(driver_data->sent_valid, KEYBOARD_KEY_COUNT);
+	spin_unlock_irqrestore(&driver_data->lock, flags);
+
+	return 0;
+}
+
+static SIMPLE_DEV_PM_OPS(lwl_nb04_kbd_backlight_pm_ops, lwl_nb04_kbd_backlight_suspend,
+			 lwl_nb04_kbd_backlight_resume);
+
 static struct platform_device *lwl_nb04_kbd_backlight_device;
 static struct platform_driver lwl_nb04_kbd_backlight_driver = {
 	.driver.name = "lwl_nb04_kbd_backlight",
+	.driver.pm = &lwl_nb04_kbd_backlight_pm_ops,
 	.remove = lwl_nb04_kbd_backlight_remove
 };
 
@@ -28,6 +28,7 @@
 #include <linux/version.h>
 #include <linux/delay.h>
 #include "../lwl_compatibility_check/lwl_compatibility_check.h"
+#include "lwl_nb04_wmi_bs.h"
 
 #define NB04_WMI_EVENT_GUID	"96A786FA-690C-48FB-9EB3-FA9BC3D92300"
 
@@ -180,6 +181,21 @@ static void lwl_nb04_keyboard_notify(struct wmi_device *wdev, union acpi_object
 		event_code = obj->buffer.pointer[1];
 		pr_debug("event value: %d (%0#4x)\n",
 			 event_code, event_code);
+
+		switch (event_code) {
+		case NB04_WMI_EVENT_MODE_BATTERY:
+			nb04_wmi_bs_system_mode_changed(WMI_SYSTEM_MODE_BATTERY);
+			break;
+		case NB04_WMI_EVENT_MODE_HUMAN:
+			nb04_wmi_bs_system_mode_changed(WMI_SYSTEM_MODE_HUMAN);
+			break;
+		case NB04_WMI_EVENT_MODE_BEAST:
+			nb04_wmi_bs_system_mode_changed(WMI_SYSTEM_MODE_BEAST);
+			break;
+		default:
+			break;
+		}
+
 		sparse_keymap_report_known_event(driver_data->input_dev,
 						 event_code,
 						 1,
@@ -25,13 +25,17 @@
 #include <linux/slab.h>
 #include <linux/dmi.h>
 #include <linux/version.h>
+#include <linux/notifier.h>
 #include "lwl_nb04_wmi_bs.h"
+#include "../lwl_platform_profile.h"
 
 #define DEFAULT_PROFILE		WMI_SYSTEM_MODE_BEAST
 
 struct driver_data_t {
 	struct platform_device *pdev;
 	u8 current_profile_value;
+	struct lwl_platform_profile pp;
+	struct notifier_block system_mode_nb;
 };
 
 static int set_system_mode(u8 mode_input)
@@ -56,22 +60,78 @@ static int set_system_mode(u8 mode_input)
 	return 0;
 }
 
-static int write_platform_profile_state(struct platform_device *pdev)
+static const struct lwl_platform_profile_map platform_profile_map[] = {
+	{ .profile = PLATFORM_PROFILE_LOW_POWER,	.native = WMI_SYSTEM_MODE_BATTERY },
+	{ .profile = PLATFORM_PROFILE_BALANCED,		.native = WMI_SYSTEM_MODE_HUMAN },
+	{ .profile = PLATFORM_PROFILE_PERFORMANCE,	.native = WMI_SYSTEM_MODE_BEAST },
+};
+
+/**
+ * The mode can not be read back, the last written or firmware reported
+ * value is used
+ */
+static int platform_profile_get_native(void *drvdata, u64 *native)
 {
-	struct driver_data_t *driver_data = dev_get_drvdata(&pdev->dev);
-	return set_system_mode(driver_data->current_profile_value);
+	struct driver_data_t *driver_data = drvdata;
+	*native = driver_data->current_profile_value;
+	return 0;
+}
+
+static int platform_profile_set_native(void *drvdata, u64 native)
+{
+	struct driver_data_t *driver_data = drvdata;
+	int err;
+
+	err = set_system_mode(native);
+	if (err)
+		return err;
+
+	driver_data->current_profile_value = native;
+
+	return 0;
+}
+
+static const struct lwl_platform_profile_ops platform_profile_ops = {
+	.get = platform_profile_get_native,
+	.set = platform_profile_set_native,
+};
+
+static int system_mode_notifier_callb(struct notifier_block *nb, unsigned long mode, void *data)
+{
+	struct driver_data_t *driver_data = container_of(nb, struct driver_data_t, system_mode_nb);
+
+	if (mode >= WMI_SYSTEM_MODE_END)
+		return NOTIFY_DONE;
+
+	pr_debug("firmware changed system mode to %lu\n", mode);
+	driver_data->current_profile_value = mode;
+	lwl_platform_profile_notify(&driver_data->pp);
+
+	return NOTIFY_OK;
 }
 
 static ssize_t platform_profile_choices_show(struct device *dev,
 					     struct device_attribute *attr,
-					     char *buffer);
+					     char *buffer)
+{
+	struct driver_data_t *driver_data = dev_get_drvdata(dev);
+	return lwl_platform_profile_choices_show(&driver_data->pp, buffer);
+}
 
 static ssize_t platform_profile_show(struct device *dev,
-				     struct device_attribute *attr, char *buffer);
+				     struct device_attribute *attr, char *buffer)
+{
+	struct driver_data_t *driver_data = dev_get_drvdata(dev);
+	return lwl_platform_profile_show(&driver_data->pp, buffer);
+}
 
 static ssize_t platform_profile_store(struct device *dev,
 				      struct device_attribute *attr,
-				      const char *buffer, size_t size);
+				      const char *buffer, size_t size)
+{
+	struct driver_data_t *driver_data = dev_get_drvdata(dev);
+	return lwl_platform_profile_store(&driver_data->pp, buffer, size);
+}
 
 struct platform_profile_attrs_t {
 	struct device_attribute platform_profile_choices;
@@ -95,98 +155,6 @@ static struct attribute_group platform_profile_attr_group = {
 	.attrs = platform_profile_attrs_list
 };
 
-struct char_to_value_t {
-	char* descriptor;
-	u64 value;
-};
-
-static struct char_to_value_t platform_profile_options[] = {
-	{ .descriptor = "low-power",	.value = WMI_SYSTEM_MODE_BATTERY },
-	{ .descriptor = "balanced",	.value = WMI_SYSTEM_MODE_HUMAN },
-	{ .descriptor = "performance",	.value = WMI_SYSTEM_MODE_BEAST },
-};
-
-static ssize_t platform_profile_choices_show(struct device *dev,
-					     struct device_attribute *attr,
-					     char *buffer)
-{
-	int i, n;
-	n = ARRAY_SIZE(platform_profile_options);
-	for (i = 0; i < n; ++i) {
-		sprintf(buffer + strlen(buffer), "%s",
-			platform_profile_options[i].descriptor);
-		if (i < n - 1)
-			sprintf(buffer + strlen(buffer), " ");
-		else
-			sprintf(buffer + strlen(buffer), "\n");
-	}
-
-	return strlen(buffer);
-}
-
-static ssize_t platform_profile_show(struct device *dev,
-				     struct device_attribute *attr, char *buffer)
-{
-	u64 platform_profile_value;
-	int i, err;
-	struct platform_device *pdev = to_platform_device(dev);
-	struct driver_data_t *driver_data = dev_get_drvdata(&pdev->dev);
-
-	err = 0;
-	platform_profile_value = driver_data->current_profile_value;
-
-	if (err) {
-		pr_err("Error reading power profile");
-		return -EIO;
-	}
-
-	for (i = 0; i < ARRAY_SIZE(platform_profile_options); ++i)
-		if (platform_profile_options[i].value == platform_profile_value) {
-			sprintf(buffer, "%s\n", platform_profile_options[i].descriptor);
-			return strlen(buffer);
-		}
-
-	pr_err("Read platform profile value not matched to a descriptor\n");
-
-	return -EIO;
-}
-
-static ssize_t platform_profile_store(struct device *dev,
-				      struct device_attribute *attr,
-				      const char *buffer, size_t size)
-{
-	struct platform_device *pdev = to_platform_device(dev);
-	struct driver_data_t *driver_data = dev_get_drvdata(&pdev->dev);
-	u64 platform_profile_value;
-	int i, err;
-	char *buffer_copy;
-	char *platform_profile_descriptor;
-
-	buffer_copy = kmalloc(size + 1, GFP_KERNEL);
-	strcpy(buffer_copy, buffer);
-	platform_profile_descriptor = strstrip(buffer_copy);
-
-	for (i = 0; i < ARRAY_SIZE(platform_profile_options); ++i)
-		if (strcmp(platform_profile_options[i].descriptor, platform_profile_descriptor) == 0) {
-			platform_profile_value = platform_profile_options[i].value;
-			break;
-		}
-
-	kfree(buffer_copy);
-
-	if (i < ARRAY_SIZE(platform_profile_options)) {
-		// Option found try to set
-		driver_data->current_profile_value = platform_profile_value;
-		err = write_platform_profile_state(pdev);
-		if (err)
-			return err;
-		return size;
-	} else {
-		// Invalid input, not matched to an option
-		return -EINVAL;
-	}
-}
-
 static int __init lwl_nb04_power_profiles_probe(struct platform_device *pdev)
 {
 	int err;
@@ -204,8 +172,14 @@ static int __init lwl_nb04_power_profiles_probe(struct platform_device *pdev)
 	dev_set_drvdata(&pdev->dev, driver_data);
 
 	driver_data->pdev = pdev;
+	driver_data->pp.name = "lwl-nb04";
+	driver_data->pp.map = platform_profile_map;
+	driver_data->pp.map_size = ARRAY_SIZE(platform_profile_map);
+	driver_data->pp.ops = &platform_profile_ops;
+	driver_data->pp.drvdata = driver_data;
+
 	driver_data->current_profile_value = DEFAULT_PROFILE;
-	write_platform_profile_state(pdev);
+	set_system_mode(driver_data->current_profile_value);
 
 	err = sysfs_create_group(&driver_data->pdev->dev.kobj, &platform_profile_attr_group);
 	if (err) {
@@ -214,6 +188,13 @@ static int __init lwl_nb04_power_profiles_probe(struct platform_device *pdev)
 		return err;
 	}
 
+	err = lwl_platform_profile_register(&driver_data->pp, &pdev->dev);
+	if (err)
+		pr_debug("platform_profile handler not registered: %d\n", err);
+
+	driver_data->system_mode_nb.notifier_call = system_mode_notifier_callb;
+	nb04_wmi_bs_register_system_mode_notifier(&driver_data->system_mode_nb);
+
 	return 0;
 }
 
@@ -225,6 +206,8 @@ static void lwl_nb04_power_profiles_remove(struct platform_device *pdev)
 {
 	pr_debug("driver remove\n");
 	struct driver_data_t *driver_data = dev_get_drvdata(&pdev->dev);
+	nb04_wmi_bs_unregister_system_mode_notifier(&driver_data->system_mode_nb);
+	lwl_platform_profile_unregister(&driver_data->pp);
 	sysfs_remove_group(&driver_data->pdev->dev.kobj, &platform_profile_attr_group);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0)
 	return 0;
@@ -22,14 +22,26 @@
 #include <linux/module.h>
 #include <linux/hwmon.h>
 #include <linux/platform_device.h>
+#include <linux/jiffies.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include "lwl_nb04_wmi_bs.h"
 
+// Sensor values younger than this are served from the snapshot
+static unsigned int cache_ttl_ms = 1000;
+module_param(cache_ttl_ms, uint, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(cache_ttl_ms, "Lifetime of cached sensor readings in ms, 0 disables caching");
+
+static atomic64_t fw_calls = ATOMIC64_INIT(0);
+
 static int read_cpu_info(u8 *cpu_temp, u8 *cpu_turbo_mode)
 {
 	int err, wmi_return;
 	u8 in[BS_INPUT_BUFFER_LENGTH];
 	u8 out[BS_OUTPUT_BUFFER_LENGTH];
 
+	atomic64_inc(&fw_calls);
 	err = nb04_wmi_bs_method(0x04, in, out);
 	if (err)
 		return err;
@@ -52,6 +64,7 @@ static int read_gpu_info(u8 *gpu_temp, u8 *gpu_turbo_mode, u16 *gpu_max_freq)
 	u8 in[BS_INPUT_BUFFER_LENGTH];
 	u8 out[BS_OUTPUT_BUFFER_LENGTH];
 
+	atomic64_inc(&fw_calls);
 	err = nb04_wmi_bs_method(0x06, in, out);
 	if (err)
 		return err;
@@ -78,6 +91,7 @@ static int read_fan_setting(u16 *fan1_cur_rpm, u16 *fan2_cur_rpm,
 	u8 in[BS_INPUT_BUFFER_LENGTH];
 	u8 out[BS_OUTPUT_BUFFER_LENGTH];
 
+	atomic64_inc(&fw_calls);
 	err = nb04_wmi_bs_method(0x02, in, out);
 	if (err)
 		return err;
@@ -110,15 +124,61 @@ static const char * const fan_labels[] = {
 	"gpu0"
 };
 
+struct sensors_snapshot_t {
+	bool valid;
+	unsigned long updated;
+	int cpu_err;
+	int gpu_err;
+	int fan_err;
+	u8 cpu_temp;
+	u8 gpu_temp;
+	u16 fan1_rpm;
+	u16 fan2_rpm;
+};
+
 struct driver_data_t {
 	int fan_cpu_max;
 	int fan_cpu_min;
 	int fan_gpu_max;
 	int fan_gpu_min;
+	struct mutex snapshot_lock;
+	struct sensors_snapshot_t snapshot;
+	u64 refreshes;
+	u64 cache_hits;
 };
 
 struct driver_data_t driver_data;
 
+/**
+ * Fetch all sensors together, called with snapshot_lock held
+ */
+static void __sensors_refresh(struct driver_data_t *driver_data)
+{
+	struct sensors_snapshot_t *snap = &driver_data->snapshot;
+
+	snap->cpu_err = read_cpu_info(&snap->cpu_temp, NULL);
+	snap->gpu_err = read_gpu_info(&snap->gpu_temp, NULL, NULL);
+	snap->fan_err = read_fan_setting(&snap->fan1_rpm, &snap->fan2_rpm, NULL, NULL, NULL);
+	snap->updated = jiffies;
+	snap->valid = true;
+	driver_data->refreshes += 1;
+}
+
+/**
+ * Get a snapshot no older than cache_ttl_ms
+ */
+static void sensors_get_snapshot(struct driver_data_t *driver_data, struct sensors_snapshot_t *snap)
+{
+	mutex_lock(&driver_data->snapshot_lock);
+	if (!driver_data->snapshot.valid || cache_ttl_ms == 0 ||
+	    time_after(jiffies, driver_data->snapshot.updated + msecs_to_jiffies(cache_ttl_ms)))
+		__sensors_refresh(driver_data);
+	else
+		driver_data->cache_hits += 1;
+	*snap = driver_data->snapshot;
+	mutex_unlock(&driver_data->snapshot_lock);
+}
+
 static umode_t
 lwl_nb04_sensors_is_visible(const void *drvdata, enum hwmon_sensor_types type,
 			       u32 attr, int channel)
@@ -130,24 +190,22 @@ static int
 lwl_nb04_sensors_read(struct device *dev, enum hwmon_sensor_types type,
 			 u32 attr, int channel, long *val)
 {
-	int err;
-	u8 temp_data;
-	u16 rpm_data;
+	struct sensors_snapshot_t snap;
 	struct driver_data_t *driver_data = dev_get_drvdata(dev);
 
 	switch (type) {
 	case hwmon_temp:
 		if (channel == 0) {
-			err = read_cpu_info(&temp_data, NULL);
-			if (err)
-				return err;
-			*val = temp_data * 1000;
+			sensors_get_snapshot(driver_data, &snap);
+			if (snap.cpu_err)
+				return snap.cpu_err;
+			*val = snap.cpu_temp * 1000;
 			return 0;
 		} else if (channel == 1) {
-			err = read_gpu_info(&temp_data, NULL, NULL);
-			if (err)
-				return err;
-			*val = temp_data * 1000;
+			sensors_get_snapshot(driver_data, &snap);
+			if (snap.gpu_err)
+				return snap.gpu_err;
+			*val = snap.gpu_temp * 1000;
 			return 0;
 		}
 		break;
@@ -172,17 +230,11 @@ lwl_nb04_sensors_read(struct device *dev, enum hwmon_sensor_types type,
 			}
 			break;
 		case hwmon_fan_input:
-			if (channel == 0) {
-				err = read_fan_setting(&rpm_data, NULL, NULL, NULL, NULL);
-				if (err)
-					return err;
-				*val = rpm_data;
-				return 0;
-			} else if (channel == 1) {
-				err = read_fan_setting(NULL, &rpm_data, NULL, NULL, NULL);
-				if (err)
-					return err;
-				*val = rpm_data;
+			if (channel == 0 || channel == 1) {
+				sensors_get_snapshot(driver_data, &snap);
+				if (snap.fan_err)
+					return snap.fan_err;
+				*val = channel == 0 ? snap.fan1_rpm : snap.fan2_rpm;
 				return 0;
 			}
 			break;
@@ -235,6 +287,43 @@ static const struct hwmon_chip_info lwl_nb04_sensors_chip_info = {
 	.info = lwl_nb04_sensors_info
 };
 
+// Debug interface, not part of the hwmon ABI
+
+static struct dentry *lwl_nb04_sensors_debugfs_dir;
+
+static ssize_t refresh_write(struct file *file, const char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	struct driver_data_t *driver_data = file->private_data;
+
+	mutex_lock(&driver_data->snapshot_lock);
+	__sensors_refresh(driver_data);
+	mutex_unlock(&driver_data->snapshot_lock);
+
+	return count;
+}
+
+static const struct file_operations refresh_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = refresh_write,
+	.llseek = noop_llseek,
+};
+
+static int wmi_stats_show(struct seq_file *m, void *unused)
+{
+	struct driver_data_t *driver_data = m->private;
+
+	mutex_lock(&driver_data->snapshot_lock);
+	seq_printf(m, "fw_calls: %lld\n", atomic64_read(&fw_calls));
+	seq_printf(m, "refreshes: %llu\n", driver_data->refreshes);
+	seq_printf(m, "cache_hits: %llu\n", driver_data->cache_hits);
+	mutex_unlock(&driver_data->snapshot_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(wmi_stats);
+
 static int __init lwl_nb04_sensors_probe(struct platform_device *pdev)
 {
 	struct device *hwmon_dev;
@@ -245,6 +334,8 @@ static int __init lwl_nb04_sensors_probe(struct platform_device *pdev)
 	if (err)
 		return err;
 
+	mutex_init(&driver_data.snapshot_lock);
+
 	driver_data.fan_cpu_max = fan1_max_rpm;
 	driver_data.fan_cpu_min = 0;
 	driver_data.fan_gpu_max = fan2_max_rpm;
@@ -255,8 +346,14 @@ static int __init lwl_nb04_sensors_probe(struct platform_device *pdev)
 							 &driver_data,
 							 &lwl_nb04_sensors_chip_info,
 							 NULL);
+	if (IS_ERR(hwmon_dev))
+		return PTR_ERR(hwmon_dev);
 
-	return PTR_ERR_OR_ZERO(hwmon_dev);
+	lwl_nb04_sensors_debugfs_dir = debugfs_create_dir(KBUILD_MODNAME, NULL);
+	debugfs_create_file("refresh", 0200, lwl_nb04_sensors_debugfs_dir, &driver_data, &refresh_fops);
+	debugfs_create_file("wmi_stats", 0444, lwl_nb04_sensors_debugfs_dir, &driver_data, &wmi_stats_fops);
+
+	return 0;
 }
 
 static struct platform_device *lwl_nb04_sensors_device;
@@ -278,6 +375,7 @@ static int __init lwl_nb04_sensors_init(void)
 
 static void __exit lwl_nb04_sensors_exit(void)
 {
+	debugfs_remove_recursive(lwl_nb04_sensors_debugfs_dir);
 	platform_device_unregister(lwl_nb04_sensors_device);
 	platform_driver_unregister(&lwl_nb04_sensors_driver);
 }
@@ -27,11 +27,14 @@
 #include "lwl_nb04_wmi_ab.h"
 #include "../lwl_compatibility_check/lwl_compatibility_check.h"
 
-#define dev_to_wdev(__dev)	container_of(__dev, struct wmi_device, dev)
+#define lwl_TRACE_SYSTEM lwl_nb04_wmi_ab
+#define CREATE_TRACE_POINTS
+#include "../lwl_trace.h"
+#include "lwl_nb04_wmi_call.h"
 
-static DEFINE_MUTEX(nb04_wmi_ab_lock);
+#define dev_to_wdev(__dev)	container_of(__dev, struct wmi_device, dev)
 
-static struct wmi_device *__wmi_dev;
+static struct nb04_wmi_call_ctx wmi_ab_call;
 
 #define KEYBOARD_MAX_BRIGHTNESS		0x0a
 #define KEYBOARD_DEFAULT_BRIGHTNESS	0x00
@@ -41,215 +44,60 @@ static struct wmi_device *__wmi_dev;
 
 struct driver_data_t {};
 
-static int
-__nb04_wmi_ab_method_buffer(struct wmi_device *wdev, u32 wmi_method_id,
-			    u8 *in, u8 *out)
-{
-	struct acpi_buffer acpi_buffer_in = { (acpi_size)AB_INPUT_BUFFER_LENGTH_NORMAL, in };
-	struct acpi_buffer return_buffer = { ACPI_ALLOCATE_BUFFER, NULL };
-	union acpi_object *acpi_object_out;
-	acpi_status status;
-
-	mutex_lock(&nb04_wmi_ab_lock);
-	pr_debug("evaluate: %u\n", wmi_method_id);
-	status = wmidev_evaluate_method(wdev, 0, wmi_method_id,
-					&acpi_buffer_in, &return_buffer);
-	mutex_unlock(&nb04_wmi_ab_lock);
-
-	if (ACPI_FAILURE(status)) {
-		pr_err("failed to evaluate wmi method %u\n", wmi_method_id);
-		return -EIO;
-	}
-
-	acpi_object_out = (union acpi_object *) return_buffer.pointer;
-	if (!acpi_object_out)
-		return -ENODATA;
-
-	if (acpi_object_out->type != ACPI_TYPE_BUFFER) {
-		pr_err("No buffer for method (%u) call\n", wmi_method_id);
-		kfree(return_buffer.pointer);
-		return -EIO;
-	}
-
-	if (acpi_object_out->buffer.length != AB_OUTPUT_BUFFER_LENGTH) {
-		pr_err("Unexpected buffer length: %u for method (%u) call\n", 
-		       acpi_object_out->buffer.length, wmi_method_id);
-		kfree(return_buffer.pointer);
-		return -EIO;
-	}
+static const struct nb04_wmi_result_desc result_buffer = {
+	.type = NB04_WMI_RESULT_BUFFER,
+	.length = AB_OUTPUT_BUFFER_LENGTH,
+	.type_err = -EIO
+};
 
-	memcpy(out, acpi_object_out->buffer.pointer, AB_OUTPUT_BUFFER_LENGTH);
-	kfree(return_buffer.pointer);
+static const struct nb04_wmi_result_desc result_buffer_reduced = {
+	.type = NB04_WMI_RESULT_BUFFER,
+	.length = AB_OUTPUT_BUFFER_LENGTH_REDUCED,
+	.type_err = -EIO
+};
 
-	return 0;
-}
+static const struct nb04_wmi_result_desc result_integer = {
+	.type = NB04_WMI_RESULT_INTEGER,
+	.type_err = -EIO
+};
 
 /**
  * Method interface 8 bytes in 80 bytes out
  */
 int nb04_wmi_ab_method_buffer(u32 wmi_method_id, u8 *in, u8 *out)
 {
-	if (__wmi_dev)
-		return __nb04_wmi_ab_method_buffer(__wmi_dev, wmi_method_id, in, out);
-	else
-		return -ENODEV;
+	return nb04_wmi_call(&wmi_ab_call, wmi_method_id, in, AB_INPUT_BUFFER_LENGTH_NORMAL,
+			     &result_buffer, out);
 }
 EXPORT_SYMBOL(nb04_wmi_ab_method_buffer);
 
-static int
-__nb04_wmi_ab_method_buffer_reduced_output(struct wmi_device *wdev, u32 wmi_method_id,
-					   u8 *in, u8 *out)
-{
-	struct acpi_buffer acpi_buffer_in = { (acpi_size)AB_INPUT_BUFFER_LENGTH_NORMAL, in };
-	struct acpi_buffer return_buffer = { ACPI_ALLOCATE_BUFFER, NULL };
-	union acpi_object *acpi_object_out;
-	acpi_status status;
-
-	mutex_lock(&nb04_wmi_ab_lock);
-	pr_debug("evaluate: %u\n", wmi_method_id);
-	status = wmidev_evaluate_method(wdev, 0, wmi_method_id,
-					&acpi_buffer_in, &return_buffer);
-	mutex_unlock(&nb04_wmi_ab_lock);
-	if (ACPI_FAILURE(status)) {
-		pr_err("failed to evaluate wmi method %u\n", wmi_method_id);
-		return -EIO;
-	}
-
-	acpi_object_out = (union acpi_object *) return_buffer.pointer;
-	if (!acpi_object_out)
-		return -ENODATA;
-
-	if (acpi_object_out->type != ACPI_TYPE_BUFFER) {
-		pr_err("No buffer for method (%u) call\n", wmi_method_id);
-		kfree(return_buffer.pointer);
-		return -EIO;
-	}
-
-	if (acpi_object_out->buffer.length != AB_OUTPUT_BUFFER_LENGTH_REDUCED) {
-		pr_err("Unexpected buffer length: %u for method (%u) call\n", 
-		       acpi_object_out->buffer.length, wmi_method_id);
-		kfree(return_buffer.pointer);
-		return -EIO;
-	}
-
-	memcpy(out, acpi_object_out->buffer.pointer, AB_OUTPUT_BUFFER_LENGTH_REDUCED);
-	kfree(return_buffer.pointer);
-
-	return 0;
-}
-
 /**
  * Method interface 8 bytes in 10 bytes out
  */
 int nb04_wmi_ab_method_buffer_reduced_output(u32 wmi_method_id, u8 *in, u8 *out)
 {
-	if (__wmi_dev)
-		return __nb04_wmi_ab_method_buffer_reduced_output(__wmi_dev, wmi_method_id, in, out);
-	else
-		return -ENODEV;
+	return nb04_wmi_call(&wmi_ab_call, wmi_method_id, in, AB_INPUT_BUFFER_LENGTH_NORMAL,
+			     &result_buffer_reduced, out);
 }
 EXPORT_SYMBOL(nb04_wmi_ab_method_buffer_reduced_output);
 
-static int
-__nb04_wmi_ab_method_extended_input(struct wmi_device *wdev, u32 wmi_method_id,
-				    u8 *in, u8 *out)
-{
-	struct acpi_buffer acpi_buffer_in = { (acpi_size)AB_INPUT_BUFFER_LENGTH_EXTENDED, in };
-	struct acpi_buffer return_buffer = { ACPI_ALLOCATE_BUFFER, NULL };
-	union acpi_object *acpi_object_out;
-	acpi_status status;
-
-	mutex_lock(&nb04_wmi_ab_lock);
-	pr_debug("evaluate: %u\n", wmi_method_id);
-	status = wmidev_evaluate_method(wdev, 0, wmi_method_id,
-					&acpi_buffer_in, &return_buffer);
-	mutex_unlock(&nb04_wmi_ab_lock);
-
-	if (ACPI_FAILURE(status)) {
-		pr_err("failed to evaluate wmi method %u\n", wmi_method_id);
-		return -EIO;
-	}
-
-	acpi_object_out = (union acpi_object *) return_buffer.pointer;
-	if (!acpi_object_out)
-		return -ENODATA;
-
-	if (acpi_object_out->type != ACPI_TYPE_BUFFER) {
-		pr_err("No buffer for method (%u) call\n", wmi_method_id);
-		kfree(return_buffer.pointer);
-		return -EIO;
-	}
-
-	if (acpi_object_out->buffer.length != AB_OUTPUT_BUFFER_LENGTH) {
-		pr_err("Unexpected buffer length: %u for method (%u) call\n", 
-		       acpi_object_out->buffer.length, wmi_method_id);
-		kfree(return_buffer.pointer);
-		return -EIO;
-	}
-
-	memcpy(out, acpi_object_out->buffer.pointer, AB_OUTPUT_BUFFER_LENGTH);
-	kfree(return_buffer.pointer);
-
-	return 0;
-}
-
 /**
  * Method interface 496 bytes in 80 bytes out
  */
 int nb04_wmi_ab_method_extended_input(u32 wmi_method_id, u8 *in, u8 *out)
 {
-	if (__wmi_dev)
-		return __nb04_wmi_ab_method_extended_input(__wmi_dev, wmi_method_id, in, out);
-	else
-		return -ENODEV;
+	return nb04_wmi_call(&wmi_ab_call, wmi_method_id, in, AB_INPUT_BUFFER_LENGTH_EXTENDED,
+			     &result_buffer, out);
 }
 EXPORT_SYMBOL(nb04_wmi_ab_method_extended_input);
 
-static int
-__nb04_wmi_ab_method_int_out(struct wmi_device *wdev, u32 wmi_method_id,
-			     u8 *in, u64 *out)
-{
-	struct acpi_buffer acpi_buffer_in = { (acpi_size)AB_INPUT_BUFFER_LENGTH_NORMAL, in };
-	struct acpi_buffer return_buffer = { ACPI_ALLOCATE_BUFFER, NULL };
-	union acpi_object *acpi_object_out;
-	acpi_status status;
-
-	mutex_lock(&nb04_wmi_ab_lock);
-	pr_debug("evaluate: %u\n", wmi_method_id);
-	status = wmidev_evaluate_method(wdev, 0, wmi_method_id,
-					&acpi_buffer_in, &return_buffer);
-	mutex_unlock(&nb04_wmi_ab_lock);
-
-	if (ACPI_FAILURE(status)) {
-		pr_err("failed to evaluate wmi method\n");
-		return -EIO;
-	}
-
-	acpi_object_out = (union acpi_object *) return_buffer.pointer;
-	if (!acpi_object_out)
-		return -ENODATA;
-
-	if (acpi_object_out->type != ACPI_TYPE_INTEGER) {
-		pr_err("No integer\n");
-		kfree(return_buffer.pointer);
-		return -EIO;
-	}
-
-	*out = acpi_object_out->integer.value;
-	kfree(return_buffer.pointer);
-
-	return 0;
-}
-
 /**
  * Method interface 8 bytes in integer out
  */
 int nb04_wmi_ab_method_int_out(u32 wmi_method_id, u8 *in, u64 *out)
 {
-	if (__wmi_dev)
-		return __nb04_wmi_ab_method_int_out(__wmi_dev, wmi_method_id, in, out);
-	else
-		return -ENODEV;
+	return nb04_wmi_call(&wmi_ab_call, wmi_method_id, in, AB_INPUT_BUFFER_LENGTH_NORMAL,
+			     &result_integer, out);
 }
 EXPORT_SYMBOL(nb04_wmi_ab_method_int_out);
 
@@ -327,6 +175,39 @@ int wmi_set_whole_keyboard(u8 red, u8 green, u8 blue, int brightness)
 }
 EXPORT_SYMBOL(wmi_set_whole_keyboard);
 
+/**
+ * Set the color of up to AB_KEYS_PER_CALL keys (or zones) in one call
+ */
+int wmi_set_multiple_keys(const struct nb04_key_color_t *keys, int count)
+{
+	u8 arg[AB_INPUT_BUFFER_LENGTH_EXTENDED] = {0};
+	u8 out[AB_OUTPUT_BUFFER_LENGTH] = {0};
+	u16 wmi_return;
+	int i, result;
+
+	if (count <= 0 || count > AB_KEYS_PER_CALL)
+		return -EINVAL;
+
+	arg[0] = count;
+	for (i = 0; i < count; ++i) {
+		arg[1 + i * 4 + 0] = keys[i].key_id;
+		arg[1 + i * 4 + 1] = keys[i].red;
+		arg[1 + i * 4 + 2] = keys[i].green;
+		arg[1 + i * 4 + 3] = keys[i].blue;
+	}
+
+	result = nb04_wmi_ab_method_extended_input(6, arg, out);
+	if (result)
+		return result;
+
+	wmi_return = (out[1] << 8) | out[0];
+	if (wmi_return != WMI_RETURN_STATUS_SUCCESS)
+		return -EIO;
+
+	return 0;
+}
+EXPORT_SYMBOL(wmi_set_multiple_keys);
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 3, 0)
 static int lwl_nb04_wmi_ab_probe(struct wmi_device *wdev)
 #else
@@ -334,6 +215,7 @@ static int lwl_nb04_wmi_ab_probe(struct wmi_device *wdev, const void *dummy_cont
 #endif
 {
 	struct driver_data_t *driver_data;
+	int err;
 
 	pr_debug("driver probe\n");
 
@@ -349,7 +231,12 @@ static int lwl_nb04_wmi_ab_probe(struct wmi_device *wdev, const void *dummy_cont
 
 	dev_set_drvdata(&wdev->dev, driver_data);
 
-	__wmi_dev = wdev;
+	err = nb04_wmi_call_init(&wmi_ab_call, wdev, AB_INPUT_BUFFER_LENGTH_EXTENDED,
+				 AB_OUTPUT_BUFFER_LENGTH, KBUILD_MODNAME);
+	if (err) {
+		wmi_ab_call.wdev = NULL;
+		return err;
+	}
 
 	return 0;
 }
@@ -360,7 +247,8 @@ static int lwl_nb04_wmi_ab_remove(struct wmi_device *wdev)
 static void lwl_nb04_wmi_ab_remove(struct wmi_device *wdev)
 #endif
 {
-	__wmi_dev = NULL;
+	nb04_wmi_call_exit(&wmi_ab_call);
+	wmi_ab_call.wdev = NULL;
 	pr_debug("driver remove\n");
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 13, 0)
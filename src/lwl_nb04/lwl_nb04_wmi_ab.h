@@ -69,6 +69,16 @@ enum wmi_color_preset {
 	WMI_COLOR_PRESET_WHITE = 7
 };
 
+// Extended input: count byte followed by 4 byte entries (key id, red, green, blue)
+#define AB_KEYS_PER_CALL		((AB_INPUT_BUFFER_LENGTH_EXTENDED - 1) / 4)
+
+struct nb04_key_color_t {
+	u8 key_id;
+	u8 red;
+	u8 green;
+	u8 blue;
+};
+
 struct device_keyboard_status_t {
 	bool keyboard_state_enabled;
 	enum wmi_keyboard_type keyboard_type;
@@ -83,5 +93,6 @@ int nb04_wmi_ab_method_int_out(u32 wmi_method_id, u8 *in, u64 *out);
 
 int wmi_update_device_status_keyboard(struct device_keyboard_status_t *kbds);
 int wmi_set_whole_keyboard(u8 red, u8 green, u8 blue, int brightness);
+int wmi_set_multiple_keys(const struct nb04_key_color_t *keys, int count);
 
 #endif
@@ -23,82 +23,72 @@
 #include <linux/module.h>
 #include <linux/wmi.h>
 #include <linux/version.h>
+#include <linux/notifier.h>
 #include "../lwl_compatibility_check/lwl_compatibility_check.h"
 #include "lwl_nb04_wmi_bs.h"
 
+#define lwl_TRACE_SYSTEM lwl_nb04_wmi_bs
+#define CREATE_TRACE_POINTS
+#include "../lwl_trace.h"
+#include "lwl_nb04_wmi_call.h"
+
 #define BS_INPUT_BUFFER_LENGTH	8
 #define BS_OUTPUT_BUFFER_LENGTH	80
 
 struct driver_data_t {};
 
-static DEFINE_MUTEX(nb04_wmi_bs_access_lock);
-
-static struct wmi_device *__wmi_dev;
+static struct nb04_wmi_call_ctx wmi_bs_call;
 
 bool nb04_wmi_bs_available(void)
 {
-	if (__wmi_dev)
+	if (wmi_bs_call.wdev)
 		return true;
 	else
 		return false;
 }
 EXPORT_SYMBOL(nb04_wmi_bs_available);
 
-static int __nb04_wmi_bs_method(struct wmi_device *wdev, u32 wmi_method_id,
-				u8 *in, u8 *out)
-{
-	struct acpi_buffer acpi_buffer_in = { (acpi_size)BS_INPUT_BUFFER_LENGTH, in };
-	struct acpi_buffer return_buffer = { ACPI_ALLOCATE_BUFFER, NULL };
-	union acpi_object *acpi_object_out;
-	acpi_status status;
-
-	mutex_lock(&nb04_wmi_bs_access_lock);
-
-	pr_debug("evaluate: %u\n", wmi_method_id);
-	status = wmidev_evaluate_method(wdev, 0, wmi_method_id,
-					&acpi_buffer_in, &return_buffer);
-
-	mutex_unlock(&nb04_wmi_bs_access_lock);
-
-	if (ACPI_FAILURE(status)) {
-		pr_err("failed to evaluate wmi method %u\n", wmi_method_id);
-		return -EIO;
-	}
-
-	acpi_object_out = (union acpi_object *) return_buffer.pointer;
-	if (!acpi_object_out)
-		return -ENODATA;
+static const struct nb04_wmi_result_desc result_buffer = {
+	.type = NB04_WMI_RESULT_BUFFER,
+	.length = BS_OUTPUT_BUFFER_LENGTH,
+	// Returns an int 0 when not finding a valid method number
+	.type_err = -EINVAL,
+	.type_err_quiet = true
+};
 
-	if (acpi_object_out->type != ACPI_TYPE_BUFFER) {
-		// Returns an int 0 when not finding a valid method number
-		kfree(return_buffer.pointer);
-		return -EINVAL;
-	}
+/**
+ * Method interface 8 bytes in 80 bytes out
+ */
+int nb04_wmi_bs_method(u32 wmi_method_id, u8 *in, u8 *out)
+{
+	return nb04_wmi_call(&wmi_bs_call, wmi_method_id, in, BS_INPUT_BUFFER_LENGTH,
+			     &result_buffer, out);
+}
+EXPORT_SYMBOL(nb04_wmi_bs_method);
 
-	if (acpi_object_out->buffer.length != BS_OUTPUT_BUFFER_LENGTH) {
-		pr_err("Unexpected buffer length: %u for method (%u) call\n", 
-		       acpi_object_out->buffer.length, wmi_method_id);
-		kfree(return_buffer.pointer);
-		return -EIO;
-	}
+static BLOCKING_NOTIFIER_HEAD(system_mode_notifier);
 
-	memcpy(out, acpi_object_out->buffer.pointer, BS_OUTPUT_BUFFER_LENGTH);
-	kfree(return_buffer.pointer);
+int nb04_wmi_bs_register_system_mode_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_register(&system_mode_notifier, nb);
+}
+EXPORT_SYMBOL(nb04_wmi_bs_register_system_mode_notifier);
 
-	return 0;
+int nb04_wmi_bs_unregister_system_mode_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_unregister(&system_mode_notifier, nb);
 }
+EXPORT_SYMBOL(nb04_wmi_bs_unregister_system_mode_notifier);
 
 /**
- * Method interface 8 bytes in 80 bytes out
+ * Forward a system mode change done by firmware (e.g. mode hotkey) to the
+ * registered listeners
  */
-int nb04_wmi_bs_method(u32 wmi_method_id, u8 *in, u8 *out)
+void nb04_wmi_bs_system_mode_changed(enum wmi_system_mode mode)
 {
-	if (__wmi_dev)
-		return __nb04_wmi_bs_method(__wmi_dev, wmi_method_id, in, out);
-	else
-		return -ENODEV;
+	blocking_notifier_call_chain(&system_mode_notifier, mode, NULL);
 }
-EXPORT_SYMBOL(nb04_wmi_bs_method);
+EXPORT_SYMBOL(nb04_wmi_bs_system_mode_changed);
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 3, 0)
 static int lwl_nb04_wmi_probe(struct wmi_device *wdev)
@@ -107,6 +97,7 @@ static int lwl_nb04_wmi_probe(struct wmi_device *wdev, const void *dummy_context
 #endif
 {
 	struct driver_data_t *driver_data;
+	int err;
 
 	pr_debug("driver probe\n");
 
@@ -116,14 +107,19 @@ static int lwl_nb04_wmi_probe(struct wmi_device *wdev, const void *dummy_context
 	if (!wmi_has_guid(NB04_WMI_BS_GUID))
 		return -ENODEV;
 
-	__wmi_dev = wdev;
-
 	driver_data = devm_kzalloc(&wdev->dev, sizeof(struct driver_data_t), GFP_KERNEL);
 	if (!driver_data)
 		return -ENOMEM;
 
 	dev_set_drvdata(&wdev->dev, driver_data);
 
+	err = nb04_wmi_call_init(&wmi_bs_call, wdev, BS_INPUT_BUFFER_LENGTH,
+				 BS_OUTPUT_BUFFER_LENGTH, KBUILD_MODNAME);
+	if (err) {
+		wmi_bs_call.wdev = NULL;
+		return err;
+	}
+
 	return 0;
 }
 
@@ -133,6 +129,8 @@ static int lwl_nb04_wmi_remove(struct wmi_device *wdev)
 static void lwl_nb04_wmi_remove(struct wmi_device *wdev)
 #endif
 {
+	nb04_wmi_call_exit(&wmi_bs_call);
+	wmi_bs_call.wdev = NULL;
 	pr_debug("driver remove\n");
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 13, 0)
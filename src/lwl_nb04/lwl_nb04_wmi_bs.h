@@ -47,4 +47,10 @@ enum wmi_return_status {
 bool nb04_wmi_bs_available(void);
 int nb04_wmi_bs_method(u32 wmi_method_id, u8 *in, u8 *out);
 
+// System mode change reported by firmware, notifier data is the wmi_system_mode
+struct notifier_block;
+int nb04_wmi_bs_register_system_mode_notifier(struct notifier_block *nb);
+int nb04_wmi_bs_unregister_system_mode_notifier(struct notifier_block *nb);
+void nb04_wmi_bs_system_mode_changed(enum wmi_system_mode mode);
+
 #endif
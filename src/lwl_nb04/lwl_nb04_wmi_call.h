@@ -0,0 +1,237 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*!
+ * Copyright (c) 2023 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+ *
+ * This file is part of lwl-drivers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef lwl_NB04_WMI_CALL_H
+#define lwl_NB04_WMI_CALL_H
+
+/*
+ * Generic WMI method call engine shared by the NB04 WMI drivers
+ *
+ * Input and output scratch buffers are allocated once per device, the
+ * output one large enough for the largest result of any method. The
+ * result is checked against a descriptor and copied to the caller. Call
+ * counts and latencies are kept per method id and shown in debugfs.
+ *
+ * Users include lwl_trace.h first, every call emits lwl_method_eval.
+ */
+
+#include <linux/acpi.h>
+#include <linux/wmi.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+// Method ids at or above this are accounted in the last slot
+#define NB04_WMI_CALL_STATS_METHODS	16
+
+enum nb04_wmi_result_type {
+	NB04_WMI_RESULT_BUFFER,
+	NB04_WMI_RESULT_INTEGER,
+};
+
+struct nb04_wmi_result_desc {
+	enum nb04_wmi_result_type type;
+	// Exact buffer length for NB04_WMI_RESULT_BUFFER
+	u32 length;
+	// Returned for a result of another type, logged unless quiet
+	int type_err;
+	bool type_err_quiet;
+};
+
+struct nb04_wmi_method_stats {
+	u64 calls;
+	u64 errors;
+	u64 total_us;
+	u64 max_us;
+};
+
+struct nb04_wmi_call_ctx {
+	struct mutex lock;
+	struct wmi_device *wdev;
+	u8 *in_buf;
+	size_t in_size;
+	u8 *out_buf;
+	size_t out_size;
+	struct nb04_wmi_method_stats stats[NB04_WMI_CALL_STATS_METHODS];
+	struct dentry *debugfs_dir;
+};
+
+static int nb04_wmi_call_stats_show(struct seq_file *m, void *unused)
+{
+	struct nb04_wmi_call_ctx *ctx = m->private;
+	struct nb04_wmi_method_stats *st;
+	int i;
+
+	seq_puts(m, "method calls errors avg_us max_us\n");
+	mutex_lock(&ctx->lock);
+	for (i = 0; i < NB04_WMI_CALL_STATS_METHODS; ++i) {
+		st = &ctx->stats[i];
+		if (st->calls == 0)
+			continue;
+		seq_printf(m, "%s%d %llu %llu %llu %llu\n",
+			   i == NB04_WMI_CALL_STATS_METHODS - 1 ? ">=" : "", i,
+			   st->calls, st->errors, div64_u64(st->total_us, st->calls), st->max_us);
+	}
+	mutex_unlock(&ctx->lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(nb04_wmi_call_stats);
+
+/**
+ * Set up the call context of a WMI device, in_size being the largest
+ * input buffer any method of the device takes and out_len the largest
+ * buffer any method returns
+ */
+static int nb04_wmi_call_init(struct nb04_wmi_call_ctx *ctx, struct wmi_device *wdev,
+			      size_t in_size, size_t out_len, const char *debugfs_name)
+{
+	mutex_init(&ctx->lock);
+	ctx->wdev = wdev;
+	ctx->in_size = in_size;
+	// ACPI places the buffer data behind the object, word aligned
+	ctx->out_size = sizeof(union acpi_object) + ALIGN(out_len, sizeof(u64));
+
+	ctx->in_buf = devm_kzalloc(&wdev->dev, ctx->in_size, GFP_KERNEL);
+	ctx->out_buf = devm_kzalloc(&wdev->dev, ctx->out_size, GFP_KERNEL);
+	if (!ctx->in_buf || !ctx->out_buf)
+		return -ENOMEM;
+
+	ctx->debugfs_dir = debugfs_create_dir(debugfs_name, NULL);
+	debugfs_create_file("method_stats", 0444, ctx->debugfs_dir, ctx, &nb04_wmi_call_stats_fops);
+
+	return 0;
+}
+
+static void nb04_wmi_call_exit(struct nb04_wmi_call_ctx *ctx)
+{
+	debugfs_remove_recursive(ctx->debugfs_dir);
+	ctx->debugfs_dir = NULL;
+}
+
+/**
+ * Check the returned object against the descriptor and copy it out
+ */
+static int __nb04_wmi_call_parse(const union acpi_object *obj, u32 wmi_method_id,
+				 const struct nb04_wmi_result_desc *desc, void *out)
+{
+	if (!obj)
+		return -ENODATA;
+
+	switch (desc->type) {
+	case NB04_WMI_RESULT_BUFFER:
+		if (obj->type != ACPI_TYPE_BUFFER) {
+			if (!desc->type_err_quiet)
+				pr_err("No buffer for method (%u) call\n", wmi_method_id);
+			return desc->type_err;
+		}
+		if (obj->buffer.length != desc->length) {
+			pr_err("Unexpected buffer length: %u for method (%u) call\n",
+			       obj->buffer.length, wmi_method_id);
+			return -EIO;
+		}
+		memcpy(out, obj->buffer.pointer, desc->length);
+		return 0;
+	case NB04_WMI_RESULT_INTEGER:
+		if (obj->type != ACPI_TYPE_INTEGER) {
+			if (!desc->type_err_quiet)
+				pr_err("No integer for method (%u) call\n", wmi_method_id);
+			return desc->type_err;
+		}
+		*(u64 *)out = obj->integer.value;
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+/**
+ * Evaluate a WMI method
+ *
+ * The in_len input bytes are copied to the preallocated input buffer,
+ * the rest of the buffer up to in_size is zeroed. The result is written
+ * to out as described by desc.
+ */
+static int nb04_wmi_call(struct nb04_wmi_call_ctx *ctx, u32 wmi_method_id,
+			 const u8 *in, size_t in_len,
+			 const struct nb04_wmi_result_desc *desc, void *out)
+{
+	struct acpi_buffer acpi_buffer_in;
+	struct acpi_buffer return_buffer;
+	struct nb04_wmi_method_stats *st;
+	acpi_status status;
+	ktime_t start;
+	u64 delta_us;
+	u64 trace_arg = 0;
+	int result;
+
+	if (!ctx->wdev)
+		return -ENODEV;
+
+	if (in_len > ctx->in_size)
+		return -EINVAL;
+
+	mutex_lock(&ctx->lock);
+
+	memcpy(ctx->in_buf, in, in_len);
+	memset(ctx->in_buf + in_len, 0, ctx->in_size - in_len);
+	acpi_buffer_in.length = in_len;
+	acpi_buffer_in.pointer = ctx->in_buf;
+	return_buffer.length = ctx->out_size;
+	return_buffer.pointer = ctx->out_buf;
+
+	pr_debug("evaluate: %u\n", wmi_method_id);
+	start = ktime_get();
+	status = wmidev_evaluate_method(ctx->wdev, 0, wmi_method_id,
+					&acpi_buffer_in, &return_buffer);
+	delta_us = ktime_us_delta(ktime_get(), start);
+
+	if (status == AE_BUFFER_OVERFLOW) {
+		// The method already ran, evaluating it again would repeat set commands
+		pr_err("result of wmi method %u larger than %zu bytes\n", wmi_method_id, ctx->out_size);
+		result = -EOVERFLOW;
+	} else if (ACPI_FAILURE(status)) {
+		pr_err("failed to evaluate wmi method %u\n", wmi_method_id);
+		result = -EIO;
+	} else {
+		result = __nb04_wmi_call_parse(return_buffer.pointer, wmi_method_id, desc, out);
+	}
+
+	// First input bytes as argument
+	memcpy(&trace_arg, in, min_t(size_t, in_len, sizeof(trace_arg)));
+	trace_lwl_method_eval(dev_name(&ctx->wdev->dev), wmi_method_id, trace_arg, result, delta_us);
+
+	st = &ctx->stats[min_t(u32, wmi_method_id, NB04_WMI_CALL_STATS_METHODS - 1)];
+	st->calls += 1;
+	if (result)
+		st->errors += 1;
+	st->total_us += delta_us;
+	if (delta_us > st->max_us)
+		st->max_us = delta_us;
+
+	mutex_unlock(&ctx->lock);
+
+	return result;
+}
+
+#endif
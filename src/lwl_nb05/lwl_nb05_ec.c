@@ -26,10 +26,16 @@
 #include <linux/dmi.h>
 #include <linux/acpi.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/string.h>
 #include <asm/io.h>
 #include "lwl_nb05_ec.h"
 #include "../lwl_compatibility_check/lwl_compatibility_check.h"
 
+#define lwl_TRACE_SYSTEM lwl_nb05_ec
+#define CREATE_TRACE_POINTS
+#include "../lwl_trace.h"
+
 static struct nb05_ec_data_t ec_data;
 
 #define EC_PORT_ADDR	0x4e
@@ -56,13 +62,11 @@ static u8 io_read(u8 reg)
 	return inb(EC_PORT_DATA);
 }
 
-void nb05_read_ec_ram(u16 addr, u8 *data)
+static int i2ec_read_ec_ram(u16 addr, u8 *data)
 {
 	u8 addr_high = (addr >> 8) & 0xff;
 	u8 addr_low = (addr & 0xff);
 
-	mutex_lock(&nb05_ec_access_lock);
-
 	io_write(I2EC_REG_ADDR, I2EC_ADDR_HIGH);
 	io_write(I2EC_REG_DATA, addr_high);
 
@@ -72,17 +76,14 @@ void nb05_read_ec_ram(u16 addr, u8 *data)
 	io_write(I2EC_REG_ADDR, I2EC_ADDR_DATA);
 	*data = io_read(I2EC_REG_DATA);
 
-	mutex_unlock(&nb05_ec_access_lock);
+	return 0;
 }
-EXPORT_SYMBOL(nb05_read_ec_ram);
 
-void nb05_write_ec_ram(u16 addr, u8 data)
+static int i2ec_write_ec_ram(u16 addr, u8 data)
 {
 	u8 addr_high = (addr >> 8) & 0xff;
 	u8 addr_low = (addr & 0xff);
 
-	mutex_lock(&nb05_ec_access_lock);
-
 	io_write(I2EC_REG_ADDR, I2EC_ADDR_HIGH);
 	io_write(I2EC_REG_DATA, addr_high);
 
@@ -92,10 +93,182 @@ void nb05_write_ec_ram(u16 addr, u8 data)
 	io_write(I2EC_REG_ADDR, I2EC_ADDR_DATA);
 	io_write(I2EC_REG_DATA, data);
 
+	return 0;
+}
+
+/**
+ * The I2EC address registers keep their value, so the high and low
+ * address bytes are only sent when they differ from the previous write
+ * of the batch.
+ */
+static int i2ec_write_ec_ram_batch(const struct nb05_ec_write_t *writes, int count)
+{
+	int i;
+	u8 addr_high, addr_low;
+	int last_high = -1, last_low = -1;
+
+	for (i = 0; i < count; ++i) {
+		addr_high = (writes[i].addr >> 8) & 0xff;
+		addr_low = (writes[i].addr & 0xff);
+
+		if (addr_high != last_high) {
+			io_write(I2EC_REG_ADDR, I2EC_ADDR_HIGH);
+			io_write(I2EC_REG_DATA, addr_high);
+			last_high = addr_high;
+		}
+
+		if (addr_low != last_low) {
+			io_write(I2EC_REG_ADDR, I2EC_ADDR_LOW);
+			io_write(I2EC_REG_DATA, addr_low);
+			last_low = addr_low;
+		}
+
+		io_write(I2EC_REG_ADDR, I2EC_ADDR_DATA);
+		io_write(I2EC_REG_DATA, writes[i].data);
+	}
+
+	return 0;
+}
+
+static struct nb05_ec_interface_t nb05_ec_interface_i2ec = {
+	.string_id = NB05_EC_INTERFACE_I2EC_STRID,
+	.read_ec_ram = i2ec_read_ec_ram,
+	.write_ec_ram = i2ec_write_ec_ram,
+	.write_ec_ram_batch = i2ec_write_ec_ram_batch,
+};
+
+// Backend all EC accesses go through, protected by nb05_ec_access_lock
+static struct nb05_ec_interface_t *nb05_ec_interface = &nb05_ec_interface_i2ec;
+
+/**
+ * Replace the I/O port backend, e.g. by an emulated EC
+ *
+ * Only one replacement can be bound at a time. The owner has to call
+ * nb05_ec_remove_interface() before it goes away.
+ */
+int nb05_ec_add_interface(struct nb05_ec_interface_t *new_interface)
+{
+	if (IS_ERR_OR_NULL(new_interface) ||
+	    !new_interface->read_ec_ram || !new_interface->write_ec_ram)
+		return -EINVAL;
+
+	mutex_lock(&nb05_ec_access_lock);
+	if (nb05_ec_interface != &nb05_ec_interface_i2ec) {
+		mutex_unlock(&nb05_ec_access_lock);
+		return -EBUSY;
+	}
+	nb05_ec_interface = new_interface;
 	mutex_unlock(&nb05_ec_access_lock);
+
+	pr_info("using EC interface %s\n", new_interface->string_id);
+
+	return 0;
+}
+EXPORT_SYMBOL(nb05_ec_add_interface);
+
+int nb05_ec_remove_interface(struct nb05_ec_interface_t *interface)
+{
+	mutex_lock(&nb05_ec_access_lock);
+	if (interface == &nb05_ec_interface_i2ec || nb05_ec_interface != interface) {
+		mutex_unlock(&nb05_ec_access_lock);
+		return -EINVAL;
+	}
+	nb05_ec_interface = &nb05_ec_interface_i2ec;
+	mutex_unlock(&nb05_ec_access_lock);
+
+	pr_info("using EC interface %s\n", NB05_EC_INTERFACE_I2EC_STRID);
+
+	return 0;
+}
+EXPORT_SYMBOL(nb05_ec_remove_interface);
+
+/**
+ * Copy the id of the active backend into id_str
+ *
+ * The backend may be unregistered right after, so its string is not
+ * handed out.
+ */
+int nb05_ec_get_active_interface_id(char *id_str, size_t size)
+{
+	ssize_t len;
+
+	mutex_lock(&nb05_ec_access_lock);
+	len = strscpy(id_str, nb05_ec_interface->string_id, size);
+	mutex_unlock(&nb05_ec_access_lock);
+
+	return len < 0 ? len : 0;
+}
+EXPORT_SYMBOL(nb05_ec_get_active_interface_id);
+
+void nb05_read_ec_ram(u16 addr, u8 *data)
+{
+	int err;
+	ktime_t start = 0;
+
+	mutex_lock(&nb05_ec_access_lock);
+	// Only timed while the tracepoint is enabled
+	if (trace_lwl_ec_read_enabled())
+		start = ktime_get();
+	err = nb05_ec_interface->read_ec_ram(addr, data);
+	if (start)
+		trace_lwl_ec_read(addr, *data, 0, err, ktime_us_delta(ktime_get(), start));
+	mutex_unlock(&nb05_ec_access_lock);
+
+	if (err) {
+		pr_err("EC read 0x%04x failed: %d\n", addr, err);
+		*data = 0;
+	}
+}
+EXPORT_SYMBOL(nb05_read_ec_ram);
+
+void nb05_write_ec_ram(u16 addr, u8 data)
+{
+	int err;
+	ktime_t start = 0;
+
+	mutex_lock(&nb05_ec_access_lock);
+	if (trace_lwl_ec_write_enabled())
+		start = ktime_get();
+	err = nb05_ec_interface->write_ec_ram(addr, data);
+	if (start)
+		trace_lwl_ec_write(addr, data, 0, err, ktime_us_delta(ktime_get(), start));
+	mutex_unlock(&nb05_ec_access_lock);
+
+	if (err)
+		pr_err("EC write 0x%04x failed: %d\n", addr, err);
 }
 EXPORT_SYMBOL(nb05_write_ec_ram);
 
+/**
+ * Write several EC RAM bytes under one lock hold
+ */
+void nb05_write_ec_ram_batch(const struct nb05_ec_write_t *writes, int count)
+{
+	int i, err = 0;
+	ktime_t start = 0;
+
+	if (count <= 0)
+		return;
+
+	mutex_lock(&nb05_ec_access_lock);
+	if (trace_lwl_ec_write_batch_enabled())
+		start = ktime_get();
+
+	if (nb05_ec_interface->write_ec_ram_batch)
+		err = nb05_ec_interface->write_ec_ram_batch(writes, count);
+	else
+		for (i = 0; i < count && !err; ++i)
+			err = nb05_ec_interface->write_ec_ram(writes[i].addr, writes[i].data);
+
+	if (start)
+		trace_lwl_ec_write_batch(writes[0].addr, count, err, ktime_us_delta(ktime_get(), start));
+	mutex_unlock(&nb05_ec_access_lock);
+
+	if (err)
+		pr_err("EC batch write failed: %d\n", err);
+}
+EXPORT_SYMBOL(nb05_write_ec_ram_batch);
+
 void nb05_read_ec_fw_version(u8 *major, u8 *minor)
 {
 	nb05_read_ec_ram(0x0400, major);
@@ -38,8 +38,33 @@ struct nb05_device_data_t {
 	bool fanctl_onereg;
 };
 
+struct nb05_ec_write_t {
+	u16 addr;
+	u8 data;
+};
+
+#define NB05_EC_INTERFACE_I2EC_STRID	"nb05_i2ec"
+
+/**
+ * EC RAM access backend
+ *
+ * Calls are serialized by the EC module. write_ec_ram_batch is optional,
+ * batches are split into single writes when missing.
+ */
+struct nb05_ec_interface_t {
+	char *string_id;
+	int (*read_ec_ram)(u16 addr, u8 *data);
+	int (*write_ec_ram)(u16 addr, u8 data);
+	int (*write_ec_ram_batch)(const struct nb05_ec_write_t *writes, int count);
+};
+
+int nb05_ec_add_interface(struct nb05_ec_interface_t *new_interface);
+int nb05_ec_remove_interface(struct nb05_ec_interface_t *interface);
+int nb05_ec_get_active_interface_id(char *id_str, size_t size);
+
 void nb05_read_ec_ram(u16 addr, u8 *data);
 void nb05_write_ec_ram(u16 addr, u8 data);
+void nb05_write_ec_ram_batch(const struct nb05_ec_write_t *writes, int count);
 void nb05_read_ec_fw_version(u8 *major, u8 *minor);
 void nb05_get_ec_data(struct nb05_ec_data_t **ec_data);
 
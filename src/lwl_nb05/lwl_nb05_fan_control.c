@@ -25,6 +25,8 @@
 #include <linux/slab.h>
 #include <linux/dmi.h>
 #include <linux/version.h>
+#include <linux/workqueue.h>
+#include <linux/mutex.h>
 #include "lwl_nb05_ec.h"
 
 #define FAN_SET_RPM_MAX 54
@@ -38,10 +40,35 @@
 #define RPM_TO_PWM(rpm_data) ((rpm_data * 0xff) / FAN_SET_RPM_MAX)
 #define DUTY_TO_PWM(duty_data) ((duty_data * 0xff) / FAN_SET_DUTY_MAX)
 
+// Fan tables: 7 regular ranges followed by 2 high temperature ranges
+#define FAN_TABLE_LENGTH 9
+#define FAN_TABLE_HIGHTEMP_START 7
+
+#define FAN1_DUTY_TABLE 0x02c1
+#define FAN1_RPM_TABLE 0x02d0
+#define FAN1_DUTY_ONEREG 0x1809
+#define FAN2_DUTY_TABLE 0x0241
+#define FAN2_RPM_TABLE 0x0250
+
+// Window in which successive pwm writes collapse into the last one
+#define FAN_WRITE_COALESCE_MS 20
+
+struct fan_table_shadow_t {
+	u16 base;
+	u16 valid;
+	u8 values[FAN_TABLE_LENGTH];
+};
+
 struct driver_data_t {
 	struct platform_device *pdev;
 	struct nb05_ec_data_t *ec_data;
 	bool write_rpm;
+	struct mutex fan_lock;
+	struct delayed_work fan_work;
+	int pending_pwm[2];
+	struct fan_table_shadow_t duty_shadow[2];
+	struct fan_table_shadow_t rpm_shadow[2];
+	struct fan_table_shadow_t onereg_shadow;
 };
 
 static ssize_t fan1_pwm_show(struct device *dev,
@@ -72,99 +99,153 @@ static ssize_t fan2_pwm_enable_store(struct device *dev,
 				     struct device_attribute *attr,
 				     const char *buffer, size_t size);
 
-static int write_fan1_rpm(u8 rpm_data);
 static u8 read_fan1_duty_ranges(void);
 static u8 read_fan1_duty_onereg(void);
-static int write_fan1_duty_ranges(u8 rpm_data);
-static int write_fan1_duty_onereg(u8 rpm_data);
 static bool read_fan1_enable_ranges(void);
 static bool read_fan1_enable_onereg(void);
 static int write_fan1_enable_ranges(bool enable_data);
 static int write_fan1_enable_onereg(bool enable_data);
-static int write_fan2_rpm(u8 rpm_data);
 static u8 read_fan2_duty(void);
-static int write_fan2_duty(u8 rpm_data);
 static bool read_fan2_enable(void);
 static int write_fan2_enable(bool enable_data);
 
-static int write_fan1_rpm(u8 rpm_data)
+/**
+ * Fill the values of a fan table for one speed value
+ *
+ * Values between fan-off and minimum fan-on-speed are not allowed, the high
+ * temperature ranges get at least hightemp_min.
+ */
+static int fan_table_values(u8 data, u8 max, u8 hightemp_min, u8 *values, int length)
 {
-	int reg;
+	int i;
 
-	if (rpm_data > FAN_SET_RPM_MAX)
+	if (data > max)
 		return -EINVAL;
 
 	// Don't allow vallues between fan-off and minimum fan-on-speed
-	if (rpm_data < FAN_ON_MIN_SPEED_PERCENT * FAN_SET_RPM_MAX / 2 / 100)
-		rpm_data = 0;
-	else if (rpm_data < FAN_ON_MIN_SPEED_PERCENT * FAN_SET_RPM_MAX / 100)
-		rpm_data = FAN_ON_MIN_SPEED_PERCENT * FAN_SET_RPM_MAX / 100;
-
-	for (reg = 0x02d0; reg <= 0x02d6; ++reg)
-		nb05_write_ec_ram(reg, rpm_data);
-
-	if (rpm_data < FAN_SET_RPM_HIGHTEMP)
-		rpm_data = FAN_SET_RPM_HIGHTEMP;
-
-	nb05_write_ec_ram(0x02d7, rpm_data);
-	nb05_write_ec_ram(0x02d8, rpm_data);
+	if (data < FAN_ON_MIN_SPEED_PERCENT * max / 2 / 100)
+		data = 0;
+	else if (data < FAN_ON_MIN_SPEED_PERCENT * max / 100)
+		data = FAN_ON_MIN_SPEED_PERCENT * max / 100;
+
+	for (i = 0; i < length; ++i) {
+		if (i == FAN_TABLE_HIGHTEMP_START && data < hightemp_min)
+			data = hightemp_min;
+		values[i] = data;
+	}
 
 	return 0;
 }
 
-static u8 read_fan1_duty_ranges(void)
+/**
+ * Append writes for the table entries that differ from what was last written
+ */
+static void fan_table_queue(struct fan_table_shadow_t *shadow, const u8 *values, int length,
+			    struct nb05_ec_write_t *writes, int *count)
 {
-	u8 duty_data;
-	nb05_read_ec_ram(0x2c1, &duty_data);
-	return duty_data;
+	int i;
+
+	for (i = 0; i < length; ++i) {
+		if ((shadow->valid & (1 << i)) && shadow->values[i] == values[i])
+			continue;
+		writes[*count].addr = shadow->base + i;
+		writes[*count].data = values[i];
+		*count += 1;
+		shadow->values[i] = values[i];
+		shadow->valid |= (1 << i);
+	}
 }
 
-static u8 read_fan1_duty_onereg(void)
+static void fan_shadows_invalidate(struct driver_data_t *driver_data)
 {
-	u8 duty_data;
-	nb05_read_ec_ram(0x1809, &duty_data);
-	return duty_data;
+	int i;
+
+	for (i = 0; i < 2; ++i) {
+		driver_data->duty_shadow[i].valid = 0;
+		driver_data->rpm_shadow[i].valid = 0;
+	}
+	driver_data->onereg_shadow.valid = 0;
 }
 
-static int write_fan1_duty_ranges(u8 duty_data)
+/**
+ * Write the latest pending pwm values of both fans in one batch
+ */
+static void fan_write_work_func(struct work_struct *work)
 {
-	int reg;
-
-	if (duty_data > FAN_SET_DUTY_MAX)
-		return -EINVAL;
-
-	// Don't allow vallues between fan-off and minimum fan-on-speed
-	if (duty_data < FAN_ON_MIN_SPEED_PERCENT * FAN_SET_DUTY_MAX / 2 / 100)
-		duty_data = 0;
-	else if (duty_data < FAN_ON_MIN_SPEED_PERCENT * FAN_SET_DUTY_MAX / 100)
-		duty_data = FAN_ON_MIN_SPEED_PERCENT * FAN_SET_DUTY_MAX / 100;
+	struct driver_data_t *driver_data =
+		container_of(to_delayed_work(work), struct driver_data_t, fan_work);
+	struct nb05_ec_write_t writes[2 * 2 * FAN_TABLE_LENGTH];
+	u8 values[FAN_TABLE_LENGTH];
+	int fan, pwm_data, count = 0;
+
+	mutex_lock(&driver_data->fan_lock);
+
+	for (fan = 0; fan < 2; ++fan) {
+		pwm_data = driver_data->pending_pwm[fan];
+		if (pwm_data < 0)
+			continue;
+		driver_data->pending_pwm[fan] = -1;
+
+		if (fan == 0 && driver_data->ec_data->dev_data->fanctl_onereg) {
+			fan_table_values(PWM_TO_DUTY(pwm_data), FAN_SET_DUTY_MAX, 0, values, 1);
+			fan_table_queue(&driver_data->onereg_shadow, values, 1, writes, &count);
+		} else {
+			fan_table_values(PWM_TO_DUTY(pwm_data), FAN_SET_DUTY_MAX, FAN_SET_DUTY_HIGHTEMP,
+					 values, FAN_TABLE_LENGTH);
+			fan_table_queue(&driver_data->duty_shadow[fan], values, FAN_TABLE_LENGTH,
+					writes, &count);
+		}
+
+		if (driver_data->write_rpm) {
+			fan_table_values(PWM_TO_RPM(pwm_data), FAN_SET_RPM_MAX, FAN_SET_RPM_HIGHTEMP,
+					 values, FAN_TABLE_LENGTH);
+			fan_table_queue(&driver_data->rpm_shadow[fan], values, FAN_TABLE_LENGTH,
+					writes, &count);
+		}
+	}
 
-	for (reg = 0x02c1; reg <= 0x02c7; ++reg)
-		nb05_write_ec_ram(reg, duty_data);
+	if (count > 0)
+		nb05_write_ec_ram_batch(writes, count);
 
-	if (duty_data < FAN_SET_DUTY_HIGHTEMP)
-		duty_data = FAN_SET_DUTY_HIGHTEMP;
+	mutex_unlock(&driver_data->fan_lock);
+}
 
-	nb05_write_ec_ram(0x02c8, duty_data);
-	nb05_write_ec_ram(0x02c9, duty_data);
+static void fan_queue_pwm(struct driver_data_t *driver_data, int fan, u8 pwm_data)
+{
+	mutex_lock(&driver_data->fan_lock);
+	driver_data->pending_pwm[fan] = pwm_data;
+	mutex_unlock(&driver_data->fan_lock);
 
-	return 0;
+	// Does not re-arm an already pending write, later values are picked up by it
+	schedule_delayed_work(&driver_data->fan_work, msecs_to_jiffies(FAN_WRITE_COALESCE_MS));
 }
 
-static int write_fan1_duty_onereg(u8 duty_data)
+/**
+ * Pending pwm value of a fan or -1 if none is queued
+ */
+static int fan_pending_pwm(struct driver_data_t *driver_data, int fan)
 {
-	if (duty_data > FAN_SET_DUTY_MAX)
-		return -EINVAL;
+	int pwm_data;
 
-	// Don't allow vallues between fan-off and minimum fan-on-speed
-	if (duty_data < FAN_ON_MIN_SPEED_PERCENT * FAN_SET_DUTY_MAX / 2 / 100)
-		duty_data = 0;
-	else if (duty_data < FAN_ON_MIN_SPEED_PERCENT * FAN_SET_DUTY_MAX / 100)
-		duty_data = FAN_ON_MIN_SPEED_PERCENT * FAN_SET_DUTY_MAX / 100;
+	mutex_lock(&driver_data->fan_lock);
+	pwm_data = driver_data->pending_pwm[fan];
+	mutex_unlock(&driver_data->fan_lock);
 
-	nb05_write_ec_ram(0x1809, duty_data);
+	return pwm_data;
+}
 
-	return 0;
+static u8 read_fan1_duty_ranges(void)
+{
+	u8 duty_data;
+	nb05_read_ec_ram(0x2c1, &duty_data);
+	return duty_data;
+}
+
+static u8 read_fan1_duty_onereg(void)
+{
+	u8 duty_data;
+	nb05_read_ec_ram(0x1809, &duty_data);
+	return duty_data;
 }
 
 static bool read_fan1_enable_ranges(void)
@@ -195,31 +276,6 @@ static int write_fan1_enable_onereg(bool enable)
 	return 0;
 }
 
-static int write_fan2_rpm(u8 rpm_data)
-{
-	int reg;
-
-	if (rpm_data > FAN_SET_RPM_MAX)
-		return -EINVAL;
-
-	// Don't allow vallues between fan-off and minimum fan-on-speed
-	if (rpm_data < FAN_ON_MIN_SPEED_PERCENT * FAN_SET_RPM_MAX / 2 / 100)
-		rpm_data = 0;
-	else if (rpm_data < FAN_ON_MIN_SPEED_PERCENT * FAN_SET_RPM_MAX / 100)
-		rpm_data = FAN_ON_MIN_SPEED_PERCENT * FAN_SET_RPM_MAX / 100;
-
-	for (reg = 0x0250; reg <= 0x0256; ++reg)
-		nb05_write_ec_ram(reg, rpm_data);
-
-	if (rpm_data < FAN_SET_RPM_HIGHTEMP)
-		rpm_data = FAN_SET_RPM_HIGHTEMP;
-
-	nb05_write_ec_ram(0x0257, rpm_data);
-	nb05_write_ec_ram(0x0258, rpm_data);
-
-	return 0;
-}
-
 static u8 read_fan2_duty(void)
 {
 	u8 rpm_data;
@@ -227,31 +283,6 @@ static u8 read_fan2_duty(void)
 	return rpm_data;
 }
 
-static int write_fan2_duty(u8 duty_data)
-{
-	int reg;
-
-	if (duty_data > FAN_SET_DUTY_MAX)
-		return -EINVAL;
-
-	// Don't allow vallues between fan-off and minimum fan-on-speed
-	if (duty_data < FAN_ON_MIN_SPEED_PERCENT * FAN_SET_DUTY_MAX / 2 / 100)
-		duty_data = 0;
-	else if (duty_data < FAN_ON_MIN_SPEED_PERCENT * FAN_SET_DUTY_MAX / 100)
-		duty_data = FAN_ON_MIN_SPEED_PERCENT * FAN_SET_DUTY_MAX / 100;
-
-	for (reg = 0x0241; reg <= 0x0247; ++reg)
-		nb05_write_ec_ram(reg, duty_data);
-
-	if (duty_data < FAN_SET_DUTY_HIGHTEMP)
-		duty_data = FAN_SET_DUTY_HIGHTEMP;
-
-	nb05_write_ec_ram(0x0248, duty_data);
-	nb05_write_ec_ram(0x0249, duty_data);
-
-	return 0;
-}
-
 static bool read_fan2_enable(void)
 {
 	u8 enable_data;
@@ -311,6 +342,10 @@ static ssize_t fan1_pwm_show(struct device *dev,
 {
 	struct driver_data_t *driver_data = dev_get_drvdata(dev);
 	u8 pwm_data, duty_data;
+	int pending = fan_pending_pwm(driver_data, 0);
+
+	if (pending >= 0)
+		return sysfs_emit(buffer, "%d\n", pending);
 
 	if (driver_data->ec_data->dev_data->fanctl_onereg)
 		duty_data = read_fan1_duty_onereg();
@@ -327,29 +362,13 @@ static ssize_t fan1_pwm_store(struct device *dev,
 			      struct device_attribute *attr,
 			      const char *buffer, size_t size)
 {
-	u8 pwm_data, rpm_data, duty_data;
-	int err;
+	u8 pwm_data;
 	struct driver_data_t *driver_data = dev_get_drvdata(dev);
 
 	if (kstrtou8(buffer, 0, &pwm_data))
 		return -EINVAL;
 
-	duty_data = PWM_TO_DUTY(pwm_data);
-	rpm_data = PWM_TO_RPM(pwm_data);
-
-	if (driver_data->ec_data->dev_data->fanctl_onereg)
-		err = write_fan1_duty_onereg(duty_data);
-	else
-		err = write_fan1_duty_ranges(duty_data);
-
-	if (err)
-		return err;
-
-	if (driver_data->write_rpm) {
-		err = write_fan1_rpm(rpm_data);
-		if (err)
-			return err;
-	}
+	fan_queue_pwm(driver_data, 0, pwm_data);
 
 	return size;
 }
@@ -393,6 +412,12 @@ static ssize_t fan1_pwm_enable_store(struct device *dev,
 	else
 		enable_data = true;
 
+	// Write pending speeds first, the EC may reset its tables on mode change
+	flush_delayed_work(&driver_data->fan_work);
+	mutex_lock(&driver_data->fan_lock);
+	fan_shadows_invalidate(driver_data);
+	mutex_unlock(&driver_data->fan_lock);
+
 	if (driver_data->ec_data->dev_data->fanctl_onereg)
 		err = write_fan1_enable_onereg(enable_data);
 	else
@@ -407,7 +432,13 @@ static ssize_t fan1_pwm_enable_store(struct device *dev,
 static ssize_t fan2_pwm_show(struct device *dev,
 			     struct device_attribute *attr, char *buffer)
 {
+	struct driver_data_t *driver_data = dev_get_drvdata(dev);
 	u8 pwm_data, duty_data;
+	int pending = fan_pending_pwm(driver_data, 1);
+
+	if (pending >= 0)
+		return sysfs_emit(buffer, "%d\n", pending);
+
 	duty_data = read_fan2_duty();
 	pwm_data = DUTY_TO_PWM(duty_data);
 	sysfs_emit(buffer, "%d\n", pwm_data);
@@ -418,26 +449,14 @@ static ssize_t fan2_pwm_show(struct device *dev,
 static ssize_t fan2_pwm_store(struct device *dev,
 			      struct device_attribute *attr,
 			      const char *buffer, size_t size)
-{	
-	u8 pwm_data, rpm_data, duty_data;
-	int err;
+{
+	u8 pwm_data;
 	struct driver_data_t *driver_data = dev_get_drvdata(dev);
 
 	if (kstrtou8(buffer, 0, &pwm_data))
 		return -EINVAL;
 
-	duty_data = PWM_TO_DUTY(pwm_data);
-	rpm_data = PWM_TO_RPM(pwm_data);
-
-	err = write_fan2_duty(duty_data);
-	if (err)
-		return err;
-
-	if (driver_data->write_rpm) {
-		err = write_fan2_rpm(rpm_data);
-		if (err)
-			return err;
-	}
+	fan_queue_pwm(driver_data, 1, pwm_data);
 
 	return size;
 }
@@ -462,6 +481,7 @@ static ssize_t fan2_pwm_enable_store(struct device *dev,
 				     struct device_attribute *attr,
 				     const char *buffer, size_t size)
 {
+	struct driver_data_t *driver_data = dev_get_drvdata(dev);
 	bool enable_data;
 	u8 enable_hwmon;
 	int err;
@@ -474,6 +494,11 @@ static ssize_t fan2_pwm_enable_store(struct device *dev,
 	else
 		enable_data = true;
 
+	flush_delayed_work(&driver_data->fan_work);
+	mutex_lock(&driver_data->fan_lock);
+	fan_shadows_invalidate(driver_data);
+	mutex_unlock(&driver_data->fan_lock);
+
 	err = write_fan2_enable(enable_data);
 	if (err)
 		return err;
@@ -505,6 +530,16 @@ static int __init lwl_nb05_fan_control_probe(struct platform_device *pdev)
 			driver_data->write_rpm = true;
 	}
 
+	mutex_init(&driver_data->fan_lock);
+	INIT_DELAYED_WORK(&driver_data->fan_work, fan_write_work_func);
+	driver_data->pending_pwm[0] = -1;
+	driver_data->pending_pwm[1] = -1;
+	driver_data->duty_shadow[0].base = FAN1_DUTY_TABLE;
+	driver_data->duty_shadow[1].base = FAN2_DUTY_TABLE;
+	driver_data->rpm_shadow[0].base = FAN1_RPM_TABLE;
+	driver_data->rpm_shadow[1].base = FAN2_RPM_TABLE;
+	driver_data->onereg_shadow.base = FAN1_DUTY_ONEREG;
+
 	err = sysfs_create_group(&driver_data->pdev->dev.kobj, &fan_control_attr_group);
 	if (err) {
 		pr_err("create group failed\n");
@@ -524,14 +559,43 @@ static void lwl_nb05_fan_control_remove(struct platform_device *pdev)
 	pr_debug("driver remove\n");
 	struct driver_data_t *driver_data = dev_get_drvdata(&pdev->dev);
 	sysfs_remove_group(&driver_data->pdev->dev.kobj, &fan_control_attr_group);
+	flush_delayed_work(&driver_data->fan_work);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0)
 	return 0;
 #endif
 }
 
+static int lwl_nb05_fan_control_suspend(struct device *dev)
+{
+	struct driver_data_t *driver_data = dev_get_drvdata(dev);
+
+	flush_delayed_work(&driver_data->fan_work);
+
+	return 0;
+}
+
+/**
+ * The EC is back at its default tables after resume, so nothing written
+ * before may be skipped
+ */
+static int lwl_nb05_fan_control_resume(struct device *dev)
+{
+	struct driver_data_t *driver_data = dev_get_drvdata(dev);
+
+	mutex_lock(&driver_data->fan_lock);
+	fan_shadows_invalidate(driver_data);
+	mutex_unlock(&driver_data->fan_lock);
+
+	return 0;
+}
+
+static SIMPLE_DEV_PM_OPS(lwl_nb05_fan_control_pm_ops, lwl_nb05_fan_control_suspend,
+			 lwl_nb05_fan_control_resume);
+
 static struct platform_device *lwl_nb05_fan_control_device;
 static struct platform_driver lwl_nb05_fan_control_driver = {
 	.driver.name = "lwl_fan_control",
+	.driver.pm = &lwl_nb05_fan_control_pm_ops,
 	.remove = lwl_nb05_fan_control_remove,
 };
 
@@ -29,7 +29,13 @@
 #include <linux/delay.h>
 #include <linux/platform_device.h>
 #include <linux/timer.h>
+#include <linux/ktime.h>
 #include "lwl_nb05_power_profiles.h"
+#include "../lwl_platform_profile.h"
+
+#define lwl_TRACE_SYSTEM lwl_nb05_power_profiles
+#define CREATE_TRACE_POINTS
+#include "../lwl_trace.h"
 #include "../lwl_compatibility_check/lwl_compatibility_check.h"
 
 #define dev_to_wdev(__dev)	container_of(__dev, struct wmi_device, dev)
@@ -41,6 +47,7 @@ static DEFINE_MUTEX(nb05_wmi_aa_access_lock);
 struct driver_data_t {
 	struct platform_device *pdev;
 	u64 last_chosen_profile;
+	struct lwl_platform_profile pp;
 };
 
 static struct wmi_device *__wmi_dev;
@@ -81,12 +88,19 @@ static int __nb05_wmi_aa_method(struct wmi_device *wdev, u32 wmi_method_id,
 	struct acpi_buffer return_buffer = { ACPI_ALLOCATE_BUFFER, NULL };
 	union acpi_object *acpi_object_out;
 	acpi_status status;
+	ktime_t start = 0;
 
 	mutex_lock(&nb05_wmi_aa_access_lock);
 
 	pr_debug("evaluate: %u\n", wmi_method_id);
+	if (trace_lwl_method_eval_enabled())
+		start = ktime_get();
 	status = wmidev_evaluate_method(wdev, 0, wmi_method_id,
 					&acpi_buffer_in, &return_buffer);
+	if (start)
+		trace_lwl_method_eval(NB05_WMI_METHOD_BA_GUID, wmi_method_id, *in,
+				      ACPI_FAILURE(status) ? -EIO : 0,
+				      ktime_us_delta(ktime_get(), start));
 
 	mutex_unlock(&nb05_wmi_aa_access_lock);
 
@@ -142,16 +156,58 @@ static int read_profile(u64 *profile)
 	return 0;
 }
 
+static const struct lwl_platform_profile_map platform_profile_map[] = {
+	{ .profile = PLATFORM_PROFILE_LOW_POWER,	.native = 2 },
+	{ .profile = PLATFORM_PROFILE_BALANCED,		.native = 0 },
+	{ .profile = PLATFORM_PROFILE_PERFORMANCE,	.native = 1 },
+};
+
+static int platform_profile_get_native(void *drvdata, u64 *native)
+{
+	return read_profile(native);
+}
+
+static int platform_profile_set_native(void *drvdata, u64 native)
+{
+	struct driver_data_t *driver_data = drvdata;
+	int err;
+
+	err = write_profile(native);
+	if (err)
+		return err;
+
+	driver_data->last_chosen_profile = native;
+
+	return 0;
+}
+
+static const struct lwl_platform_profile_ops platform_profile_ops = {
+	.get = platform_profile_get_native,
+	.set = platform_profile_set_native,
+};
+
 static ssize_t platform_profile_choices_show(struct device *dev,
 					     struct device_attribute *attr,
-					     char *buffer);
+					     char *buffer)
+{
+	struct driver_data_t *driver_data = dev_get_drvdata(&__wmi_dev->dev);
+	return lwl_platform_profile_choices_show(&driver_data->pp, buffer);
+}
 
 static ssize_t platform_profile_show(struct device *dev,
-				     struct device_attribute *attr, char *buffer);
+				     struct device_attribute *attr, char *buffer)
+{
+	struct driver_data_t *driver_data = dev_get_drvdata(&__wmi_dev->dev);
+	return lwl_platform_profile_show(&driver_data->pp, buffer);
+}
 
 static ssize_t platform_profile_store(struct device *dev,
 				      struct device_attribute *attr,
-				      const char *buffer, size_t size);
+				      const char *buffer, size_t size)
+{
+	struct driver_data_t *driver_data = dev_get_drvdata(&__wmi_dev->dev);
+	return lwl_platform_profile_store(&driver_data->pp, buffer, size);
+}
 
 struct platform_profile_attrs_t {
 	struct device_attribute platform_profile_choices;
@@ -175,58 +231,6 @@ static struct attribute_group platform_profile_attr_group = {
 	.attrs = platform_profile_attrs_list
 };
 
-struct char_to_value_t {
-	char* descriptor;
-	u64 value;
-};
-
-static struct char_to_value_t platform_profile_options[] = {
-	{ .descriptor = "low-power",		.value = 2 },
-	{ .descriptor = "balanced",		.value = 0 },
-	{ .descriptor = "performance",		.value = 1 }
-};
-
-static ssize_t platform_profile_choices_show(struct device *dev,
-					     struct device_attribute *attr,
-					     char *buffer)
-{
-	int i, n;
-	n = ARRAY_SIZE(platform_profile_options);
-	for (i = 0; i < n; ++i) {
-		sprintf(buffer + strlen(buffer), "%s",
-			platform_profile_options[i].descriptor);
-		if (i < n - 1)
-			sprintf(buffer + strlen(buffer), " ");
-		else
-			sprintf(buffer + strlen(buffer), "\n");
-	}
-
-	return strlen(buffer);
-}
-
-static ssize_t platform_profile_show(struct device *dev,
-				     struct device_attribute *attr, char *buffer)
-{
-	u64 platform_profile_value;
-	int i, err;
-
-	err = read_profile(&platform_profile_value);
-	if (err) {
-		pr_err("Error reading power profile");
-		return -EIO;
-	}
-
-	for (i = 0; i < ARRAY_SIZE(platform_profile_options); ++i)
-		if (platform_profile_options[i].value == platform_profile_value) {
-			sprintf(buffer, "%s\n", platform_profile_options[i].descriptor);
-			return strlen(buffer);
-		}
-
-	pr_err("Read platform profile value not matched to a descriptor\n");
-
-	return -EIO;
-}
-
 static int rewrite_last_profile_internal(void)
 {
 	struct driver_data_t *driver_data = dev_get_drvdata(&__wmi_dev->dev);
@@ -241,6 +245,9 @@ static int rewrite_last_profile_internal(void)
 		err = write_profile(driver_data->last_chosen_profile);
 		if (err)
 			return err;
+		// Firmware switched the profile on its own, let listeners
+		// re-read the restored one
+		lwl_platform_profile_notify(&driver_data->pp);
 	}
 
 	return 0;
@@ -258,44 +265,6 @@ bool profile_changed_by_driver(void)
 }
 EXPORT_SYMBOL(profile_changed_by_driver);
 
-static ssize_t platform_profile_store(struct device *dev,
-				      struct device_attribute *attr,
-				      const char *buffer, size_t size)
-{
-	struct platform_device *pdev = to_platform_device(dev);
-	struct wmi_device *wdev = dev_to_wdev(pdev->dev.parent);
-	struct driver_data_t *driver_data = dev_get_drvdata(&wdev->dev);
-	u64 platform_profile_value;
-	int i, err;
-	char *buffer_copy;
-	char *platform_profile_descriptor;
-
-	buffer_copy = kmalloc(size + 1, GFP_KERNEL);
-	strcpy(buffer_copy, buffer);
-	platform_profile_descriptor = strstrip(buffer_copy);
-
-	for (i = 0; i < ARRAY_SIZE(platform_profile_options); ++i)
-		if (strcmp(platform_profile_options[i].descriptor, platform_profile_descriptor) == 0) {
-			platform_profile_value = platform_profile_options[i].value;
-			break;
-		}
-
-	kfree(buffer_copy);
-
-	if (i < ARRAY_SIZE(platform_profile_options)) {
-		// Option found try to set
-		err = write_profile(platform_profile_value);
-		if (err)
-			return err;
-		
-		driver_data->last_chosen_profile = platform_profile_value;
-		return size;
-	} else {
-		// Invalid input, not matched to an option
-		return -EINVAL;
-	}
-}
-
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 3, 0)
 static int lwl_nb05_power_profiles_probe(struct wmi_device *wdev)
 #else
@@ -321,6 +290,12 @@ static int lwl_nb05_power_profiles_probe(struct wmi_device *wdev, const void *du
 
 	dev_set_drvdata(&wdev->dev, driver_data);
 
+	driver_data->pp.name = "lwl-nb05";
+	driver_data->pp.map = platform_profile_map;
+	driver_data->pp.map_size = ARRAY_SIZE(platform_profile_map);
+	driver_data->pp.ops = &platform_profile_ops;
+	driver_data->pp.drvdata = driver_data;
+
 	// Initialize last chosen profile
 	err = read_profile(&driver_data->last_chosen_profile);
 	if (err) {
@@ -347,6 +322,10 @@ static int lwl_nb05_power_profiles_probe(struct wmi_device *wdev, const void *du
 		return err;
 	}
 
+	err = lwl_platform_profile_register(&driver_data->pp, &driver_data->pdev->dev);
+	if (err)
+		pr_debug("platform_profile handler not registered: %d\n", err);
+
 	return 0;
 }
 
@@ -359,6 +338,8 @@ static void lwl_nb05_power_profiles_remove(struct wmi_device *wdev)
 	pr_debug("driver remove\n");
 	del_timer(&profile_changed_timer);
 	struct driver_data_t *driver_data = dev_get_drvdata(&wdev->dev);
+	cancel_work_sync(&nb05_rewrite_profile_work);
+	lwl_platform_profile_unregister(&driver_data->pp);
 	sysfs_remove_group(&driver_data->pdev->dev.kobj, &platform_profile_attr_group);
 	platform_device_unregister(driver_data->pdev);
 
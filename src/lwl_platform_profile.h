@@ -0,0 +1,329 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*!
+ * Copyright (c) 2024 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+ *
+ * This file is part of lwl-drivers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef lwl_PLATFORM_PROFILE_H
+#define lwl_PLATFORM_PROFILE_H
+
+/*
+ * platform_profile provider layer
+ *
+ * A backend describes its native power modes by a map to the standard
+ * kernel profiles and provides get/set of the native value. The layer
+ * registers the kernel platform_profile handler so that power-profiles-daemon
+ * works the same on all devices, and provides show/store helpers for the
+ * drivers' own platform_profile attributes. Backends call
+ * lwl_platform_profile_notify() when firmware reports a mode change.
+ */
+
+#include <linux/kernel.h>
+#include <linux/device.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/version.h>
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 12, 0)
+#include <linux/platform_profile.h>
+#define lwl_PLATFORM_PROFILE_KERNEL	IS_REACHABLE(CONFIG_ACPI_PLATFORM_PROFILE)
+#else
+enum platform_profile_option {
+	PLATFORM_PROFILE_LOW_POWER,
+	PLATFORM_PROFILE_COOL,
+	PLATFORM_PROFILE_QUIET,
+	PLATFORM_PROFILE_BALANCED,
+	PLATFORM_PROFILE_BALANCED_PERFORMANCE,
+	PLATFORM_PROFILE_PERFORMANCE,
+	PLATFORM_PROFILE_LAST,
+};
+#define lwl_PLATFORM_PROFILE_KERNEL	0
+#endif
+
+static const char * const lwl_platform_profile_names[] = {
+	[PLATFORM_PROFILE_LOW_POWER] = "low-power",
+	[PLATFORM_PROFILE_COOL] = "cool",
+	[PLATFORM_PROFILE_QUIET] = "quiet",
+	[PLATFORM_PROFILE_BALANCED] = "balanced",
+	[PLATFORM_PROFILE_BALANCED_PERFORMANCE] = "balanced-performance",
+	[PLATFORM_PROFILE_PERFORMANCE] = "performance",
+};
+
+struct lwl_platform_profile_map {
+	enum platform_profile_option profile;
+	u64 native;
+};
+
+struct lwl_platform_profile_ops {
+	int (*get)(void *drvdata, u64 *native);
+	int (*set)(void *drvdata, u64 native);
+};
+
+struct lwl_platform_profile {
+	const char *name;
+	// Native modes in the order they are listed in platform_profile_choices
+	const struct lwl_platform_profile_map *map;
+	unsigned int map_size;
+	const struct lwl_platform_profile_ops *ops;
+	void *drvdata;
+	bool registered;
+#if lwl_PLATFORM_PROFILE_KERNEL
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 14, 0)
+	struct platform_profile_handler handler;
+#else
+	struct device *ppdev;
+#endif
+#endif
+};
+
+static int lwl_platform_profile_to_native(const struct lwl_platform_profile *pp,
+					  enum platform_profile_option profile, u64 *native)
+{
+	unsigned int i;
+
+	for (i = 0; i < pp->map_size; ++i)
+		if (pp->map[i].profile == profile) {
+			*native = pp->map[i].native;
+			return 0;
+		}
+
+	return -EOPNOTSUPP;
+}
+
+static int lwl_platform_profile_from_native(const struct lwl_platform_profile *pp,
+					    u64 native, enum platform_profile_option *profile)
+{
+	unsigned int i;
+
+	for (i = 0; i < pp->map_size; ++i)
+		if (pp->map[i].native == native) {
+			*profile = pp->map[i].profile;
+			return 0;
+		}
+
+	pr_err("%s: native profile value %llu not mapped\n", pp->name, native);
+
+	return -EIO;
+}
+
+static int lwl_platform_profile_get(struct lwl_platform_profile *pp,
+				    enum platform_profile_option *profile)
+{
+	u64 native;
+	int err;
+
+	err = pp->ops->get(pp->drvdata, &native);
+	if (err)
+		return err;
+
+	return lwl_platform_profile_from_native(pp, native, profile);
+}
+
+// Only used by the kernel handler, which may be compiled out
+static int __attribute__ ((unused)) lwl_platform_profile_set(struct lwl_platform_profile *pp,
+							     enum platform_profile_option profile)
+{
+	u64 native;
+	int err;
+
+	err = lwl_platform_profile_to_native(pp, profile, &native);
+	if (err)
+		return err;
+
+	return pp->ops->set(pp->drvdata, native);
+}
+
+#if lwl_PLATFORM_PROFILE_KERNEL
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 14, 0)
+static int lwl_platform_profile_handler_get(struct platform_profile_handler *pprof,
+					    enum platform_profile_option *profile)
+{
+	struct lwl_platform_profile *pp = container_of(pprof, struct lwl_platform_profile, handler);
+	return lwl_platform_profile_get(pp, profile);
+}
+
+static int lwl_platform_profile_handler_set(struct platform_profile_handler *pprof,
+					    enum platform_profile_option profile)
+{
+	struct lwl_platform_profile *pp = container_of(pprof, struct lwl_platform_profile, handler);
+	return lwl_platform_profile_set(pp, profile);
+}
+#else
+static int lwl_platform_profile_ops_probe(void *drvdata, unsigned long *choices)
+{
+	struct lwl_platform_profile *pp = drvdata;
+	unsigned int i;
+
+	for (i = 0; i < pp->map_size; ++i)
+		set_bit(pp->map[i].profile, choices);
+
+	return 0;
+}
+
+static int lwl_platform_profile_ops_get(struct device *dev,
+					enum platform_profile_option *profile)
+{
+	return lwl_platform_profile_get(dev_get_drvdata(dev), profile);
+}
+
+static int lwl_platform_profile_ops_set(struct device *dev,
+					enum platform_profile_option profile)
+{
+	return lwl_platform_profile_set(dev_get_drvdata(dev), profile);
+}
+
+static const struct platform_profile_ops lwl_platform_profile_kernel_ops = {
+	.probe = lwl_platform_profile_ops_probe,
+	.profile_get = lwl_platform_profile_ops_get,
+	.profile_set = lwl_platform_profile_ops_set,
+};
+#endif
+#endif
+
+/**
+ * Register the kernel platform_profile handler for a backend
+ *
+ * Fails with -EOPNOTSUPP when the kernel has no platform_profile support.
+ * Kernels before 6.14 accept only one handler system wide, the drivers'
+ * own attributes keep working when registration fails.
+ */
+static int lwl_platform_profile_register(struct lwl_platform_profile *pp, struct device *parent)
+{
+#if lwl_PLATFORM_PROFILE_KERNEL
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 14, 0)
+	unsigned int i;
+	int err;
+
+	memset(&pp->handler, 0, sizeof(pp->handler));
+	for (i = 0; i < pp->map_size; ++i)
+		set_bit(pp->map[i].profile, pp->handler.choices);
+	pp->handler.profile_get = lwl_platform_profile_handler_get;
+	pp->handler.profile_set = lwl_platform_profile_handler_set;
+
+	err = platform_profile_register(&pp->handler);
+	if (err)
+		return err;
+#else
+	pp->ppdev = platform_profile_register(parent, pp->name, pp,
+					      &lwl_platform_profile_kernel_ops);
+	if (IS_ERR(pp->ppdev))
+		return PTR_ERR(pp->ppdev);
+#endif
+	pp->registered = true;
+	pr_debug("%s: platform_profile handler registered\n", pp->name);
+
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+static void lwl_platform_profile_unregister(struct lwl_platform_profile *pp)
+{
+	if (!pp->registered)
+		return;
+
+#if lwl_PLATFORM_PROFILE_KERNEL
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 14, 0)
+	platform_profile_remove();
+#else
+	platform_profile_remove(pp->ppdev);
+#endif
+#endif
+	pp->registered = false;
+}
+
+/**
+ * Tell listeners that the profile changed outside of the kernel interface
+ *
+ * Must not be called from within the backend set op, the kernel holds its
+ * profile lock while calling it.
+ */
+static void lwl_platform_profile_notify(struct lwl_platform_profile *pp)
+{
+	if (!pp->registered)
+		return;
+
+#if lwl_PLATFORM_PROFILE_KERNEL
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 14, 0)
+	platform_profile_notify();
+#else
+	platform_profile_notify(pp->ppdev);
+#endif
+#endif
+}
+
+static ssize_t __attribute__ ((unused)) lwl_platform_profile_choices_show(struct lwl_platform_profile *pp, char *buffer)
+{
+	unsigned int i;
+	int len = 0;
+
+	for (i = 0; i < pp->map_size; ++i)
+		len += sprintf(buffer + len, "%s%s", i > 0 ? " " : "",
+			       lwl_platform_profile_names[pp->map[i].profile]);
+	len += sprintf(buffer + len, "\n");
+
+	return len;
+}
+
+static ssize_t __attribute__ ((unused)) lwl_platform_profile_show(struct lwl_platform_profile *pp, char *buffer)
+{
+	enum platform_profile_option profile;
+	int err;
+
+	err = lwl_platform_profile_get(pp, &profile);
+	if (err) {
+		pr_err("Error reading power profile\n");
+		return err;
+	}
+
+	return sprintf(buffer, "%s\n", lwl_platform_profile_names[profile]);
+}
+
+static ssize_t __attribute__ ((unused)) lwl_platform_profile_store(struct lwl_platform_profile *pp,
+								  const char *buffer, size_t size)
+{
+	unsigned int i;
+	int err;
+	char *buffer_copy;
+	char *descriptor;
+
+	buffer_copy = kstrndup(buffer, size, GFP_KERNEL);
+	if (!buffer_copy)
+		return -ENOMEM;
+	descriptor = strstrip(buffer_copy);
+
+	for (i = 0; i < pp->map_size; ++i)
+		if (strcmp(lwl_platform_profile_names[pp->map[i].profile], descriptor) == 0)
+			break;
+
+	kfree(buffer_copy);
+
+	// Invalid input, not matched to an option
+	if (i == pp->map_size)
+		return -EINVAL;
+
+	err = pp->ops->set(pp->drvdata, pp->map[i].native);
+	if (err)
+		return err;
+
+	lwl_platform_profile_notify(pp);
+
+	return size;
+}
+
+#endif
@@ -0,0 +1,281 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*!
+ * Copyright (c) 2024 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+ *
+ * This file is part of lwl-drivers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef lwl_STATE_RESTORE_H
+#define lwl_STATE_RESTORE_H
+
+/*
+ * Snapshot and replay of user applied settings
+ *
+ * A driver describes each setting it wants back after resume by an item
+ * with a restore op, records the value whenever the user applies one and
+ * calls lwl_state_restore_all() from its resume path. Items are replayed
+ * in stage order, a failing item does not stop the others and its status
+ * is kept for debugfs.
+ *
+ * Within a module the stages give the order. Across modules the keyboard
+ * drivers replay from their platform resume, lwl_io and other modules from
+ * a PM notifier, which runs after all devices are resumed.
+ *
+ * debugfs, state directory below the one given to lwl_state_debugfs_init():
+ *   items   items with stage, value and status of the last replay
+ *   replay  write 1 to replay now, e.g. after resetting the
+ *           firmware by hand
+ */
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+// Replay order, settings depend on the ones in earlier stages
+enum lwl_state_stage {
+	lwl_STATE_STAGE_PROFILE,
+	lwl_STATE_STAGE_POWER,
+	lwl_STATE_STAGE_FAN,
+	lwl_STATE_STAGE_CHARGING,
+	lwl_STATE_STAGE_LEDS,
+	lwl_STATE_STAGES,
+};
+
+static const char * const lwl_state_stage_names[] = {
+	[lwl_STATE_STAGE_PROFILE] = "profile",
+	[lwl_STATE_STAGE_POWER] = "power",
+	[lwl_STATE_STAGE_FAN] = "fan",
+	[lwl_STATE_STAGE_CHARGING] = "charging",
+	[lwl_STATE_STAGE_LEDS] = "leds",
+};
+
+struct lwl_state_item {
+	const char *name;
+	enum lwl_state_stage stage;
+	// Write value back to the firmware, called without the state lock
+	int (*restore)(struct lwl_state_item *item, u64 value);
+	void *drvdata;
+
+	u64 value;
+	bool valid;
+	// Status of the last replay, -ENODATA before the first one
+	int last_status;
+	struct list_head list;
+};
+
+struct lwl_state {
+	// Protects item values and the list
+	struct mutex lock;
+	// Serializes replays
+	struct mutex restore_lock;
+	struct list_head items;
+	unsigned int replays;
+	unsigned int last_failed;
+	u64 last_duration_us;
+	struct dentry *debugfs_dir;
+};
+
+// Static initializer, values may be recorded before the driver probes
+#define lwl_STATE_INIT(_state) {					\
+	.lock = __MUTEX_INITIALIZER(_state.lock),			\
+	.restore_lock = __MUTEX_INITIALIZER(_state.restore_lock),	\
+	.items = LIST_HEAD_INIT(_state.items),				\
+}
+
+#define lwl_STATE_ITEM(_name, _stage, _restore) {	\
+	.name = _name,					\
+	.stage = _stage,				\
+	.restore = _restore,				\
+	.last_status = -ENODATA,			\
+}
+
+/**
+ * Add an item behind the items of the same and earlier stages
+ */
+static void __attribute__ ((unused)) lwl_state_add(struct lwl_state *state, struct lwl_state_item *item)
+{
+	struct lwl_state_item *pos;
+
+	mutex_lock(&state->restore_lock);
+	mutex_lock(&state->lock);
+	list_for_each_entry(pos, &state->items, list)
+		if (pos->stage > item->stage)
+			break;
+	list_add_tail(&item->list, &pos->list);
+	mutex_unlock(&state->lock);
+	mutex_unlock(&state->restore_lock);
+}
+
+/**
+ * Remove all items, e.g. when the driver is removed
+ */
+static void __attribute__ ((unused)) lwl_state_clear(struct lwl_state *state)
+{
+	struct lwl_state_item *item, *tmp;
+
+	mutex_lock(&state->restore_lock);
+	mutex_lock(&state->lock);
+	list_for_each_entry_safe(item, tmp, &state->items, list)
+		list_del_init(&item->list);
+	mutex_unlock(&state->lock);
+	mutex_unlock(&state->restore_lock);
+}
+
+/**
+ * Remember value as the one to replay for item
+ */
+static void __attribute__ ((unused)) lwl_state_record(struct lwl_state *state, struct lwl_state_item *item, u64 value)
+{
+	mutex_lock(&state->lock);
+	item->value = value;
+	item->valid = true;
+	mutex_unlock(&state->lock);
+}
+
+/**
+ * Stop replaying item, the firmware default applies again
+ */
+static void __attribute__ ((unused)) lwl_state_forget(struct lwl_state *state, struct lwl_state_item *item)
+{
+	mutex_lock(&state->lock);
+	item->valid = false;
+	mutex_unlock(&state->lock);
+}
+
+static int __lwl_state_restore_item(struct lwl_state *state, struct lwl_state_item *item)
+{
+	bool valid;
+	u64 value;
+	int status;
+
+	mutex_lock(&state->lock);
+	valid = item->valid;
+	value = item->value;
+	mutex_unlock(&state->lock);
+
+	if (!valid)
+		return 0;
+
+	status = item->restore(item, value);
+	item->last_status = status;
+	if (status)
+		pr_warn("restoring %s failed: %d\n", item->name, status);
+	else
+		pr_debug("restored %s: %llu\n", item->name, value);
+
+	return status;
+}
+
+/**
+ * Replay a single item, e.g. when firmware resets it on an event
+ */
+static int __attribute__ ((unused)) lwl_state_restore_item(struct lwl_state *state, struct lwl_state_item *item)
+{
+	int status;
+
+	mutex_lock(&state->restore_lock);
+	status = __lwl_state_restore_item(state, item);
+	mutex_unlock(&state->restore_lock);
+
+	return status;
+}
+
+/**
+ * Replay all recorded items in stage order
+ *
+ * Returns the number of items that failed. Items are only added and
+ * removed with restore_lock held as well, so the list is walked without
+ * the state lock.
+ */
+static int __attribute__ ((unused)) lwl_state_restore_all(struct lwl_state *state)
+{
+	struct lwl_state_item *item;
+	unsigned int failed = 0;
+	ktime_t start;
+
+	mutex_lock(&state->restore_lock);
+
+	start = ktime_get();
+	list_for_each_entry(item, &state->items, list)
+		if (__lwl_state_restore_item(state, item))
+			failed += 1;
+
+	state->replays += 1;
+	state->last_failed = failed;
+	state->last_duration_us = ktime_us_delta(ktime_get(), start);
+	pr_debug("state replay: %u failed, %llu us\n", failed, state->last_duration_us);
+
+	mutex_unlock(&state->restore_lock);
+
+	return failed;
+}
+
+static int lwl_state_show(struct seq_file *m, void *unused)
+{
+	struct lwl_state *state = m->private;
+	struct lwl_state_item *item;
+
+	mutex_lock(&state->restore_lock);
+	mutex_lock(&state->lock);
+	seq_printf(m, "replays: %u\n", state->replays);
+	seq_printf(m, "last_failed: %u\n", state->last_failed);
+	seq_printf(m, "last_duration_us: %llu\n", state->last_duration_us);
+	seq_puts(m, "item stage value status\n");
+	list_for_each_entry(item, &state->items, list) {
+		seq_printf(m, "%s %s ", item->name, lwl_state_stage_names[item->stage]);
+		if (item->valid)
+			seq_printf(m, "%llu %d\n", item->value, item->last_status);
+		else
+			seq_puts(m, "- -\n");
+	}
+	mutex_unlock(&state->lock);
+	mutex_unlock(&state->restore_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lwl_state);
+
+static int lwl_state_replay_set(void *data, u64 val)
+{
+	lwl_state_restore_all(data);
+
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(lwl_state_replay_fops, NULL, lwl_state_replay_set, "%llu\n");
+
+/**
+ * Create the debugfs files of a state below parent
+ */
+static void __attribute__ ((unused)) lwl_state_debugfs_init(struct lwl_state *state, struct dentry *parent)
+{
+	if (IS_ERR_OR_NULL(parent))
+		return;
+
+	state->debugfs_dir = debugfs_create_dir("state", parent);
+	debugfs_create_file("items", 0444, state->debugfs_dir, state, &lwl_state_fops);
+	debugfs_create_file_unsafe("replay", 0200, state->debugfs_dir, state, &lwl_state_replay_fops);
+}
+
+static void __attribute__ ((unused)) lwl_state_debugfs_remove(struct lwl_state *state)
+{
+	debugfs_remove_recursive(state->debugfs_dir);
+	state->debugfs_dir = NULL;
+}
+
+#endif
@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*!
+ * Copyright (c) 2024 TUXEDO Computers GmbH <tux@tuxedocomputers.com>
+ *
+ * This file is part of lwl-drivers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Firmware transaction trace events
+ *
+ * Every module using these defines lwl_TRACE_SYSTEM to its own trace system
+ * name before including this header, one file per module also defines
+ * CREATE_TRACE_POINTS. The module's Kbuild needs -I pointing to src/ for
+ * define_trace.h to find this header.
+ *
+ * Example: perf trace -e 'lwl_*:*'
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lwl_TRACE_SYSTEM
+
+#if !defined(lwl_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define lwl_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#define lwl_TRACE_METHOD_LEN	40
+
+DECLARE_EVENT_CLASS(lwl_ec_access,
+
+	TP_PROTO(u16 addr, u8 data, int polls, int status, u64 latency_us),
+
+	TP_ARGS(addr, data, polls, status, latency_us),
+
+	TP_STRUCT__entry(
+		__field(u16, addr)
+		__field(u8, data)
+		__field(int, polls)
+		__field(int, status)
+		__field(u64, latency_us)
+	),
+
+	TP_fast_assign(
+		__entry->addr = addr;
+		__entry->data = data;
+		__entry->polls = polls;
+		__entry->status = status;
+		__entry->latency_us = latency_us;
+	),
+
+	TP_printk("addr=0x%04x data=0x%02x polls=%d status=%d latency_us=%llu",
+		  __entry->addr, __entry->data, __entry->polls, __entry->status,
+		  __entry->latency_us)
+);
+
+DEFINE_EVENT(lwl_ec_access, lwl_ec_read,
+	TP_PROTO(u16 addr, u8 data, int polls, int status, u64 latency_us),
+	TP_ARGS(addr, data, polls, status, latency_us)
+);
+
+DEFINE_EVENT(lwl_ec_access, lwl_ec_write,
+	TP_PROTO(u16 addr, u8 data, int polls, int status, u64 latency_us),
+	TP_ARGS(addr, data, polls, status, latency_us)
+);
+
+TRACE_EVENT(lwl_ec_write_batch,
+
+	TP_PROTO(u16 first_addr, int count, int status, u64 latency_us),
+
+	TP_ARGS(first_addr, count, status, latency_us),
+
+	TP_STRUCT__entry(
+		__field(u16, first_addr)
+		__field(int, count)
+		__field(int, status)
+		__field(u64, latency_us)
+	),
+
+	TP_fast_assign(
+		__entry->first_addr = first_addr;
+		__entry->count = count;
+		__entry->status = status;
+		__entry->latency_us = latency_us;
+	),
+
+	TP_printk("first_addr=0x%04x count=%d status=%d latency_us=%llu",
+		  __entry->first_addr, __entry->count, __entry->status,
+		  __entry->latency_us)
+);
+
+/*
+ * method is the WMI GUID, ACPI path or interface name, cmd the method id
+ * or sub command
+ */
+TRACE_EVENT(lwl_method_eval,
+
+	TP_PROTO(const char *method, u32 cmd, u64 arg, int status, u64 duration_us),
+
+	TP_ARGS(method, cmd, arg, status, duration_us),
+
+	TP_STRUCT__entry(
+		__array(char, method, lwl_TRACE_METHOD_LEN)
+		__field(u32, cmd)
+		__field(u64, arg)
+		__field(int, status)
+		__field(u64, duration_us)
+	),
+
+	TP_fast_assign(
+		strscpy(__entry->method, method, lwl_TRACE_METHOD_LEN);
+		__entry->cmd = cmd;
+		__entry->arg = arg;
+		__entry->status = status;
+		__entry->duration_us = duration_us;
+	),
+
+	TP_printk("method=%s cmd=0x%02x arg=0x%llx status=%d duration_us=%llu",
+		  __entry->method, __entry->cmd, __entry->arg, __entry->status,
+		  __entry->duration_us)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE lwl_trace
+
+#include <trace/define_trace.h>
@@ -23,8 +23,13 @@
 #include <linux/module.h>
 #include <linux/acpi.h>
 #include <linux/version.h>
+#include <linux/ktime.h>
 #include "tuxi_acpi.h"
 
+#define lwl_TRACE_SYSTEM lwl_tuxi_acpi
+#define CREATE_TRACE_POINTS
+#include "../lwl_trace.h"
+
 #define DRIVER_NAME "tuxi_acpi"
 
 struct tuxi_acpi_driver_data_t {
@@ -52,6 +57,7 @@ int evaluate_intparams(acpi_handle handle,
 	union acpi_object *params;
 	unsigned long long result;
 	acpi_status status;
+	ktime_t start = 0;
 	int i;
 	u32 param_buffer_size = sizeof(union acpi_object) * param_count;
 
@@ -69,12 +75,18 @@ int evaluate_intparams(acpi_handle handle,
 	input.count = param_count;
 	input.pointer = params;
 
+	if (trace_lwl_method_eval_enabled())
+		start = ktime_get();
 	if (param_buffer_size > 0) {
 		status = acpi_evaluate_integer(handle, pathname, &input, &result);
 		kfree(params);
 	} else {
 		status = acpi_evaluate_integer(handle, pathname, NULL, &result);
 	}
+	if (start)
+		trace_lwl_method_eval(pathname, param_count, param_count > 0 ? int_params[0] : 0,
+				      ACPI_FAILURE(status) ? -EIO : 0,
+				      ktime_us_delta(ktime_get(), start));
 
 	if (ACPI_FAILURE(status))
 		return -EIO;
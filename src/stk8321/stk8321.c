@@ -26,6 +26,13 @@
 #include <linux/iio/buffer.h>
 #include <linux/iio/iio.h>
 #include <linux/iio/sysfs.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+#include <linux/interrupt.h>
+#include <linux/input.h>
+#include <linux/workqueue.h>
+#include <linux/math64.h>
 #include <linux/version.h>
 
 // Backport
@@ -52,6 +59,14 @@ const struct i2c_device_id *i2c_client_get_device_id(const struct i2c_client *cl
 #define STK8321_REG_POWMODE		0x11
 #define STK8321_REG_DATASETUP		0x13
 #define STK8321_REG_SWRST		0x14
+#define STK8321_REG_INTEN2		0x17
+#define STK8321_REG_INTMAP2		0x1a
+
+#define STK8321_DREADY_INT_MASK		0x10
+#define STK8321_DREADY_INT_MAP		0x01
+
+// XOUT1 - ZOUT2 in one block
+#define STK8321_ALL_AXES_LENGTH		6
 
 #define STK8321_DATA_FILTER_MASK	0x80
 #define STK8321_DATA_PROTECT_MASK	0x40
@@ -94,6 +109,24 @@ static const struct {
 	{ 1000, 0, STK8321_BW_HZ_1000 },
 };
 
+/*
+ * Hinge angle fusion for devices with display and base sensor
+ *
+ * Angle convention: 0 = lid closed, 180 = flat, 360 = folded to tablet.
+ */
+static unsigned int hinge_poll_ms = 200;
+static unsigned int tablet_mode_enter_deg = 300;
+static unsigned int tablet_mode_exit_deg = 260;
+
+// Display sensors with running hinge work, for parameter changes
+static LIST_HEAD(stk8321_hinge_devices);
+static DEFINE_MUTEX(stk8321_hinge_lock);
+// Thresholds are checked as a pair once the first hinge is set up
+static bool stk8321_hinge_params_checked;
+
+// Minimum gravity component perpendicular to the hinge (2g range: 1024 = 1g)
+#define STK8321_HINGE_MIN_PROJECTION	512
+
 static IIO_CONST_ATTR_SAMP_FREQ_AVAIL(
 	"7.810000 15.630000 31.250000 62.500000 125 250 500 1000");
 
@@ -109,11 +142,94 @@ static const struct attribute_group stk8321_accel_attrs_group = {
 struct stk8321_data {
 	struct i2c_client *client;
 	struct i2c_client *second_client;
+	struct device_link *second_link;
 	struct iio_mount_matrix orientation;
 	struct mutex lock;
 	int samp_freq;
+	struct iio_trigger *dready_trig;
+	// Hinge fusion, display sensor only
+	struct delayed_work hinge_work;
+	struct input_dev *tablet_input;
+	int hinge_angle;
+	bool tablet_mode;
+	bool hinge_active;
+	struct list_head hinge_list;
+	// Buffer scan: three 16 bit little endian axes and timestamp
+	struct {
+		__le16 chans[3];
+		s64 timestamp __aligned(8);
+	} scan;
 };
 
+static int hinge_poll_ms_set(const char *value, const struct kernel_param *kp)
+{
+	struct stk8321_data *data;
+	unsigned int old_ms = hinge_poll_ms;
+	int ret;
+
+	ret = param_set_uint(value, kp);
+	if (ret)
+		return ret;
+
+	// Work stops itself at 0, start it again when polling is re-enabled
+	if (old_ms == 0 && hinge_poll_ms > 0) {
+		mutex_lock(&stk8321_hinge_lock);
+		list_for_each_entry(data, &stk8321_hinge_devices, hinge_list)
+			schedule_delayed_work(&data->hinge_work, 0);
+		mutex_unlock(&stk8321_hinge_lock);
+	}
+
+	return 0;
+}
+
+static const struct kernel_param_ops hinge_poll_ms_ops = {
+	.set = hinge_poll_ms_set,
+	.get = param_get_uint,
+};
+
+module_param_cb(hinge_poll_ms, &hinge_poll_ms_ops, &hinge_poll_ms, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(hinge_poll_ms, "Hinge angle update interval in ms, 0 disables");
+
+/**
+ * Thresholds form a hysteresis, exit has to stay below enter. At module
+ * load they may come in any order and are checked at hinge setup.
+ */
+static int tablet_mode_deg_set(const char *value, const struct kernel_param *kp)
+{
+	unsigned int deg, enter, exit;
+	int ret;
+
+	ret = kstrtouint(value, 10, &deg);
+	if (ret)
+		return ret;
+	if (deg > 360)
+		return -EINVAL;
+
+	mutex_lock(&stk8321_hinge_lock);
+	enter = kp->arg == &tablet_mode_enter_deg ? deg : tablet_mode_enter_deg;
+	exit = kp->arg == &tablet_mode_exit_deg ? deg : tablet_mode_exit_deg;
+	if (stk8321_hinge_params_checked && exit >= enter) {
+		ret = -EINVAL;
+	} else {
+		*(unsigned int *)kp->arg = deg;
+		ret = 0;
+	}
+	mutex_unlock(&stk8321_hinge_lock);
+
+	return ret;
+}
+
+static const struct kernel_param_ops tablet_mode_deg_ops = {
+	.set = tablet_mode_deg_set,
+	.get = param_get_uint,
+};
+
+module_param_cb(tablet_mode_enter_deg, &tablet_mode_deg_ops, &tablet_mode_enter_deg, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(tablet_mode_enter_deg, "Hinge angle at or above which tablet mode is entered");
+
+module_param_cb(tablet_mode_exit_deg, &tablet_mode_deg_ops, &tablet_mode_exit_deg, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(tablet_mode_exit_deg, "Hinge angle at or below which tablet mode is left, below enter");
+
 static const struct iio_mount_matrix iio_mount_zeromatrix = {
 	.rotation = {
 		"0", "0", "0",
@@ -136,6 +252,89 @@ static int stk8321_read_axis(struct i2c_client *client, u8 reg1, u8 reg2)
 	return result;
 }
 
+/**
+ * Read all axes in one go, 12 bit left aligned little endian values
+ */
+static int stk8321_read_all_axes(struct i2c_client *client, __le16 *chans)
+{
+	u8 *buf = (u8 *)chans;
+	int i, ret;
+
+	if (i2c_check_functionality(client->adapter, I2C_FUNC_SMBUS_READ_I2C_BLOCK)) {
+		ret = i2c_smbus_read_i2c_block_data(client, STK8321_REG_XOUT1,
+						    STK8321_ALL_AXES_LENGTH, buf);
+		if (ret < 0)
+			return ret;
+		if (ret != STK8321_ALL_AXES_LENGTH)
+			return -EIO;
+		return 0;
+	}
+
+	for (i = 0; i < STK8321_ALL_AXES_LENGTH; ++i) {
+		ret = i2c_smbus_read_byte_data(client, STK8321_REG_XOUT1 + i);
+		if (ret < 0)
+			return ret;
+		buf[i] = ret;
+	}
+
+	return 0;
+}
+
+/**
+ * atan(r / 1000) in millidegrees for r in 0 - 1000
+ *
+ * atan(x) ~= 45x + x(1 - x)(14.02 + 3.79x), error below 0.1 degrees
+ */
+static int stk8321_atan_mdeg(int r)
+{
+	return 45 * r + (int)div_s64((s64)r * (1000 - r) * (14020 + 3790 * r / 1000), 1000000);
+}
+
+/**
+ * atan2 in millidegrees, 0 - 359999
+ */
+static int stk8321_atan2_mdeg(int y, int x)
+{
+	int ay = abs(y), ax = abs(x), angle;
+
+	if (ax == 0 && ay == 0)
+		return 0;
+
+	if (ax >= ay)
+		angle = stk8321_atan_mdeg(ay * 1000 / ax);
+	else
+		angle = 90000 - stk8321_atan_mdeg(ax * 1000 / ay);
+
+	if (x < 0)
+		angle = 180000 - angle;
+	if (y < 0)
+		angle = 360000 - angle;
+
+	return angle % 360000;
+}
+
+/**
+ * Hinge angle in millidegrees from display and base gravity vectors
+ *
+ * Both vectors in device frame (x along the hinge). Returns -EINVAL when
+ * the hinge is too close to vertical for a reliable result.
+ */
+static int stk8321_hinge_angle_mdeg(const int *display, const int *base)
+{
+	int theta_display, theta_base;
+
+	if (display[1] * display[1] + display[2] * display[2] <
+		    STK8321_HINGE_MIN_PROJECTION * STK8321_HINGE_MIN_PROJECTION ||
+	    base[1] * base[1] + base[2] * base[2] <
+		    STK8321_HINGE_MIN_PROJECTION * STK8321_HINGE_MIN_PROJECTION)
+		return -EINVAL;
+
+	theta_display = stk8321_atan2_mdeg(display[1], display[2]);
+	theta_base = stk8321_atan2_mdeg(base[1], base[2]);
+
+	return ((180000 - (theta_display - theta_base)) % 360000 + 360000) % 360000;
+}
+
 static int stk8321_read_x(struct i2c_client *client)
 {
 	return stk8321_read_axis(client, STK8321_REG_XOUT1, STK8321_REG_XOUT2);
@@ -186,8 +385,13 @@ static const struct iio_chan_spec_ext_info stk8321_ext_info[] = {
 	.channel2 = IIO_MOD_##axis,					\
 	.info_mask_separate = BIT(IIO_CHAN_INFO_RAW),			\
 	.info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SAMP_FREQ),	\
+	.scan_index = index,						\
 	.scan_type = {							\
+		.sign = 's',						\
 		.realbits = 12,						\
+		.storagebits = 16,					\
+		.shift = 4,						\
+		.endianness = IIO_LE,					\
 	},								\
 	.ext_info = stk8321_ext_info,					\
 }
@@ -196,8 +400,47 @@ static const struct iio_chan_spec stk8321_channels[] = {
 	STK8321_ACCEL_CHANNEL(0, X),
 	STK8321_ACCEL_CHANNEL(1, Y),
 	STK8321_ACCEL_CHANNEL(2, Z),
+	IIO_CHAN_SOFT_TIMESTAMP(3),
+};
+
+// Display sensor of a dual sensor device additionally reports the hinge angle
+static const struct iio_chan_spec stk8321_channels_hinge[] = {
+	STK8321_ACCEL_CHANNEL(0, X),
+	STK8321_ACCEL_CHANNEL(1, Y),
+	STK8321_ACCEL_CHANNEL(2, Z),
+	IIO_CHAN_SOFT_TIMESTAMP(3),
+	{
+		.type = IIO_ANGL,
+		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW) | BIT(IIO_CHAN_INFO_SCALE),
+		.scan_index = -1,
+	},
 };
 
+// Axes are always read together
+static const unsigned long stk8321_scan_masks[] = { 0x07, 0 };
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 15, 0)
+static bool stk8321_claim_direct(struct iio_dev *indio_dev)
+{
+	return iio_device_claim_direct_mode(indio_dev) == 0;
+}
+
+static void stk8321_release_direct(struct iio_dev *indio_dev)
+{
+	iio_device_release_direct_mode(indio_dev);
+}
+#else
+static bool stk8321_claim_direct(struct iio_dev *indio_dev)
+{
+	return iio_device_claim_direct(indio_dev);
+}
+
+static void stk8321_release_direct(struct iio_dev *indio_dev)
+{
+	iio_device_release_direct(indio_dev);
+}
+#endif
+
 static int stk8321_read_raw(struct iio_dev *indio_dev,
 			    struct iio_chan_spec const *chan,
 			    int *val, int *val2, long mask)
@@ -205,27 +448,49 @@ static int stk8321_read_raw(struct iio_dev *indio_dev,
 	struct stk8321_data *data = iio_priv(indio_dev);
 	int ret;
 
+	if (chan->type == IIO_ANGL) {
+		switch (mask) {
+		case IIO_CHAN_INFO_RAW:
+			mutex_lock(&data->lock);
+			ret = data->hinge_angle;
+			mutex_unlock(&data->lock);
+			if (ret < 0)
+				return -ENODATA;
+			*val = ret / 1000;
+			return IIO_VAL_INT;
+		case IIO_CHAN_INFO_SCALE:
+			// Degrees to radians
+			*val = 0;
+			*val2 = 17453293;
+			return IIO_VAL_INT_PLUS_NANO;
+		default:
+			return -EINVAL;
+		}
+	}
+
 	switch (mask) {
 	case IIO_CHAN_INFO_RAW:
+		// Single reads would race the trigger handler while buffering
+		if (!stk8321_claim_direct(indio_dev))
+			return -EBUSY;
+
+		mutex_lock(&data->lock);
 		switch (chan->address) {
 		case 0:
-			mutex_lock(&data->lock);
 			ret = stk8321_read_x(data->client);
-			mutex_unlock(&data->lock);
 			break;
 		case 1:
-			mutex_lock(&data->lock);
 			ret = stk8321_read_y(data->client);
-			mutex_unlock(&data->lock);
 			break;
 		case 2:
-			mutex_lock(&data->lock);
 			ret = stk8321_read_z(data->client);
-			mutex_unlock(&data->lock);
 			break;
 		default:
-			return -EINVAL;
+			ret = -EINVAL;
+			break;
 		}
+		mutex_unlock(&data->lock);
+		stk8321_release_direct(indio_dev);
 
 		if (ret < 0)
 			return ret;
@@ -280,6 +545,81 @@ static const struct iio_info stk8321_info = {
 	.write_raw	= stk8321_write_raw,
 };
 
+static irqreturn_t stk8321_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct stk8321_data *data = iio_priv(indio_dev);
+	int ret;
+
+	mutex_lock(&data->lock);
+	ret = stk8321_read_all_axes(data->client, data->scan.chans);
+	mutex_unlock(&data->lock);
+
+	if (ret == 0)
+		iio_push_to_buffers_with_timestamp(indio_dev, &data->scan, pf->timestamp);
+
+	iio_trigger_notify_done(indio_dev->trig);
+
+	return IRQ_HANDLED;
+}
+
+static int stk8321_data_rdy_trigger_set_state(struct iio_trigger *trig, bool state)
+{
+	struct iio_dev *indio_dev = iio_trigger_get_drvdata(trig);
+	struct stk8321_data *data = iio_priv(indio_dev);
+	int ret;
+
+	mutex_lock(&data->lock);
+	ret = i2c_smbus_write_byte_data(data->client, STK8321_REG_INTEN2,
+					state ? STK8321_DREADY_INT_MASK : 0x00);
+	mutex_unlock(&data->lock);
+
+	return ret;
+}
+
+static const struct iio_trigger_ops stk8321_trigger_ops = {
+	.set_trigger_state = stk8321_data_rdy_trigger_set_state,
+};
+
+/**
+ * Data ready trigger, only available when the sensor has an interrupt line
+ */
+static int stk8321_setup_dready_trigger(struct iio_dev *indio_dev)
+{
+	struct stk8321_data *data = iio_priv(indio_dev);
+	struct i2c_client *client = data->client;
+	int ret;
+
+	data->dready_trig = devm_iio_trigger_alloc(&client->dev, "%s-%s",
+						   indio_dev->name, dev_name(&client->dev));
+	if (!data->dready_trig)
+		return -ENOMEM;
+
+	data->dready_trig->ops = &stk8321_trigger_ops;
+	iio_trigger_set_drvdata(data->dready_trig, indio_dev);
+
+	// Registered before the IRQ, an early interrupt polls a live trigger
+	ret = devm_iio_trigger_register(&client->dev, data->dready_trig);
+	if (ret)
+		return ret;
+
+	ret = devm_request_irq(&client->dev, client->irq,
+			       iio_trigger_generic_data_rdy_poll,
+			       IRQF_TRIGGER_RISING, STK8321_DRIVER_NAME,
+			       data->dready_trig);
+	if (ret)
+		return ret;
+
+	ret = i2c_smbus_write_byte_data(client, STK8321_REG_INTMAP2, STK8321_DREADY_INT_MAP);
+	if (ret < 0)
+		return ret;
+
+	indio_dev->trig = iio_trigger_get(data->dready_trig);
+
+	return 0;
+}
+
 #ifdef CONFIG_ACPI
 static int stk8321_apply_acpi_orientation(struct device *dev,
 					  char *method_name,
@@ -382,13 +722,150 @@ static void stk8321_dual_probe(struct i2c_client *client)
 	snprintf(dev_name, sizeof(dev_name), "%s:01", acpi_device_hid(adev));
 
 	data->second_client = i2c_acpi_new_device(&client->dev, 1, &board_info);
+	if (IS_ERR_OR_NULL(data->second_client))
+		return;
+
+	// The hinge work reads the base sensor, suspend before and resume after it
+	data->second_link = device_link_add(&client->dev, &data->second_client->dev, DL_FLAG_STATELESS);
+	if (!data->second_link) {
+		pr_err("[%02x] failed to link base sensor\n", client->addr);
+		i2c_unregister_device(data->second_client);
+		data->second_client = NULL;
+	}
+}
+
+static int stk8321_matrix_value(const char *str)
+{
+	int value;
+
+	if (kstrtoint(str, 10, &value))
+		return 0;
+
+	return clamp(value, -1, 1);
+}
+
+/**
+ * Gravity vector of a sensor in device frame (mount matrix applied)
+ */
+static int stk8321_read_gravity(struct stk8321_data *data, int *vec)
+{
+	__le16 chans[3];
+	int raw[3], i, j, ret;
+
+	mutex_lock(&data->lock);
+	ret = stk8321_read_all_axes(data->client, chans);
+	mutex_unlock(&data->lock);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < 3; ++i)
+		raw[i] = (s16)le16_to_cpu(chans[i]) >> 4;
+
+	for (i = 0; i < 3; ++i) {
+		vec[i] = 0;
+		for (j = 0; j < 3; ++j)
+			vec[i] += stk8321_matrix_value(data->orientation.rotation[i * 3 + j]) * raw[j];
+	}
+
+	return 0;
+}
+
+static void stk8321_hinge_work_func(struct work_struct *work)
+{
+	struct stk8321_data *data = container_of(to_delayed_work(work), struct stk8321_data, hinge_work);
+	struct device *base_dev = &data->second_client->dev;
+	struct iio_dev *base_indio_dev;
+	int display[3], base[3], angle, ret;
+	bool tablet_mode;
+
+	// Base sensor data is only valid while its driver is bound
+	device_lock(base_dev);
+	base_indio_dev = base_dev->driver ? i2c_get_clientdata(data->second_client) : NULL;
+	ret = !base_indio_dev ||
+	      stk8321_read_gravity(data, display) ||
+	      stk8321_read_gravity(iio_priv(base_indio_dev), base);
+	device_unlock(base_dev);
+	if (ret)
+		goto out;
+
+	angle = stk8321_hinge_angle_mdeg(display, base);
+	if (angle < 0)
+		goto out;
+
+	tablet_mode = data->tablet_mode;
+	if (angle >= tablet_mode_enter_deg * 1000)
+		tablet_mode = true;
+	else if (angle <= tablet_mode_exit_deg * 1000)
+		tablet_mode = false;
+
+	mutex_lock(&data->lock);
+	data->hinge_angle = angle;
+	mutex_unlock(&data->lock);
+
+	if (tablet_mode != data->tablet_mode) {
+		data->tablet_mode = tablet_mode;
+		input_report_switch(data->tablet_input, SW_TABLET_MODE, tablet_mode);
+		input_sync(data->tablet_input);
+	}
+
+out:
+	if (hinge_poll_ms > 0)
+		schedule_delayed_work(&data->hinge_work, msecs_to_jiffies(hinge_poll_ms));
+}
+
+static int stk8321_hinge_setup(struct i2c_client *client)
+{
+	struct stk8321_data *data = iio_priv(i2c_get_clientdata(client));
+	int ret;
+
+	data->tablet_input = devm_input_allocate_device(&client->dev);
+	if (!data->tablet_input)
+		return -ENOMEM;
+
+	data->tablet_input->name = "STK8321 Tablet Mode Switch";
+	data->tablet_input->phys = STK8321_DRIVER_NAME "/input0";
+	data->tablet_input->id.bustype = BUS_I2C;
+	input_set_capability(data->tablet_input, EV_SW, SW_TABLET_MODE);
+
+	ret = input_register_device(data->tablet_input);
+	if (ret)
+		return ret;
+
+	input_report_switch(data->tablet_input, SW_TABLET_MODE, 0);
+	input_sync(data->tablet_input);
+
+	mutex_lock(&stk8321_hinge_lock);
+	if (!stk8321_hinge_params_checked) {
+		if (tablet_mode_exit_deg >= tablet_mode_enter_deg) {
+			pr_err("tablet mode exit %u >= enter %u, using 260/300\n",
+			       tablet_mode_exit_deg, tablet_mode_enter_deg);
+			tablet_mode_enter_deg = 300;
+			tablet_mode_exit_deg = 260;
+		}
+		stk8321_hinge_params_checked = true;
+	}
+	data->hinge_active = true;
+	list_add(&data->hinge_list, &stk8321_hinge_devices);
+	schedule_delayed_work(&data->hinge_work, 0);
+	mutex_unlock(&stk8321_hinge_lock);
+
+	return 0;
 }
 
 static void stk8321_dual_remove(struct i2c_client *client)
 {
 	struct stk8321_data *data = iio_priv(i2c_get_clientdata(client));
-	if (!IS_ERR_OR_NULL(data->second_client))
+	if (data->hinge_active) {
+		mutex_lock(&stk8321_hinge_lock);
+		data->hinge_active = false;
+		list_del(&data->hinge_list);
+		mutex_unlock(&stk8321_hinge_lock);
+		cancel_delayed_work_sync(&data->hinge_work);
+	}
+	if (!IS_ERR_OR_NULL(data->second_client)) {
+		device_link_del(data->second_link);
 		i2c_unregister_device(data->second_client);
+	}
 }
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
@@ -421,6 +898,8 @@ static int stk8321_probe(struct i2c_client *client)
 	mutex_init(&data->lock);
 	data->client = client;
 	data->samp_freq = 0;
+	data->hinge_angle = -1;
+	INIT_DELAYED_WORK(&data->hinge_work, stk8321_hinge_work_func);
 
 	// Setup sensor in suspend mode
 	stk8321_set_power_mode(client, STK8321_POWMODE_SUSPEND);
@@ -435,6 +914,22 @@ static int stk8321_probe(struct i2c_client *client)
 	indio_dev->modes = INDIO_DIRECT_MODE;
 	indio_dev->channels = stk8321_channels;
 	indio_dev->num_channels = ARRAY_SIZE(stk8321_channels);
+	indio_dev->available_scan_masks = stk8321_scan_masks;
+
+	if (client->irq > 0) {
+		ret = stk8321_setup_dready_trigger(indio_dev);
+		if (ret)
+			pr_debug("[%02x] no data ready trigger: %d\n", client->addr, ret);
+	}
+
+	// Without data ready interrupt a software (e.g. hrtimer) trigger can be used
+	ret = devm_iio_triggered_buffer_setup(&client->dev, indio_dev,
+					      iio_pollfunc_store_time,
+					      stk8321_trigger_handler, NULL);
+	if (ret) {
+		pr_err("[%02x] triggered buffer setup failed\n", client->addr);
+		return ret;
+	}
 
 	ret = stk8321_apply_orientation(indio_dev);
 	if (ret)
@@ -443,7 +938,24 @@ static int stk8321_probe(struct i2c_client *client)
 	if (!id && has_acpi_companion(&client->dev))
 		stk8321_dual_probe(client);
 
-	return devm_iio_device_register(&client->dev, indio_dev);
+	if (!IS_ERR_OR_NULL(data->second_client)) {
+		indio_dev->channels = stk8321_channels_hinge;
+		indio_dev->num_channels = ARRAY_SIZE(stk8321_channels_hinge);
+	}
+
+	ret = devm_iio_device_register(&client->dev, indio_dev);
+	if (ret) {
+		stk8321_dual_remove(client);
+		return ret;
+	}
+
+	if (!IS_ERR_OR_NULL(data->second_client)) {
+		ret = stk8321_hinge_setup(client);
+		if (ret)
+			pr_err("[%02x] hinge angle setup failed: %d\n", client->addr, ret);
+	}
+
+	return 0;
 }
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 1, 0)
@@ -463,6 +975,8 @@ static int stk8321_suspend(struct device *dev)
 {
 	struct stk8321_data *data = iio_priv(dev_get_drvdata(dev));
 	struct i2c_client *client = data->client;
+	if (data->hinge_active)
+		cancel_delayed_work_sync(&data->hinge_work);
 	mutex_lock(&data->lock);
 	stk8321_set_power_mode(client, STK8321_POWMODE_SUSPEND);
 	mutex_unlock(&data->lock);
@@ -476,6 +990,8 @@ static int stk8321_resume(struct device *dev)
 	mutex_lock(&data->lock);
 	stk8321_set_power_mode(client, STK8321_POWMODE_NORMAL);
 	mutex_unlock(&data->lock);
+	if (data->hinge_active)
+		schedule_delayed_work(&data->hinge_work, 0);
 	return 0;
 }
 
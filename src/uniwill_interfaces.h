@@ -43,6 +43,32 @@ typedef int (uniwill_write_ec_ram_t)(u16, u8);
 typedef int (uniwill_write_ec_ram_with_retry_t)(u16, u8, int);
 typedef void (uniwill_event_callb_t)(u32);
 
+enum uniwill_ec_op_type_t {
+	UW_EC_OP_READ,
+	UW_EC_OP_WRITE,
+	// Write followed by a read back of the same address
+	UW_EC_OP_WRITE_VERIFY,
+	// Read, replace the bits in mask with data and write back
+	UW_EC_OP_UPDATE_BITS,
+};
+
+/**
+ * Single operation of an EC transaction
+ *
+ * data is filled in for reads and holds the written value for
+ * UW_EC_OP_UPDATE_BITS after execution. status is set per operation.
+ */
+struct uniwill_ec_op_t {
+	enum uniwill_ec_op_type_t type;
+	u16 addr;
+	u8 data;
+	u8 mask;
+	int status;
+};
+
+typedef int (uniwill_ec_transaction_t)(struct uniwill_ec_op_t *, int);
+typedef int (uniwill_ec_transaction_with_retry_t)(struct uniwill_ec_op_t *, int, int);
+
 // UW_EC_REG_* known relevant EC address exposing some information or function
 // UW_EC_REG_*_BIT_* single bit from byte holding information, should be handled with bit-wise operations
 // UW_EC_REG_*_VALUE_* discrete value of the whole byte with special meaning
@@ -102,6 +128,7 @@ struct uniwill_interface_t {
 	uniwill_event_callb_t *event_callb;
 	uniwill_read_ec_ram_t *read_ec_ram;
 	uniwill_write_ec_ram_t *write_ec_ram;
+	uniwill_ec_transaction_t *ec_transaction;
 };
 
 int uniwill_add_interface(struct uniwill_interface_t *new_interface);
@@ -110,6 +137,8 @@ uniwill_read_ec_ram_t uniwill_read_ec_ram;
 uniwill_write_ec_ram_t uniwill_write_ec_ram;
 uniwill_write_ec_ram_with_retry_t uniwill_write_ec_ram_with_retry;
 uniwill_read_ec_ram_with_retry_t uniwill_read_ec_ram_with_retry;
+uniwill_ec_transaction_t uniwill_ec_transaction;
+uniwill_ec_transaction_with_retry_t uniwill_ec_transaction_with_retry;
 int uniwill_get_active_interface_id(char **id_str);
 
 #define UW_MODEL_PF5LUXG	0x09
@@ -146,6 +175,14 @@ struct uniwill_device_features_t {
 
 struct uniwill_device_features_t *uniwill_get_device_features(void);
 
+enum uw_perf_profiles_v1 {
+	PROFILE_POWERSAVE = 1,
+	PROFILE_ENTHUSIAST = 2,
+	PROFILE_OVERBOOST = 3,
+};
+
+int uniwill_set_performance_profile_v1(u8 profile);
+
 union uw_ec_read_return {
 	u32 dword;
 	struct {
@@ -32,8 +32,14 @@
 #include <linux/led-class-multicolor.h>
 #include <linux/string.h>
 #include <linux/version.h>
+#include <linux/spinlock.h>
+#include <linux/bitmap.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include "uniwill_interfaces.h"
 #include "uniwill_leds.h"
+#include "lwl_platform_profile.h"
+#include "lwl_state_restore.h"
 
 #define UNIWILL_OSD_RADIOON			0x01A
 #define UNIWILL_OSD_RADIOOFF			0x01B
@@ -56,7 +62,11 @@
 #define UNIWILL_FN_LOCK_MASK			0x10
 
 static void uw_charging_priority_write_state(void);
-static void uw_charging_profile_write_state(void);
+
+static struct lwl_platform_profile uw_platform_profile;
+
+// Settings replayed on resume
+static struct lwl_state uw_state = lwl_STATE_INIT(uw_state);
 
 struct lwl_keyboard_driver uniwill_keyboard_driver;
 
@@ -97,7 +107,101 @@ static struct uniwill_interfaces_t {
 
 uniwill_event_callb_t uniwill_event_callb;
 
-int uniwill_read_ec_ram(u16 address, u8 *data)
+/*
+ * Shadow cache for EC RAM
+ *
+ * Registers are classified as
+ * - constant: identification and feature bits, read once from hardware
+ * - write-through: only changed by this driver, value known after the first
+ *   read or write
+ * - volatile: everything not listed below, always read from hardware
+ *
+ * The whole cache is invalidated on resume and on every EC event since
+ * firmware might have changed or reset values behind our back.
+ */
+enum uw_ec_cache_class_t {
+	UW_EC_CACHE_VOLATILE = 0,
+	UW_EC_CACHE_CONSTANT,
+	UW_EC_CACHE_WRITE_THROUGH,
+};
+
+struct uw_ec_cache_range_t {
+	u16 start;
+	u16 end;
+	enum uw_ec_cache_class_t class;
+};
+
+static const struct uw_ec_cache_range_t uw_ec_cache_ranges[] = {
+	{ UW_EC_REG_BAREBONE_ID,	UW_EC_REG_BAREBONE_ID,	UW_EC_CACHE_CONSTANT },
+	{ 0x0742,			0x0742,			UW_EC_CACHE_CONSTANT },
+	{ UW_EC_REG_FEATURES_0,		UW_EC_REG_FEATURES_1,	UW_EC_CACHE_CONSTANT },
+	{ 0x0786,			0x078a,			UW_EC_CACHE_CONSTANT },
+	{ UW_EC_REG_FAN_CTRL_STATUS,	UW_EC_REG_FAN_CTRL_STATUS, UW_EC_CACHE_CONSTANT },
+	// Custom profile mode and double PL4 bit
+	{ 0x0727,			0x0727,			UW_EC_CACHE_WRITE_THROUGH },
+	// Lightbar animation and color
+	{ 0x0748,			0x074b,			UW_EC_CACHE_WRITE_THROUGH },
+	{ UW_EC_REG_KBD_BL_RGB_RED_BRIGHTNESS, UW_EC_REG_KBD_BL_RGB_BLUE_BRIGHTNESS, UW_EC_CACHE_WRITE_THROUGH },
+	{ UW_EC_REG_ROMID_START,	UW_EC_REG_ROMID_SPECIAL_2, UW_EC_CACHE_WRITE_THROUGH },
+	// Custom fan tables
+	{ 0x0f00,			0x0f5f,			UW_EC_CACHE_WRITE_THROUGH },
+};
+
+#define UW_EC_CACHE_ENTRIES	256
+
+static bool uniwill_ec_cache_enabled = true;
+static DEFINE_SPINLOCK(uw_ec_cache_lock);
+static u8 uw_ec_cache_data[UW_EC_CACHE_ENTRIES];
+static DECLARE_BITMAP(uw_ec_cache_valid, UW_EC_CACHE_ENTRIES);
+// Incremented on every change, prevents storing values read before a write
+static unsigned long uw_ec_cache_generation;
+static u64 uw_ec_cache_hits, uw_ec_cache_misses, uw_ec_cache_uncached;
+static struct dentry *uw_ec_cache_debugfs_dir;
+
+static int uw_ec_cache_index(u16 address, enum uw_ec_cache_class_t *class)
+{
+	int i, index = 0;
+
+	for (i = 0; i < ARRAY_SIZE(uw_ec_cache_ranges); ++i) {
+		const struct uw_ec_cache_range_t *range = &uw_ec_cache_ranges[i];
+		if (address >= range->start && address <= range->end) {
+			index += address - range->start;
+			if (WARN_ON_ONCE(index >= UW_EC_CACHE_ENTRIES))
+				return -1;
+			*class = range->class;
+			return index;
+		}
+		index += range->end - range->start + 1;
+	}
+
+	*class = UW_EC_CACHE_VOLATILE;
+	return -1;
+}
+
+static void uniwill_ec_cache_invalidate(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&uw_ec_cache_lock, flags);
+	bitmap_zero(uw_ec_cache_valid, UW_EC_CACHE_ENTRIES);
+	uw_ec_cache_generation += 1;
+	spin_unlock_irqrestore(&uw_ec_cache_lock, flags);
+}
+
+/**
+ * Update cache entry after a write, called with uw_ec_cache_lock held
+ */
+static void __uw_ec_cache_store_write(int index, enum uw_ec_cache_class_t class, u8 data, int status)
+{
+	if (status == 0 && class == UW_EC_CACHE_WRITE_THROUGH) {
+		uw_ec_cache_data[index] = data;
+		set_bit(index, uw_ec_cache_valid);
+	} else {
+		clear_bit(index, uw_ec_cache_valid);
+	}
+}
+
+static int uniwill_read_ec_ram_hw(u16 address, u8 *data)
 {
 	int status;
 
@@ -110,6 +214,45 @@ int uniwill_read_ec_ram(u16 address, u8 *data)
 
 	return status;
 }
+
+int uniwill_read_ec_ram(u16 address, u8 *data)
+{
+	int status, index;
+	unsigned long flags, generation;
+	enum uw_ec_cache_class_t class;
+
+	index = uw_ec_cache_index(address, &class);
+	if (index < 0 || !READ_ONCE(uniwill_ec_cache_enabled)) {
+		spin_lock_irqsave(&uw_ec_cache_lock, flags);
+		uw_ec_cache_uncached += 1;
+		spin_unlock_irqrestore(&uw_ec_cache_lock, flags);
+		return uniwill_read_ec_ram_hw(address, data);
+	}
+
+	spin_lock_irqsave(&uw_ec_cache_lock, flags);
+	if (test_bit(index, uw_ec_cache_valid)) {
+		*data = uw_ec_cache_data[index];
+		uw_ec_cache_hits += 1;
+		spin_unlock_irqrestore(&uw_ec_cache_lock, flags);
+		return 0;
+	}
+	uw_ec_cache_misses += 1;
+	generation = uw_ec_cache_generation;
+	spin_unlock_irqrestore(&uw_ec_cache_lock, flags);
+
+	status = uniwill_read_ec_ram_hw(address, data);
+	if (status)
+		return status;
+
+	spin_lock_irqsave(&uw_ec_cache_lock, flags);
+	if (generation == uw_ec_cache_generation) {
+		uw_ec_cache_data[index] = *data;
+		set_bit(index, uw_ec_cache_valid);
+	}
+	spin_unlock_irqrestore(&uw_ec_cache_lock, flags);
+
+	return status;
+}
 EXPORT_SYMBOL(uniwill_read_ec_ram);
 
 int uniwill_read_ec_ram_with_retry(u16 address, u8 *data, int retries)
@@ -130,7 +273,9 @@ EXPORT_SYMBOL(uniwill_read_ec_ram_with_retry);
 
 int uniwill_write_ec_ram(u16 address, u8 data)
 {
-	int status;
+	int status, index;
+	unsigned long flags;
+	enum uw_ec_cache_class_t class;
 
 	if (!IS_ERR_OR_NULL(uniwill_interfaces.wmi))
 		status = uniwill_interfaces.wmi->write_ec_ram(address, data);
@@ -139,6 +284,14 @@ int uniwill_write_ec_ram(u16 address, u8 data)
 		status = -EIO;
 	}
 
+	index = uw_ec_cache_index(address, &class);
+	if (index >= 0) {
+		spin_lock_irqsave(&uw_ec_cache_lock, flags);
+		uw_ec_cache_generation += 1;
+		__uw_ec_cache_store_write(index, class, data, status);
+		spin_unlock_irqrestore(&uw_ec_cache_lock, flags);
+	}
+
 	return status;
 }
 EXPORT_SYMBOL(uniwill_write_ec_ram);
@@ -155,7 +308,8 @@ int uniwill_write_ec_ram_with_retry(u16 address, u8 data, int retries)
 			continue;
 		}
 		else {
-			status = uniwill_read_ec_ram(address, &control_data);
+			// Verify against hardware, not against the shadow cache
+			status = uniwill_read_ec_ram_hw(address, &control_data);
 			if (status != 0 || data != control_data) {
 				msleep(50);
 				continue;
@@ -168,14 +322,123 @@ int uniwill_write_ec_ram_with_retry(u16 address, u8 data, int retries)
 }
 EXPORT_SYMBOL(uniwill_write_ec_ram_with_retry);
 
+static int uw_ec_cache_show(struct seq_file *m, void *unused)
+{
+	unsigned long flags;
+	u64 hits, misses, uncached;
+	unsigned int valid;
+
+	spin_lock_irqsave(&uw_ec_cache_lock, flags);
+	hits = uw_ec_cache_hits;
+	misses = uw_ec_cache_misses;
+	uncached = uw_ec_cache_uncached;
+	valid = bitmap_weight(uw_ec_cache_valid, UW_EC_CACHE_ENTRIES);
+	spin_unlock_irqrestore(&uw_ec_cache_lock, flags);
+
+	seq_printf(m, "enabled: %d\n", uniwill_ec_cache_enabled);
+	seq_printf(m, "hits: %llu\n", hits);
+	seq_printf(m, "misses: %llu\n", misses);
+	seq_printf(m, "uncached: %llu\n", uncached);
+	seq_printf(m, "valid_entries: %u\n", valid);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(uw_ec_cache);
+
+static void uw_ec_cache_debugfs_init(void)
+{
+	uw_ec_cache_debugfs_dir = debugfs_create_dir("uniwill_keyboard", NULL);
+	debugfs_create_file("ec_cache", 0444, uw_ec_cache_debugfs_dir, NULL, &uw_ec_cache_fops);
+}
+
+static void uw_ec_cache_debugfs_remove(void)
+{
+	debugfs_remove_recursive(uw_ec_cache_debugfs_dir);
+	uw_ec_cache_debugfs_dir = NULL;
+}
+
+/**
+ * Run a list of EC operations atomically, see struct uniwill_ec_op_t
+ *
+ * All operations go to hardware, the shadow cache is updated with the
+ * results afterwards.
+ */
+int uniwill_ec_transaction(struct uniwill_ec_op_t *ops, int count)
+{
+	int i, index, status;
+	unsigned long flags, generation;
+	bool foreign_change;
+	enum uw_ec_cache_class_t class;
+
+	if (IS_ERR_OR_NULL(uniwill_interfaces.wmi)) {
+		pr_err("no active interface while ec transaction\n");
+		return -EIO;
+	}
+
+	if (!uniwill_interfaces.wmi->ec_transaction)
+		return -EOPNOTSUPP;
+
+	spin_lock_irqsave(&uw_ec_cache_lock, flags);
+	generation = uw_ec_cache_generation;
+	spin_unlock_irqrestore(&uw_ec_cache_lock, flags);
+
+	status = uniwill_interfaces.wmi->ec_transaction(ops, count);
+
+	spin_lock_irqsave(&uw_ec_cache_lock, flags);
+	foreign_change = generation != uw_ec_cache_generation;
+	for (i = 0; i < count; ++i) {
+		if (ops[i].status == -ECANCELED)
+			break;
+		index = uw_ec_cache_index(ops[i].addr, &class);
+		if (index < 0)
+			continue;
+		if (ops[i].type == UW_EC_OP_READ) {
+			if (ops[i].status == 0 && !foreign_change) {
+				uw_ec_cache_data[index] = ops[i].data;
+				set_bit(index, uw_ec_cache_valid);
+			}
+		} else {
+			__uw_ec_cache_store_write(index, class, ops[i].data, ops[i].status);
+		}
+	}
+	uw_ec_cache_generation += 1;
+	spin_unlock_irqrestore(&uw_ec_cache_lock, flags);
+
+	return status;
+}
+EXPORT_SYMBOL(uniwill_ec_transaction);
+
+/**
+ * Like uniwill_ec_transaction but on failure waits and continues with the
+ * failed operation up to retries times in total
+ */
+int uniwill_ec_transaction_with_retry(struct uniwill_ec_op_t *ops, int count, int retries)
+{
+	int status, i, first_failed = 0;
+
+	status = uniwill_ec_transaction(ops, count);
+	for (i = 1; i < retries && status != 0 && status != -EOPNOTSUPP; ++i) {
+		pr_debug("uniwill_ec_transaction(...) failed.\n");
+		while (first_failed < count && ops[first_failed].status == 0)
+			++first_failed;
+		msleep(50);
+		status = uniwill_ec_transaction(&ops[first_failed], count - first_failed);
+	}
+
+	return status;
+}
+EXPORT_SYMBOL(uniwill_ec_transaction_with_retry);
+
 static DEFINE_MUTEX(uniwill_interface_modification_lock);
 
 int uniwill_add_interface(struct uniwill_interface_t *interface)
 {
 	mutex_lock(&uniwill_interface_modification_lock);
 
-	if (strcmp(interface->string_id, UNIWILL_INTERFACE_WMI_STRID) == 0)
+	if (strcmp(interface->string_id, UNIWILL_INTERFACE_WMI_STRID) == 0) {
 		uniwill_interfaces.wmi = interface;
+		uniwill_ec_cache_invalidate();
+	}
 	else {
 		lwl_DEBUG("trying to add unknown interface\n");
 		mutex_unlock(&uniwill_interface_modification_lock);
@@ -274,17 +537,21 @@ static struct notifier_block keyboard_notifier_block = {
 
 static void uniwill_write_kbd_bl_enable(u8 enable)
 {
-	u8 backlight_data;
-	enable = enable & 0x01;
-
-	uniwill_read_ec_ram(UW_EC_REG_KBD_BL_STATUS, &backlight_data);
-	backlight_data = backlight_data & ~(1 << 1);
-	backlight_data |= (!enable << 1);
-	uniwill_write_ec_ram(UW_EC_REG_KBD_BL_STATUS, backlight_data);
+	struct uniwill_ec_op_t op = {
+		.type = UW_EC_OP_UPDATE_BITS,
+		.addr = UW_EC_REG_KBD_BL_STATUS,
+		.mask = 1 << 1,
+		.data = !(enable & 0x01) << 1
+	};
+
+	uniwill_ec_transaction(&op, 1);
 }
 
 void uniwill_event_callb(u32 code)
 {
+	// Firmware may have changed any register in reaction to the event
+	uniwill_ec_cache_invalidate();
+
 	switch (code) {
 		case UNIWILL_OSD_MODE_CHANGE_KEY_EVENT:
 			// Special key combination when mode change key is pressed (the one next to
@@ -297,6 +564,8 @@ void uniwill_event_callb(u32 code)
 			input_report_key(uniwill_keyboard_driver.input_device, KEY_LEFTALT, 0);
 			input_report_key(uniwill_keyboard_driver.input_device, KEY_LEFTMETA, 0);
 			input_sync(uniwill_keyboard_driver.input_device);
+			// Firmware may switch the performance profile on its own
+			lwl_platform_profile_notify(&uw_platform_profile);
 			break;
 		case UNIWILL_OSD_DC_ADAPTER_CHANGE:
 			// Refresh keyboard state and charging prio on cable switch event
@@ -331,35 +600,47 @@ void uniwill_event_callb(u32 code)
 
 static void uniwill_write_lightbar_rgb(u8 red, u8 green, u8 blue)
 {
+	struct uniwill_ec_op_t ops[3];
+	int n = 0;
+
 	if (red <= UNIWILL_LIGHTBAR_LED_MAX_BRIGHTNESS) {
-		uniwill_write_ec_ram(0x0749, red);
+		ops[n++] = (struct uniwill_ec_op_t) { .type = UW_EC_OP_WRITE, .addr = 0x0749, .data = red };
 	}
 	if (green <= UNIWILL_LIGHTBAR_LED_MAX_BRIGHTNESS) {
-		uniwill_write_ec_ram(0x074a, green);
+		ops[n++] = (struct uniwill_ec_op_t) { .type = UW_EC_OP_WRITE, .addr = 0x074a, .data = green };
 	}
 	if (blue <= UNIWILL_LIGHTBAR_LED_MAX_BRIGHTNESS) {
-		uniwill_write_ec_ram(0x074b, blue);
+		ops[n++] = (struct uniwill_ec_op_t) { .type = UW_EC_OP_WRITE, .addr = 0x074b, .data = blue };
 	}
+
+	if (n > 0)
+		uniwill_ec_transaction(ops, n);
 }
 
 static void uniwill_read_lightbar_rgb(u8 *red, u8 *green, u8 *blue)
 {
-	uniwill_read_ec_ram(0x0749, red);
-	uniwill_read_ec_ram(0x074a, green);
-	uniwill_read_ec_ram(0x074b, blue);
+	struct uniwill_ec_op_t ops[] = {
+		{ .type = UW_EC_OP_READ, .addr = 0x0749 },
+		{ .type = UW_EC_OP_READ, .addr = 0x074a },
+		{ .type = UW_EC_OP_READ, .addr = 0x074b }
+	};
+
+	uniwill_ec_transaction(ops, ARRAY_SIZE(ops));
+	*red = ops[0].data;
+	*green = ops[1].data;
+	*blue = ops[2].data;
 }
 
 static void uniwill_write_lightbar_animation(bool animation_status)
 {
-	u8 value;
-
-	uniwill_read_ec_ram(0x0748, &value);
-	if (animation_status) {
-		value |= 0x80;
-	} else {
-		value &= ~0x80;
-	}
-	uniwill_write_ec_ram(0x0748, value);
+	struct uniwill_ec_op_t op = {
+		.type = UW_EC_OP_UPDATE_BITS,
+		.addr = 0x0748,
+		.mask = 0x80,
+		.data = animation_status ? 0x80 : 0x00
+	};
+
+	uniwill_ec_transaction(&op, 1);
 }
 
 static void uniwill_read_lightbar_animation(bool *animation_status)
@@ -505,7 +786,6 @@ static int uw_lightbar_remove(struct platform_device *dev)
 }
 
 static bool uw_charging_prio_loaded = false;
-static bool uw_charging_prio_last_written_value;
 
 static ssize_t uw_charging_prios_available_show(struct device *child,
 						struct device_attribute *attr,
@@ -542,23 +822,29 @@ static struct attribute_group uw_charging_prio_attr_group = {
  */
 static int uw_set_charging_priority(u8 charging_priority)
 {
-	u8 previous_data, next_data;
 	int result;
+	struct uniwill_ec_op_t op = {
+		.type = UW_EC_OP_UPDATE_BITS,
+		.addr = 0x07cc,
+		.mask = 1 << 7
+	};
 
 	charging_priority = (charging_priority & 0x01) << 7;
+	op.data = charging_priority;
 
-	result = uniwill_read_ec_ram(0x07cc, &previous_data);
-	if (result != 0)
-		return result;
-
-	next_data = (previous_data & ~(1 << 7)) | charging_priority;
-	result = uniwill_write_ec_ram(0x07cc, next_data);
-	if (result == 0)
-		uw_charging_prio_last_written_value = charging_priority;
+	result = uniwill_ec_transaction(&op, 1);
 
 	return result;
 }
 
+static int uw_charging_prio_restore(struct lwl_state_item *item, u64 value)
+{
+	return uw_set_charging_priority(value);
+}
+
+static struct lwl_state_item uw_state_charging_prio =
+	lwl_STATE_ITEM("charging_prio", lwl_STATE_STAGE_CHARGING, uw_charging_prio_restore);
+
 static int uw_get_charging_priority(u8 *charging_priority)
 {
 	int result = uniwill_read_ec_ram(0x07cc, charging_priority);
@@ -598,7 +884,7 @@ static int uw_has_charging_priority(bool *status)
 static void uw_charging_priority_write_state(void)
 {
 	if (uw_charging_prio_loaded)
-		uw_set_charging_priority(uw_charging_prio_last_written_value);
+		lwl_state_restore_item(&uw_state, &uw_state_charging_prio);
 }
 
 static void uw_charging_priority_init(struct platform_device *dev)
@@ -611,13 +897,13 @@ static void uw_charging_priority_init(struct platform_device *dev)
 
 	// Read for state init
 	if (uw_charging_prio_loaded) {
-		uw_get_charging_priority(&value);
-		uw_charging_prio_last_written_value = value;
+		if (uw_get_charging_priority(&value) == 0)
+			lwl_state_record(&uw_state, &uw_state_charging_prio, value);
+		lwl_state_add(&uw_state, &uw_state_charging_prio);
 	}
 }
 
 static bool uw_charging_profile_loaded = false;
-static bool uw_charging_profile_last_written_value;
 
 static ssize_t uw_charging_profiles_available_show(struct device *child,
 						   struct device_attribute *attr,
@@ -655,24 +941,29 @@ static struct attribute_group uw_charging_profile_attr_group = {
  */
 static int uw_set_charging_profile(u8 charging_profile)
 {
-	u8 previous_data, next_data;
 	int result;
+	struct uniwill_ec_op_t op = {
+		.type = UW_EC_OP_UPDATE_BITS,
+		.addr = 0x07a6,
+		.mask = 0x03 << 4
+	};
 
 	charging_profile = (charging_profile & 0x03) << 4;
+	op.data = charging_profile;
 
-	result = uniwill_read_ec_ram(0x07a6, &previous_data);
-	if (result != 0)
-		return result;
-
-	next_data = (previous_data & ~(0x03 << 4)) | charging_profile;
-	result = uniwill_write_ec_ram(0x07a6, next_data);
-
-	if (result == 0)
-		uw_charging_profile_last_written_value = charging_profile;
+	result = uniwill_ec_transaction(&op, 1);
 
 	return result;
 }
 
+static int uw_charging_profile_restore(struct lwl_state_item *item, u64 value)
+{
+	return uw_set_charging_profile(value);
+}
+
+static struct lwl_state_item uw_state_charging_profile =
+	lwl_STATE_ITEM("charging_profile", lwl_STATE_STAGE_CHARGING, uw_charging_profile_restore);
+
 static int uw_get_charging_profile(u8 *charging_profile)
 {
 	int result = uniwill_read_ec_ram(0x07a6, charging_profile);
@@ -710,12 +1001,6 @@ static int uw_has_charging_profile(bool *status)
 	return 0;
 }
 
-static void __attribute__ ((unused)) uw_charging_profile_write_state(void)
-{
-	if (uw_charging_profile_loaded)
-		uw_set_charging_profile(uw_charging_profile_last_written_value);
-}
-
 static void uw_charging_profile_init(struct platform_device *dev)
 {
 	u8 value;
@@ -726,8 +1011,9 @@ static void uw_charging_profile_init(struct platform_device *dev)
 
 	// Read for state init
 	if (uw_charging_profile_loaded) {
-		uw_get_charging_profile(&value);
-		uw_charging_profile_last_written_value = value;
+		if (uw_get_charging_profile(&value) == 0)
+			lwl_state_record(&uw_state, &uw_state_charging_profile, value);
+		lwl_state_add(&uw_state, &uw_state_charging_profile);
 	}
 }
 
@@ -804,8 +1090,10 @@ static ssize_t uw_charging_profile_store(struct device *child,
 	if (i < ARRAY_SIZE(charging_profile_options)) {
 		// Option found try to set
 		result = uw_set_charging_profile(charging_profile_value);
-		if (result == 0)
+		if (result == 0) {
+			lwl_state_record(&uw_state, &uw_state_charging_profile, charging_profile_value);
 			return size;
+		}
 		else
 			return -EIO;
 	} else
@@ -880,8 +1168,10 @@ static ssize_t uw_charging_prio_store(struct device *child,
 	if (i < ARRAY_SIZE(charging_prio_options)) {
 		// Option found try to set
 		result = uw_set_charging_priority(charging_prio_value);
-		if (result == 0)
+		if (result == 0) {
+			lwl_state_record(&uw_state, &uw_state_charging_prio, charging_prio_value);
 			return size;
+		}
 		else
 			return -EIO;
 	} else
@@ -923,8 +1213,8 @@ static int set_rom_id(void) {
 	int i, ret;
 	const struct dmi_system_id *uw_sku_romid;
 	const u8 *romid;
-	u8 data;
 	bool romid_false = false;
+	struct uniwill_ec_op_t ops[16];
 
 	uw_sku_romid = dmi_first_match(uw_sku_romid_table);
 	if (!uw_sku_romid)
@@ -935,14 +1225,17 @@ static int set_rom_id(void) {
 		 romid[0], romid[1], romid[2], romid[3], romid[4], romid[5], romid[6], romid[7],
 		 romid[8], romid[9], romid[10], romid[11], romid[12], romid[13]);
 
+	for (i = 0; i < 14; ++i)
+		ops[i] = (struct uniwill_ec_op_t) { .type = UW_EC_OP_READ, .addr = UW_EC_REG_ROMID_START + i };
+	ret = uniwill_ec_transaction_with_retry(ops, 14, 3);
+	if (ret) {
+		pr_debug("uniwill_ec_transaction_with_retry(...) failed.\n");
+		return ret;
+	}
+
 	for (i = 0; i < 14; ++i) {
-		ret = uniwill_read_ec_ram_with_retry(UW_EC_REG_ROMID_START + i, &data, 3);
-		if (ret) {
-			pr_debug("uniwill_read_ec_ram_with_retry(...) failed.\n");
-			return ret;
-		}
-		pr_debug("ROMID index: %d, expected value: 0x%02X, actual value: 0x%02X\n", i, romid[i], data);
-		if (data != romid[i]) {
+		pr_debug("ROMID index: %d, expected value: 0x%02X, actual value: 0x%02X\n", i, romid[i], ops[i].data);
+		if (ops[i].data != romid[i]) {
 			pr_debug("ROMID is false. Correcting...\n");
 			romid_false = true;
 			break;
@@ -950,23 +1243,15 @@ static int set_rom_id(void) {
 	}
 
 	if (romid_false) {
-		ret = uniwill_write_ec_ram_with_retry(UW_EC_REG_ROMID_SPECIAL_1, 0xA5, 3);
-		if (ret) {
-			pr_debug("uniwill_write_ec_ram_with_retry(...) failed.\n");
-			return ret;
-		}
-		ret = uniwill_write_ec_ram_with_retry(UW_EC_REG_ROMID_SPECIAL_2, 0x78, 3);
+		ops[0] = (struct uniwill_ec_op_t) { .type = UW_EC_OP_WRITE_VERIFY, .addr = UW_EC_REG_ROMID_SPECIAL_1, .data = 0xA5 };
+		ops[1] = (struct uniwill_ec_op_t) { .type = UW_EC_OP_WRITE_VERIFY, .addr = UW_EC_REG_ROMID_SPECIAL_2, .data = 0x78 };
+		for (i = 0; i < 14; ++i)
+			ops[i + 2] = (struct uniwill_ec_op_t) { .type = UW_EC_OP_WRITE_VERIFY, .addr = UW_EC_REG_ROMID_START + i, .data = romid[i] };
+		ret = uniwill_ec_transaction_with_retry(ops, 16, 3);
 		if (ret) {
-			pr_debug("uniwill_write_ec_ram_with_retry(...) failed.\n");
+			pr_debug("uniwill_ec_transaction_with_retry(...) failed.\n");
 			return ret;
 		}
-		for (i = 0; i < 14; ++i) {
-			ret = uniwill_write_ec_ram_with_retry(UW_EC_REG_ROMID_START + i, romid[i], 3);
-			if (ret) {
-				pr_debug("uniwill_write_ec_ram_with_retry(...) failed.\n");
-				return ret;
-			}
-		}
 	}
 	else
 		pr_debug("ROMID is correct.\n");
@@ -1111,45 +1396,184 @@ struct uniwill_device_features_t *uniwill_get_device_features(void)
 }
 EXPORT_SYMBOL(uniwill_get_device_features);
 
-// Fn lock
+// Performance profile v1
 
-static int uniwill_wmi_fn_lock_get(int *on)
+static const struct lwl_platform_profile_map uw_platform_profile_map_two_profs[] = {
+	{ .profile = PLATFORM_PROFILE_LOW_POWER,	.native = PROFILE_POWERSAVE },
+	{ .profile = PLATFORM_PROFILE_BALANCED,		.native = PROFILE_ENTHUSIAST },
+};
+
+static const struct lwl_platform_profile_map uw_platform_profile_map_three_profs[] = {
+	{ .profile = PLATFORM_PROFILE_LOW_POWER,	.native = PROFILE_POWERSAVE },
+	{ .profile = PLATFORM_PROFILE_BALANCED,		.native = PROFILE_ENTHUSIAST },
+	{ .profile = PLATFORM_PROFILE_PERFORMANCE,	.native = PROFILE_OVERBOOST },
+};
+
+/**
+ * Set profile 1-3 to 0xa0, 0x00 or 0x10 depending on
+ * device support.
+ */
+static int __uniwill_write_performance_profile_v1(u8 profile)
+{
+	struct uniwill_ec_op_t op = {
+		.type = UW_EC_OP_UPDATE_BITS,
+		.addr = 0x0751,
+		.mask = 0xa0 | 0x10
+	};
+
+	switch (profile) {
+	case PROFILE_POWERSAVE:
+		op.data = 0xa0;
+		break;
+	case PROFILE_ENTHUSIAST:
+		op.data = 0x00;
+		break;
+	case PROFILE_OVERBOOST:
+		op.data = 0x10;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return uniwill_ec_transaction(&op, 1);
+}
+
+static int uniwill_read_performance_profile_v1(u8 *profile)
 {
 	u8 data;
-	int err;
+	int result;
 
-	err = uniwill_read_ec_ram(UW_EC_REG_KBD_FN_LOCK_STATUS_BIT, &data);
-	if (err)
-		return err;
+	result = uniwill_read_ec_ram(0x0751, &data);
+	if (result)
+		return result;
 
-	if (on)
-		*on = (data & UNIWILL_FN_LOCK_MASK) >> 4;
+	switch (data & (0xa0 | 0x10)) {
+	case 0xa0:
+		*profile = PROFILE_POWERSAVE;
+		break;
+	case 0x00:
+		*profile = PROFILE_ENTHUSIAST;
+		break;
+	case 0x10:
+		*profile = PROFILE_OVERBOOST;
+		break;
+	default:
+		return -EIO;
+	}
 
 	return 0;
 }
 
-static int uniwill_wmi_fn_lock_set(int on)
+static int uw_performance_profile_restore(struct lwl_state_item *item, u64 value)
+{
+	return __uniwill_write_performance_profile_v1(value);
+}
+
+static struct lwl_state_item uw_state_performance_profile =
+	lwl_STATE_ITEM("performance_profile", lwl_STATE_STAGE_PROFILE, uw_performance_profile_restore);
+
+int uniwill_set_performance_profile_v1(u8 profile)
+{
+	int result;
+
+	result = __uniwill_write_performance_profile_v1(profile);
+	if (result)
+		return result;
+
+	lwl_state_record(&uw_state, &uw_state_performance_profile, profile);
+	lwl_platform_profile_notify(&uw_platform_profile);
+
+	return 0;
+}
+EXPORT_SYMBOL(uniwill_set_performance_profile_v1);
+
+static int uw_platform_profile_get_native(void *drvdata, u64 *native)
+{
+	u8 profile;
+	int result;
+
+	result = uniwill_read_performance_profile_v1(&profile);
+	if (result)
+		return result;
+
+	*native = profile;
+
+	return 0;
+}
+
+static int uw_platform_profile_set_native(void *drvdata, u64 native)
+{
+	int result;
+
+	result = __uniwill_write_performance_profile_v1(native);
+	if (result)
+		return result;
+
+	lwl_state_record(&uw_state, &uw_state_performance_profile, native);
+
+	return 0;
+}
+
+static const struct lwl_platform_profile_ops uw_platform_profile_ops = {
+	.get = uw_platform_profile_get_native,
+	.set = uw_platform_profile_set_native,
+};
+
+static void uw_platform_profile_init(struct platform_device *dev)
+{
+	struct uniwill_device_features_t *uw_feats = uniwill_get_device_features();
+	int result;
+
+	if (uw_feats->uniwill_profile_v1_two_profs) {
+		uw_platform_profile.map = uw_platform_profile_map_two_profs;
+		uw_platform_profile.map_size = ARRAY_SIZE(uw_platform_profile_map_two_profs);
+	} else if (uw_feats->uniwill_profile_v1_three_profs ||
+		   uw_feats->uniwill_profile_v1_three_profs_leds_only) {
+		uw_platform_profile.map = uw_platform_profile_map_three_profs;
+		uw_platform_profile.map_size = ARRAY_SIZE(uw_platform_profile_map_three_profs);
+	} else {
+		return;
+	}
+
+	uw_platform_profile.name = "lwl-uniwill";
+	uw_platform_profile.ops = &uw_platform_profile_ops;
+
+	lwl_state_add(&uw_state, &uw_state_performance_profile);
+
+	result = lwl_platform_profile_register(&uw_platform_profile, &dev->dev);
+	if (result)
+		lwl_DEBUG("platform_profile handler not registered: %d\n", result);
+}
+
+// Fn lock
+
+static int uniwill_wmi_fn_lock_get(int *on)
 {
 	u8 data;
 	int err;
 
-	// possible race condition
 	err = uniwill_read_ec_ram(UW_EC_REG_KBD_FN_LOCK_STATUS_BIT, &data);
 	if (err)
 		return err;
 
 	if (on)
-		data = data | UNIWILL_FN_LOCK_MASK;
-	else
-		data = data & ~UNIWILL_FN_LOCK_MASK;
-
-	err = uniwill_write_ec_ram(UW_EC_REG_KBD_FN_LOCK_STATUS_BIT, data);
-	if (err)
-		return err;
+		*on = (data & UNIWILL_FN_LOCK_MASK) >> 4;
 
 	return 0;
 }
 
+static int uniwill_wmi_fn_lock_set(int on)
+{
+	struct uniwill_ec_op_t op = {
+		.type = UW_EC_OP_UPDATE_BITS,
+		.addr = UW_EC_REG_KBD_FN_LOCK_STATUS_BIT,
+		.mask = UNIWILL_FN_LOCK_MASK,
+		.data = on ? UNIWILL_FN_LOCK_MASK : 0x00
+	};
+
+	return uniwill_ec_transaction(&op, 1);
+}
+
 static ssize_t uniwill_fn_lock_show(struct device *dev,
 		struct device_attribute *attr,
 		char *buf)
@@ -1199,12 +1623,31 @@ static bool uniwill_fn_lock_available(void){
 		return 1;
 }
 
+static int uw_leds_restore(struct lwl_state_item *item, u64 value)
+{
+	uniwill_leds_restore_state_extern();
+
+	return 0;
+}
+
+static struct lwl_state_item uw_state_leds =
+	lwl_STATE_ITEM("leds", lwl_STATE_STAGE_LEDS, uw_leds_restore);
+
 static int uniwill_keyboard_probe(struct platform_device *dev)
 {
 	u32 i;
 	u8 data;
 	int status;
 	struct uniwill_device_features_t *uw_feats;
+	struct uniwill_ec_op_t ops[5];
+	struct uniwill_ec_op_t custom_mode_op = {
+		.type = UW_EC_OP_UPDATE_BITS,
+		.addr = 0x0727,
+		.mask = 1 << 6
+	};
+
+	uw_ec_cache_debugfs_init();
+	lwl_state_debugfs_init(&uw_state, uw_ec_cache_debugfs_dir);
 
 	set_rom_id();
 
@@ -1218,9 +1661,14 @@ static int uniwill_keyboard_probe(struct platform_device *dev)
 	if (uw_feats->uniwill_profile_v1) {
 		// Set manual-mode fan-curve in 0x0743 - 0x0747
 		// Some kind of default fan-curve is stored in 0x0786 - 0x078a: Using it to initialize manual-mode fan-curve
-		for (i = 0; i < 5; ++i) {
-			uniwill_read_ec_ram(0x0786 + i, &data);
-			uniwill_write_ec_ram(0x0743 + i, data);
+		for (i = 0; i < 5; ++i)
+			ops[i] = (struct uniwill_ec_op_t) { .type = UW_EC_OP_READ, .addr = 0x0786 + i };
+		if (uniwill_ec_transaction(ops, 5) == 0) {
+			for (i = 0; i < 5; ++i) {
+				ops[i].type = UW_EC_OP_WRITE;
+				ops[i].addr = 0x0743 + i;
+			}
+			uniwill_ec_transaction(ops, 5);
 		}
 	}
 
@@ -1229,12 +1677,11 @@ static int uniwill_keyboard_probe(struct platform_device *dev)
 	if (uw_feats->uniwill_custom_profile_mode_needed) {
 		// Certain devices seem to need this first reset to
 		// zero on boot to have it properly applied
-		uniwill_read_ec_ram(0x0727, &data);
-		data &= ~(1 << 6);
-		uniwill_write_ec_ram(0x0727, data);
+		custom_mode_op.data = 0x00;
+		uniwill_ec_transaction(&custom_mode_op, 1);
 		msleep(50);
-		data |= (1 << 6);
-		uniwill_write_ec_ram(0x0727, data);
+		custom_mode_op.data = 1 << 6;
+		uniwill_ec_transaction(&custom_mode_op, 1);
 	}
 
 	// Enable manual mode
@@ -1252,6 +1699,9 @@ static int uniwill_keyboard_probe(struct platform_device *dev)
 	uniwill_kbd_bl_enable_state_on_start = (data >> 1) & 0x01;
 	uniwill_leds_init(dev);
 	uniwill_write_kbd_bl_enable(1);
+	// Backlight state is kept by the LED driver itself
+	lwl_state_record(&uw_state, &uw_state_leds, 0);
+	lwl_state_add(&uw_state, &uw_state_leds);
 
 	status = uw_lightbar_init(dev);
 	uw_lightbar_loaded = (status >= 0);
@@ -1259,6 +1709,8 @@ static int uniwill_keyboard_probe(struct platform_device *dev)
 	uw_charging_priority_init(dev);
 	uw_charging_profile_init(dev);
 
+	uw_platform_profile_init(dev);
+
 	return 0;
 }
 
@@ -1268,6 +1720,8 @@ static int uniwill_keyboard_remove(struct platform_device *dev)
 static void uniwill_keyboard_remove(struct platform_device *dev)
 #endif
 {
+	lwl_platform_profile_unregister(&uw_platform_profile);
+
 	if (uw_charging_prio_loaded)
 		sysfs_remove_group(&dev->dev.kobj, &uw_charging_prio_attr_group);
 
@@ -1288,6 +1742,10 @@ static void uniwill_keyboard_remove(struct platform_device *dev)
 
 	// Disable manual mode
 	uniwill_write_ec_ram(0x0741, 0x00);
+
+	lwl_state_clear(&uw_state);
+	lwl_state_debugfs_remove(&uw_state);
+	uw_ec_cache_debugfs_remove();
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0)
 	return 0;
 #endif
@@ -1296,13 +1754,16 @@ static void uniwill_keyboard_remove(struct platform_device *dev)
 static int uniwill_keyboard_suspend(struct platform_device *dev, pm_message_t state)
 {
 	struct uniwill_device_features_t *uw_feats = &uniwill_device_features;
-	u8 data;
+	struct uniwill_ec_op_t custom_mode_op = {
+		.type = UW_EC_OP_UPDATE_BITS,
+		.addr = 0x0727,
+		.mask = 1 << 6,
+		.data = 0x00
+	};
 	if (uw_feats->uniwill_custom_profile_mode_needed) {
 		// Unset "customer mode light" before suspend. Otherwise at
 		// least one device is known to immediately wake up.
-		uniwill_read_ec_ram(0x0727, &data);
-		data &= ~(1 << 6);
-		uniwill_write_ec_ram(0x0727, data);
+		uniwill_ec_transaction(&custom_mode_op, 1);
 	}
 	uniwill_write_kbd_bl_enable(0);
 	return 0;
@@ -1311,14 +1772,20 @@ static int uniwill_keyboard_suspend(struct platform_device *dev, pm_message_t st
 static int uniwill_keyboard_resume(struct platform_device *dev)
 {
 	struct uniwill_device_features_t *uw_feats = &uniwill_device_features;
-	u8 data;
+	struct uniwill_ec_op_t custom_mode_op = {
+		.type = UW_EC_OP_UPDATE_BITS,
+		.addr = 0x0727,
+		.mask = 1 << 6,
+		.data = 1 << 6
+	};
+
+	uniwill_ec_cache_invalidate();
+
 	if (uw_feats->uniwill_custom_profile_mode_needed) {
 		// Re-set "customer mode light" on resume
-		uniwill_read_ec_ram(0x0727, &data);
-		data |= (1 << 6);
-		uniwill_write_ec_ram(0x0727, data);
+		uniwill_ec_transaction(&custom_mode_op, 1);
 	}
-	uniwill_leds_restore_state_extern();
+	lwl_state_restore_all(&uw_state);
 	uniwill_write_kbd_bl_enable(1);
 	return 0;
 }
@@ -1334,6 +1801,9 @@ static struct platform_driver platform_driver_uniwill = {
 		},
 };
 
+module_param_named(uw_ec_cache, uniwill_ec_cache_enabled, bool, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(uw_ec_cache, "Serve constant and write-through Uniwill EC registers from memory (default: true).");
+
 struct lwl_keyboard_driver uniwill_keyboard_driver = {
 	.platform_driver = &platform_driver_uniwill,
 	.probe = uniwill_keyboard_probe,
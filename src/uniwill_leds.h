@@ -63,16 +63,15 @@ static bool uw_leds_initialized = false;
 
 static int uniwill_write_kbd_bl_brightness(u8 brightness)
 {
-	int result = 0;
-	u8 data = 0;
-
-	result = uniwill_read_ec_ram(UW_EC_REG_KBD_BL_STATUS, &data);
-	if (result)
-		return result;
-	data &= 0x0f; // lower bits must be preserved
-	data |= brightness << 5; // upper 2 to 3 bits encode brightness
-	data |= UW_EC_REG_KBD_BL_STATUS_SUBCMD_RESET; // "apply bit"
-	return uniwill_write_ec_ram(UW_EC_REG_KBD_BL_STATUS, data);
+	struct uniwill_ec_op_t op = {
+		.type = UW_EC_OP_UPDATE_BITS,
+		.addr = UW_EC_REG_KBD_BL_STATUS,
+		.mask = 0xf0, // lower bits must be preserved
+		.data = (brightness << 5) // upper 2 to 3 bits encode brightness
+			| UW_EC_REG_KBD_BL_STATUS_SUBCMD_RESET // "apply bit"
+	};
+
+	return uniwill_ec_transaction(&op, 1);
 }
 
 static int uniwill_write_kbd_bl_brightness_white_workaround(u8 brightness)
@@ -108,29 +107,19 @@ static int tf_convert_rgb_range(u8 input) {
 static int uniwill_write_kbd_bl_color(u8 red, u8 green, u8 blue)
 {
 	int result = 0;
-	u8 data = 0;
 
 	// If, after conversion, all three (red, green, and blue) values are zero at the same time,
 	// a special case is triggered in the EC and (probably device dependent) default values are
 	// written instead.
-
-	result = uniwill_write_ec_ram(UW_EC_REG_KBD_BL_RGB_RED_BRIGHTNESS, tf_convert_rgb_range(red));
-	if (result)
-		return result;
-
-	result = uniwill_write_ec_ram(UW_EC_REG_KBD_BL_RGB_GREEN_BRIGHTNESS, tf_convert_rgb_range(green));
-	if (result)
-		return result;
-
-	result = uniwill_write_ec_ram(UW_EC_REG_KBD_BL_RGB_BLUE_BRIGHTNESS, tf_convert_rgb_range(blue));
-	if (result)
-		return result;
-
-	result = uniwill_read_ec_ram(UW_EC_REG_KBD_BL_RGB_MODE, &data);
-	if (result)
-		return result;
-
-	result = uniwill_write_ec_ram(UW_EC_REG_KBD_BL_RGB_MODE, data | UW_EC_REG_KBD_BL_RGB_MODE_BIT_APPLY_COLOR);
+	struct uniwill_ec_op_t ops[] = {
+		{ .type = UW_EC_OP_WRITE, .addr = UW_EC_REG_KBD_BL_RGB_RED_BRIGHTNESS, .data = tf_convert_rgb_range(red) },
+		{ .type = UW_EC_OP_WRITE, .addr = UW_EC_REG_KBD_BL_RGB_GREEN_BRIGHTNESS, .data = tf_convert_rgb_range(green) },
+		{ .type = UW_EC_OP_WRITE, .addr = UW_EC_REG_KBD_BL_RGB_BLUE_BRIGHTNESS, .data = tf_convert_rgb_range(blue) },
+		{ .type = UW_EC_OP_UPDATE_BITS, .addr = UW_EC_REG_KBD_BL_RGB_MODE,
+		  .mask = UW_EC_REG_KBD_BL_RGB_MODE_BIT_APPLY_COLOR, .data = UW_EC_REG_KBD_BL_RGB_MODE_BIT_APPLY_COLOR }
+	};
+
+	result = uniwill_ec_transaction(ops, ARRAY_SIZE(ops));
 	if (result)
 		return result;
 
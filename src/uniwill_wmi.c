@@ -24,8 +24,15 @@
 #include <linux/wmi.h>
 #include <linux/version.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include "uniwill_interfaces.h"
 
+#define lwl_TRACE_SYSTEM lwl_uniwill_wmi
+#define CREATE_TRACE_POINTS
+#include "lwl_trace.h"
+
 #define UNIWILL_EC_REG_LDAT	0x8a
 #define UNIWILL_EC_REG_HDAT	0x8b
 #define UNIWILL_EC_REG_FLAGS	0x8c
@@ -38,13 +45,89 @@
 #define UNIWILL_EC_BIT_CFLG	3
 #define UNIWILL_EC_BIT_DRDY	7
 
-#define UW_EC_BUSY_WAIT_CYCLES	30
-#define UW_EC_BUSY_WAIT_DELAY	15
+// Overall time the EC gets to set DRDY, same as the former 30 x 15ms polling
+#define UW_EC_BUSY_WAIT_TIMEOUT_MS	450
+// First poll interval, doubled on every unsuccessful poll up to the ceiling
+#define UW_EC_BUSY_WAIT_MIN_US		50
+#define UW_EC_BUSY_WAIT_MAX_US_DEFAULT	15000
+
+// Latency histogram buckets, bucket n counts transactions below 2^(n + 6) us,
+// the last bucket collects everything above
+#define UW_EC_LATENCY_BUCKETS		14
 
 static bool uniwill_ec_direct = true;
+static uint uniwill_ec_wait_max_us = UW_EC_BUSY_WAIT_MAX_US_DEFAULT;
+
+struct uw_ec_latency_stats_t {
+	u64 count;
+	u64 timeouts;
+	u64 total_us;
+	u64 max_us;
+	u64 buckets[UW_EC_LATENCY_BUCKETS];
+};
+
+static struct uw_ec_latency_stats_t uw_ec_read_stats;
+static struct uw_ec_latency_stats_t uw_ec_write_stats;
+static struct dentry *uw_ec_debugfs_dir;
 
 DEFINE_MUTEX(uniwill_ec_lock);
 
+/**
+ * Account one direct EC transaction, called with uniwill_ec_lock held
+ *
+ * Returns the transaction duration in us
+ */
+static u64 uw_ec_latency_account(struct uw_ec_latency_stats_t *stats, ktime_t start, bool timeout)
+{
+	u64 delta_us = ktime_us_delta(ktime_get(), start);
+	int bucket = 0;
+
+	while (bucket < UW_EC_LATENCY_BUCKETS - 1 && delta_us >= (1ULL << (bucket + 6)))
+		++bucket;
+
+	stats->count += 1;
+	stats->total_us += delta_us;
+	if (delta_us > stats->max_us)
+		stats->max_us = delta_us;
+	if (timeout)
+		stats->timeouts += 1;
+	stats->buckets[bucket] += 1;
+
+	return delta_us;
+}
+
+/**
+ * Wait for the EC to set DRDY after a read or write request
+ *
+ * Polls with a short initial delay that is doubled on every unsuccessful
+ * poll up to ec_wait_max_us. An idle EC usually answers within the first
+ * few polls, msleep() in contrast never returns before the next jiffy.
+ *
+ * Returns the number of polls needed or -ETIMEDOUT
+ */
+static int uw_ec_wait_ready(void)
+{
+	ktime_t deadline = ktime_add_ms(ktime_get(), UW_EC_BUSY_WAIT_TIMEOUT_MS);
+	unsigned int delay_us = UW_EC_BUSY_WAIT_MIN_US;
+	unsigned int max_us = max_t(unsigned int, READ_ONCE(uniwill_ec_wait_max_us), UW_EC_BUSY_WAIT_MIN_US);
+	int polls = 0;
+	u8 tmp;
+
+	do {
+		usleep_range(delay_us, delay_us + delay_us / 2);
+		polls += 1;
+		ec_read(UNIWILL_EC_REG_FLAGS, &tmp);
+		if (tmp & (1 << UNIWILL_EC_BIT_DRDY))
+			return polls;
+		delay_us = min(delay_us * 2, max_us);
+	} while (ktime_before(ktime_get(), deadline));
+
+	return -ETIMEDOUT;
+}
+
+/**
+ * EC access through the WMI BC method, called with uniwill_ec_lock held
+ */
 static int uw_wmi_ec_evaluate(u8 addr_low, u8 addr_high, u8 data_low, u8 data_high, u8 read_flag, u32 *return_buffer)
 {
 	acpi_status status;
@@ -61,8 +144,6 @@ static int uw_wmi_ec_evaluate(u8 addr_low, u8 addr_high, u8 data_low, u8 data_hi
 	struct acpi_buffer wmi_in = { (acpi_size) sizeof(wmi_arg), wmi_arg};
 	struct acpi_buffer wmi_out = { ACPI_ALLOCATE_BUFFER, NULL };
 
-	mutex_lock(&uniwill_ec_lock);
-
 	// Zero input buffer
 	memset(wmi_arg, 0x00, 10 * sizeof(u32));
 
@@ -92,8 +173,6 @@ static int uw_wmi_ec_evaluate(u8 addr_low, u8 addr_high, u8 data_low, u8 data_hi
 	kfree(out_acpi);
 	kfree(wmi_arg);
 
-	mutex_unlock(&uniwill_ec_lock);
-
 	return e_result;
 }
 
@@ -103,8 +182,17 @@ static int uw_wmi_ec_evaluate(u8 addr_low, u8 addr_high, u8 data_low, u8 data_hi
 static int uw_ec_read_addr_wmi(u8 addr_low, u8 addr_high, union uw_ec_read_return *output)
 {
 	u32 uw_data[10];
-	int ret = uw_wmi_ec_evaluate(addr_low, addr_high, 0x00, 0x00, 1, uw_data);
+	ktime_t start = 0;
+	int ret;
+
+	// Only timed while the tracepoint is enabled
+	if (trace_lwl_ec_read_enabled())
+		start = ktime_get();
+	ret = uw_wmi_ec_evaluate(addr_low, addr_high, 0x00, 0x00, 1, uw_data);
 	output->dword = uw_data[0];
+	if (start)
+		trace_lwl_ec_read((addr_high << 8) | addr_low, output->bytes.data_low, 0, ret,
+				  ktime_us_delta(ktime_get(), start));
 	// pr_debug("addr: 0x%02x%02x value: %0#4x (high: %0#4x) result: %d\n", addr_high, addr_low, output->bytes.data_low, output->bytes.data_high, ret);
 	return ret;
 }
@@ -115,23 +203,30 @@ static int uw_ec_read_addr_wmi(u8 addr_low, u8 addr_high, union uw_ec_read_retur
 static int uw_ec_write_addr_wmi(u8 addr_low, u8 addr_high, u8 data_low, u8 data_high, union uw_ec_write_return *output)
 {
 	u32 uw_data[10];
-	int ret = uw_wmi_ec_evaluate(addr_low, addr_high, data_low, data_high, 0, uw_data);
+	ktime_t start = 0;
+	int ret;
+
+	if (trace_lwl_ec_write_enabled())
+		start = ktime_get();
+	ret = uw_wmi_ec_evaluate(addr_low, addr_high, data_low, data_high, 0, uw_data);
 	output->dword = uw_data[0];
+	if (start)
+		trace_lwl_ec_write((addr_high << 8) | addr_low, data_low, 0, ret,
+				   ktime_us_delta(ktime_get(), start));
 	return ret;
 }
 
 /**
- * Direct EC address read
+ * Direct EC address read, called with uniwill_ec_lock held
  */
 static int uw_ec_read_addr_direct(u8 addr_low, u8 addr_high, union uw_ec_read_return *output)
 {
 	int result;
-	int count;
+	int polls;
 	u8 tmp, flags;
-	bool ready;
 	bool bflag = false;
-
-	mutex_lock(&uniwill_ec_lock);
+	u64 latency_us;
+	ktime_t start = ktime_get();
 
 	ec_read(UNIWILL_EC_REG_FLAGS, &flags);
 	if ((flags & (1 << UNIWILL_EC_BIT_BFLG)) > 0) {
@@ -150,16 +245,9 @@ static int uw_ec_read_addr_direct(u8 addr_low, u8 addr_high, union uw_ec_read_re
 	ec_write(UNIWILL_EC_REG_FLAGS, flags);
 
 	// Wait for ready flag
-	count = UW_EC_BUSY_WAIT_CYCLES;
-	ready = false;
-	while (!ready && count != 0) {
-		msleep(UW_EC_BUSY_WAIT_DELAY);
-		ec_read(UNIWILL_EC_REG_FLAGS, &tmp);
-		ready = (tmp & (1 << UNIWILL_EC_BIT_DRDY)) != 0;
-		count -= 1;
-	}
+	polls = uw_ec_wait_ready();
 
-	if (count != 0) {
+	if (polls > 0) {
 		output->dword = 0;
 		ec_read(UNIWILL_EC_REG_CMDL, &tmp);
 		output->bytes.data_low = tmp;
@@ -174,28 +262,31 @@ static int uw_ec_read_addr_direct(u8 addr_low, u8 addr_high, union uw_ec_read_re
 
 	ec_write(UNIWILL_EC_REG_FLAGS, 0x00);
 
-	mutex_unlock(&uniwill_ec_lock);
+	latency_us = uw_ec_latency_account(&uw_ec_read_stats, start, result != 0);
+	trace_lwl_ec_read((addr_high << 8) | addr_low, output->bytes.data_low, polls, result, latency_us);
 
 	if (bflag)
 		pr_debug("addr: 0x%02x%02x value: %0#4x result: %d\n", addr_high, addr_low, output->bytes.data_low, result);
 
-	if ((UW_EC_BUSY_WAIT_CYCLES - count) > 1)
-		pr_debug("read wait count: %i", (UW_EC_BUSY_WAIT_CYCLES - count));
+	if (polls > 1)
+		pr_debug("read wait count: %i", polls);
 
 	// pr_debug("addr: 0x%02x%02x value: %0#4x result: %d\n", addr_high, addr_low, output->bytes.data_low, result);
 
 	return result;
 }
 
+/**
+ * Direct EC address write, called with uniwill_ec_lock held
+ */
 static int uw_ec_write_addr_direct(u8 addr_low, u8 addr_high, u8 data_low, u8 data_high, union uw_ec_write_return *output)
 {
 	int result = 0;
-	int count;
-	u8 tmp, flags;
-	bool ready;
+	int polls;
+	u8 flags;
 	bool bflag = false;
-
-	mutex_lock(&uniwill_ec_lock);
+	u64 latency_us;
+	ktime_t start = ktime_get();
 
 	ec_read(UNIWILL_EC_REG_FLAGS, &flags);
 	if ((flags & (1 << UNIWILL_EC_BIT_BFLG)) > 0) {
@@ -216,17 +307,10 @@ static int uw_ec_write_addr_direct(u8 addr_low, u8 addr_high, u8 data_low, u8 da
 	ec_write(UNIWILL_EC_REG_FLAGS, flags);
 
 	// Wait for ready flag
-	count = UW_EC_BUSY_WAIT_CYCLES;
-	ready = false;
-	while (!ready && count != 0) {
-		msleep(UW_EC_BUSY_WAIT_DELAY);
-		ec_read(UNIWILL_EC_REG_FLAGS, &tmp);
-		ready = (tmp & (1 << UNIWILL_EC_BIT_DRDY)) != 0;
-		count -= 1;
-	}
+	polls = uw_ec_wait_ready();
 
 	// Replicate wmi output depending on success
-	if (count != 0) {
+	if (polls > 0) {
 		output->bytes.addr_low = addr_low;
 		output->bytes.addr_high = addr_high;
 		output->bytes.data_low = data_low;
@@ -240,18 +324,19 @@ static int uw_ec_write_addr_direct(u8 addr_low, u8 addr_high, u8 data_low, u8 da
 
 	ec_write(UNIWILL_EC_REG_FLAGS, 0x00);
 
+	latency_us = uw_ec_latency_account(&uw_ec_write_stats, start, result != 0);
+	trace_lwl_ec_write((addr_high << 8) | addr_low, data_low, polls, result, latency_us);
+
 	if (bflag)
 		pr_debug("addr: 0x%02x%02x value: %0#4x result: %d\n", addr_high, addr_low, data_low, result);
 
-	if ((UW_EC_BUSY_WAIT_CYCLES - count) > 1)
-		pr_debug("write wait count: %i", (UW_EC_BUSY_WAIT_CYCLES - count));
-
-	mutex_unlock(&uniwill_ec_lock);
+	if (polls > 1)
+		pr_debug("write wait count: %i", polls);
 
 	return result;
 }
 
-static int uw_wmi_read_ec_ram(u16 addr, u8 *data)
+static int __uw_wmi_read_ec_ram(u16 addr, u8 *data)
 {
 	int result;
 	u8 addr_low, addr_high;
@@ -273,7 +358,7 @@ static int uw_wmi_read_ec_ram(u16 addr, u8 *data)
 	return result;
 }
 
-static int uw_wmi_write_ec_ram(u16 addr, u8 data)
+static int __uw_wmi_write_ec_ram(u16 addr, u8 data)
 {
 	int result;
 	u8 addr_low, addr_high, data_low, data_high;
@@ -292,10 +377,144 @@ static int uw_wmi_write_ec_ram(u16 addr, u8 data)
 	return result;
 }
 
+static int uw_wmi_read_ec_ram(u16 addr, u8 *data)
+{
+	int result;
+
+	mutex_lock(&uniwill_ec_lock);
+	result = __uw_wmi_read_ec_ram(addr, data);
+	mutex_unlock(&uniwill_ec_lock);
+
+	return result;
+}
+
+static int uw_wmi_write_ec_ram(u16 addr, u8 data)
+{
+	int result;
+
+	mutex_lock(&uniwill_ec_lock);
+	result = __uw_wmi_write_ec_ram(addr, data);
+	mutex_unlock(&uniwill_ec_lock);
+
+	return result;
+}
+
+static int __uw_wmi_ec_op(struct uniwill_ec_op_t *op)
+{
+	int result;
+	u8 data;
+
+	switch (op->type) {
+	case UW_EC_OP_READ:
+		return __uw_wmi_read_ec_ram(op->addr, &op->data);
+	case UW_EC_OP_WRITE:
+		return __uw_wmi_write_ec_ram(op->addr, op->data);
+	case UW_EC_OP_WRITE_VERIFY:
+		result = __uw_wmi_write_ec_ram(op->addr, op->data);
+		if (result)
+			return result;
+		result = __uw_wmi_read_ec_ram(op->addr, &data);
+		if (result)
+			return result;
+		return data == op->data ? 0 : -EIO;
+	case UW_EC_OP_UPDATE_BITS:
+		result = __uw_wmi_read_ec_ram(op->addr, &data);
+		if (result)
+			return result;
+		op->data = (data & ~op->mask) | (op->data & op->mask);
+		return __uw_wmi_write_ec_ram(op->addr, op->data);
+	default:
+		return -EINVAL;
+	}
+}
+
+/**
+ * Run a list of EC operations under a single uniwill_ec_lock hold
+ *
+ * Execution stops at the first failing operation, the remaining
+ * operations are marked with -ECANCELED.
+ *
+ * Returns 0 or the status of the failed operation
+ */
+static int uw_wmi_ec_transaction(struct uniwill_ec_op_t *ops, int count)
+{
+	int i, result = 0;
+
+	mutex_lock(&uniwill_ec_lock);
+	for (i = 0; i < count; ++i) {
+		if (result) {
+			ops[i].status = -ECANCELED;
+			continue;
+		}
+		ops[i].status = __uw_wmi_ec_op(&ops[i]);
+		result = ops[i].status;
+	}
+	mutex_unlock(&uniwill_ec_lock);
+
+	return result;
+}
+
+static void uw_ec_latency_show_one(struct seq_file *m, const char *name,
+				   struct uw_ec_latency_stats_t *stats)
+{
+	int i;
+
+	seq_printf(m, "%s: count %llu timeouts %llu avg_us %llu max_us %llu\n", name,
+		   stats->count, stats->timeouts,
+		   stats->count ? div64_u64(stats->total_us, stats->count) : 0,
+		   stats->max_us);
+	for (i = 0; i < UW_EC_LATENCY_BUCKETS - 1; ++i)
+		seq_printf(m, "  < %6llu us: %llu\n", 1ULL << (i + 6), stats->buckets[i]);
+	seq_printf(m, "  >= %5llu us: %llu\n", 1ULL << (i + 5), stats->buckets[i]);
+}
+
+static int uw_ec_latency_show(struct seq_file *m, void *unused)
+{
+	mutex_lock(&uniwill_ec_lock);
+	uw_ec_latency_show_one(m, "read", &uw_ec_read_stats);
+	uw_ec_latency_show_one(m, "write", &uw_ec_write_stats);
+	mutex_unlock(&uniwill_ec_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(uw_ec_latency);
+
+static ssize_t uw_ec_latency_reset_write(struct file *file, const char __user *buf,
+					 size_t count, loff_t *ppos)
+{
+	mutex_lock(&uniwill_ec_lock);
+	memset(&uw_ec_read_stats, 0, sizeof(uw_ec_read_stats));
+	memset(&uw_ec_write_stats, 0, sizeof(uw_ec_write_stats));
+	mutex_unlock(&uniwill_ec_lock);
+
+	return count;
+}
+
+static const struct file_operations uw_ec_latency_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = uw_ec_latency_reset_write,
+	.llseek = noop_llseek,
+};
+
+static void uw_ec_debugfs_init(void)
+{
+	uw_ec_debugfs_dir = debugfs_create_dir(UNIWILL_INTERFACE_WMI_STRID, NULL);
+	debugfs_create_file("ec_latency", 0444, uw_ec_debugfs_dir, NULL, &uw_ec_latency_fops);
+	debugfs_create_file("ec_latency_reset", 0200, uw_ec_debugfs_dir, NULL, &uw_ec_latency_reset_fops);
+}
+
+static void uw_ec_debugfs_remove(void)
+{
+	debugfs_remove_recursive(uw_ec_debugfs_dir);
+	uw_ec_debugfs_dir = NULL;
+}
+
 struct uniwill_interface_t uniwill_wmi_interface = {
 	.string_id = UNIWILL_INTERFACE_WMI_STRID,
 	.read_ec_ram = uw_wmi_read_ec_ram,
-	.write_ec_ram = uw_wmi_write_ec_ram
+	.write_ec_ram = uw_wmi_write_ec_ram,
+	.ec_transaction = uw_wmi_ec_transaction
 };
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 3, 0)
@@ -320,6 +539,8 @@ static int uniwill_wmi_probe(struct wmi_device *wdev, const void *dummy_context)
 		return -ENODEV;
 	}
 
+	uw_ec_debugfs_init();
+
 	uniwill_add_interface(&uniwill_wmi_interface);
 
 	pr_info("interface initialized\n");
@@ -335,6 +556,7 @@ static void uniwill_wmi_remove(struct wmi_device *wdev)
 {
 	pr_debug("uniwill_wmi driver remove\n");
 	uniwill_remove_interface(&uniwill_wmi_interface);
+	uw_ec_debugfs_remove();
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 13, 0)
 	return 0;
 #endif
@@ -394,5 +616,13 @@ MODULE_LICENSE("GPL");
 module_param_cb(ec_direct_io, &param_ops_bool, &uniwill_ec_direct, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
 MODULE_PARM_DESC(ec_direct_io, "Do not use WMI methods to read/write EC RAM (default: true).");
 
+/*
+ * Upper bound for the interval between two polls of the EC ready flag in
+ * direct mode. Polling starts at UW_EC_BUSY_WAIT_MIN_US and doubles until
+ * this ceiling is reached.
+ */
+module_param_named(ec_wait_max_us, uniwill_ec_wait_max_us, uint, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ec_wait_max_us, "Maximum EC ready poll interval in microseconds (default: 15000).");
+
 MODULE_DEVICE_TABLE(wmi, uniwill_wmi_device_ids);
 MODULE_ALIAS_UNIWILL_WMI();